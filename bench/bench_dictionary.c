@@ -0,0 +1,113 @@
+/*
+ * bench_dictionary.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include "../src/messages.h"
+
+#define BENCH_LOOKUPS 10000000
+#define BENCH_REPEAT 3
+
+static void bench_callback(const PackageData* data, Package* output, unsigned int* sizeOutput) {
+    *sizeOutput = 0;
+}
+
+/* It returns the best time of a lookup, in ns. The names are copies of the
+ * words, so lookups can't compare pointers */
+static double bench_run(MessageHandler* mh, char** names, unsigned int count) {
+    gint64 start = 0;
+    gint64 best = G_MAXINT64;
+    gint64 sum = 0;
+    unsigned int i = 0;
+    int j = 0;
+
+    for (j = 0; j < BENCH_REPEAT; j++) {
+        start = g_get_monotonic_time();
+
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+            sum += mh_resolve_word(mh, names[i % count]);
+        }
+
+        best = MIN(best, g_get_monotonic_time() - start);
+    }
+
+    g_assert(sum > 0 || count == 1);
+
+    return best * 1e3 / BENCH_LOOKUPS;
+}
+
+int main(int argc, char** argv) {
+    const unsigned int sizes[] = { 10, 1000, 100000 };
+    MessageHandler* mh = NULL;
+    GRand* rand = NULL;
+    char** names = NULL;
+    char* word = NULL;
+    char* swap = NULL;
+    double dynamic = 0;
+    double frozen = 0;
+    gint64 start = 0;
+    gint64 build = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    size_t k = 0;
+
+    rand = g_rand_new_with_seed(42);
+
+    printf("%10s %14s %14s %14s %10s\n", "words", "freeze [ms]", "dynamic [ns]", "frozen [ns]", "speedup");
+
+    for (k = 0; k < G_N_ELEMENTS(sizes); k++) {
+        mh = mh_new();
+        names = g_new(char*, sizes[k]);
+
+        for (i = 0; i < sizes[k]; i++) {
+            word = g_strdup_printf("axis.%u.position", i);
+            mh_add_word(mh, word, bench_callback);
+            names[i] = word;
+        }
+
+        /* the words are looked up in random order */
+        for (i = sizes[k] - 1; i > 0; i--) {
+            j = g_rand_int_range(rand, 0, i + 1);
+            swap = names[i];
+            names[i] = names[j];
+            names[j] = swap;
+        }
+
+        dynamic = bench_run(mh, names, sizes[k]);
+
+        start = g_get_monotonic_time();
+        g_assert(mh_freeze(mh));
+        build = g_get_monotonic_time() - start;
+
+        frozen = bench_run(mh, names, sizes[k]);
+
+        printf("%10u %14.2f %14.1f %14.1f %9.1fx\n", sizes[k], build / 1e3, dynamic, frozen, dynamic / frozen);
+
+        for (i = 0; i < sizes[k]; i++) {
+            g_free(names[i]);
+        }
+
+        g_free(names);
+        mh_free(mh);
+    }
+
+    g_rand_free(rand);
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * bench_ini.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../src/config.h"
+#include "../src/ini.h"
+
+#define BENCH_GROUP "Bench"
+#define BENCH_REPEAT 3
+
+/* It writes a configuration file with the given number of keys */
+static char* bench_generate_file(unsigned int keys) {
+    GString* data = NULL;
+    char* path = NULL;
+    unsigned int i = 0;
+
+    data = g_string_sized_new(keys * 32);
+
+    g_string_append(data, "# generated by bench_ini\n[Other]\nkey=value\n\n[" BENCH_GROUP "]\n");
+
+    for (i = 0; i < keys; i++) {
+        g_string_append_printf(data, "axis.%u.gain = %u.%u\n", i, i, i % 10);
+    }
+
+    path = g_strdup_printf("%s/bench_ini_%u.cfg", g_get_tmp_dir(), keys);
+
+    g_file_set_contents(path, data->str, data->len, NULL);
+    g_string_free(data, TRUE);
+
+    return path;
+}
+
+/* The GKeyFile path, as it was used to load configurations */
+static unsigned int bench_load_gkeyfile(const char* path) {
+    GKeyFile* keyFile = NULL;
+    GHashTable* table = NULL;
+    char** keys = NULL;
+    gsize length = 0;
+    gsize i = 0;
+    unsigned int size = 0;
+
+    keyFile = g_key_file_new();
+    g_key_file_load_from_file(keyFile, path, G_KEY_FILE_NONE, NULL);
+
+    table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    keys = g_key_file_get_keys(keyFile, BENCH_GROUP, &length, NULL);
+
+    for (i = 0; i < length; i++) {
+        g_hash_table_insert(table, g_strdup(keys[i]), g_key_file_get_value(keyFile, BENCH_GROUP, keys[i], NULL));
+    }
+
+    size = g_hash_table_size(table);
+
+    g_strfreev(keys);
+    g_hash_table_destroy(table);
+    g_key_file_free(keyFile);
+
+    return size;
+}
+
+static unsigned int bench_load_cfg(const char* path) {
+    CfgFile* cfg = NULL;
+    unsigned int size = 0;
+
+    cfg = cfg_load(path, BENCH_GROUP);
+    size = cfg_get_size(cfg);
+    cfg_free(cfg);
+
+    return size;
+}
+
+static void bench_count_entry(const IniEntry* entry, void* userData) {
+    (*(unsigned int*)userData)++;
+}
+
+static unsigned int bench_parse_only(const char* path) {
+    unsigned int size = 0;
+
+    ini_parse_file(path, bench_count_entry, &size);
+
+    return size;
+}
+
+/* It returns the best time of BENCH_REPEAT runs, in seconds */
+static double bench_run(unsigned int (*load)(const char*), const char* path, unsigned int expected) {
+    gint64 start = 0;
+    gint64 best = G_MAXINT64;
+    unsigned int size = 0;
+    int i = 0;
+
+    for (i = 0; i < BENCH_REPEAT; i++) {
+        start = g_get_monotonic_time();
+        size = load(path);
+        best = MIN(best, g_get_monotonic_time() - start);
+
+        g_assert(size >= expected);
+    }
+
+    return (double)best / G_USEC_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+    const unsigned int sizes[] = { 10000, 100000, 1000000 };
+    GStatBuf st;
+    char* path = NULL;
+    double mbytes = 0;
+    double gkeyfile = 0;
+    double cfg = 0;
+    double parse = 0;
+    size_t i = 0;
+
+    printf("%10s %10s %14s %14s %14s %10s\n", "keys", "MB", "GKeyFile [s]", "cfg_load [s]", "parse [MB/s]", "speedup");
+
+    for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        path = bench_generate_file(sizes[i]);
+
+        g_stat(path, &st);
+        mbytes = (double)st.st_size / (1024 * 1024);
+
+        gkeyfile = bench_run(bench_load_gkeyfile, path, sizes[i]);
+        cfg = bench_run(bench_load_cfg, path, sizes[i]);
+        parse = bench_run(bench_parse_only, path, sizes[i]);
+
+        printf("%10u %10.1f %14.4f %14.4f %14.1f %9.1fx\n",
+            sizes[i], mbytes, gkeyfile, cfg, mbytes / parse, gkeyfile / cfg);
+
+        g_unlink(path);
+        g_free(path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * bench_replay.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../src/messages.h"
+#include "../src/recorder.h"
+
+#define BENCH_PACKAGES 1000000
+#define BENCH_REALTIME_PACKAGES 1000
+#define BENCH_REALTIME_INTERVAL 500     /* in us */
+
+static WireField _fields[] = { { WIRE_FIELD_INT, 0 }, { WIRE_FIELD_DOUBLE, 0 }, { WIRE_FIELD_STRING, 0 } };
+static WireDescriptor _desc = { 3, _fields };
+
+static const char* _words[] = { "POSITION", "SPEED", "STATUS", "ALARM" };
+
+static void bench_handle(const PackageData* data, Package* output, unsigned int* sizeOutput) {
+    *sizeOutput = 0;
+}
+
+/* It records the given number of packages, sent every interval us */
+static void bench_record(const char* path, unsigned int packages, unsigned int interval) {
+    MessageHandler* mh = NULL;
+    Recorder* rec = NULL;
+    PackageData data[3];
+    Package pkg;
+    Package output;
+    double value = 0;
+    unsigned int size = 0;
+    unsigned int i = 0;
+
+    mh = mh_new();
+    rec = rec_new(path);
+    g_assert(rec != NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(_words); i++) {
+        mh_add_word(mh, _words[i], bench_handle);
+        rec_add_word(rec, _words[i], &_desc);
+    }
+
+    pkg.size = 3;
+    pkg.data = data;
+
+    data[1].field = &value;
+    data[2].field = "axis";
+
+    rec_start(rec, mh);
+
+    for (i = 0; i < packages; i++) {
+        value = i * 0.5;
+        data[0].field = GINT_TO_POINTER(i);
+
+        pkg.name = (char*)_words[i % G_N_ELEMENTS(_words)];
+        mh_send_data(mh, pkg, &output, &size);
+
+        if (interval > 0)
+            g_usleep(interval);
+    }
+
+    rec_stop(rec, mh);
+    g_assert(rec_get_recorded(rec) == packages);
+
+    rec_free(rec);
+    mh_free(mh);
+}
+
+static void bench_replay(const char* path, const char* mode, int realTime) {
+    MessageHandler* mh = NULL;
+    ReplayStats stats;
+    unsigned int i = 0;
+
+    mh = mh_new();
+
+    for (i = 0; i < G_N_ELEMENTS(_words); i++) {
+        mh_add_word(mh, _words[i], bench_handle);
+    }
+
+    g_assert(rec_replay(path, mh, realTime, &stats));
+
+    printf("%12s %10u %12.3f %14.0f %12llu %12llu %12llu\n", mode, stats.packages, stats.duration,
+        stats.throughput, stats.medianLatency, stats.p99Latency, stats.maxLatency);
+
+    mh_free(mh);
+}
+
+int main(int argc, char** argv) {
+    char* path = NULL;
+
+    path = g_build_filename(g_get_tmp_dir(), "bench_replay.log", NULL);
+
+    printf("%12s %10s %12s %14s %12s %12s %12s\n", "mode", "packages", "time [s]", "packages/s",
+        "median [ns]", "p99 [ns]", "max [ns]");
+
+    bench_record(path, BENCH_PACKAGES, 0);
+    bench_replay(path, "fast", FALSE);
+
+    bench_record(path, BENCH_REALTIME_PACKAGES, BENCH_REALTIME_INTERVAL);
+    bench_replay(path, "original", TRUE);
+
+    g_unlink(path);
+    g_free(path);
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * bench_ring.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <glib.h>
+#include "../src/ring_buffer.h"
+#include "../src/messages.h"
+
+#define BENCH_ITEMS 1000000
+#define BENCH_RING_SIZE 4096
+
+/* one latency sample every BENCH_SAMPLE_RATE items */
+#define BENCH_SAMPLE_RATE 64
+
+typedef struct {
+    RingBuffer* rb;
+    GAsyncQueue* queue;
+    MessageHandler* mh;
+    unsigned int items;         /* items to push or to pop */
+    gint64* stamps;             /* enqueue time of the items, in ns */
+    GArray* latencies;          /* sampled latencies, in ns */
+} benchThread;
+
+static gint64 bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_sample(benchThread* thread, unsigned int i, const gint64* stamp) {
+    gint64 latency = 0;
+
+    if (i % BENCH_SAMPLE_RATE == 0) {
+        latency = bench_now() - *stamp;
+        g_array_append_val(thread->latencies, latency);
+    }
+}
+
+static void* bench_ring_producer(void* data) {
+    benchThread* thread = (benchThread*)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < thread->items; i++) {
+        thread->stamps[i] = bench_now();
+
+        while (!rb_try_push(thread->rb, &thread->stamps[i])) {
+            g_thread_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void* bench_ring_consumer(void* data) {
+    benchThread* thread = (benchThread*)data;
+    void* item = NULL;
+    unsigned int i = 0;
+
+    for (i = 0; i < thread->items; i++) {
+        while (!rb_try_pop(thread->rb, &item)) {
+            g_thread_yield();
+        }
+
+        bench_sample(thread, i, item);
+    }
+
+    return NULL;
+}
+
+static void* bench_queue_producer(void* data) {
+    benchThread* thread = (benchThread*)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < thread->items; i++) {
+        thread->stamps[i] = bench_now();
+        g_async_queue_push(thread->queue, &thread->stamps[i]);
+    }
+
+    return NULL;
+}
+
+static void* bench_queue_consumer(void* data) {
+    benchThread* thread = (benchThread*)data;
+    unsigned int i = 0;
+
+    for (i = 0; i < thread->items; i++) {
+        bench_sample(thread, i, g_async_queue_pop(thread->queue));
+    }
+
+    return NULL;
+}
+
+static void* bench_mh_producer(void* data) {
+    benchThread* thread = (benchThread*)data;
+    PackageData pkgData;
+    Package pkg;
+    unsigned int i = 0;
+
+    pkg.name = "BENCH";
+    pkg.size = 1;
+    pkg.data = &pkgData;
+
+    for (i = 0; i < thread->items; i++) {
+        while (!mh_try_post(thread->mh, pkg, NULL, NULL)) {
+            g_thread_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void bench_mh_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+    *sizeOutput = 0;
+}
+
+static int bench_compare_latency(const void* a, const void* b) {
+    gint64 first = *(const gint64*)a;
+    gint64 second = *(const gint64*)b;
+
+    return (first > second) - (first < second);
+}
+
+/* It runs the producers and the consumers, then it prints throughput and latency */
+static void bench_run(const char* name, int producers, int consumers, GThreadFunc producerFunc, GThreadFunc consumerFunc) {
+    benchThread* threads = NULL;
+    GThread** handles = NULL;
+    GArray* latencies = NULL;
+    RingBuffer* rb = NULL;
+    GAsyncQueue* queue = NULL;
+    MessageHandler* mh = NULL;
+    gint64 start = 0;
+    double seconds = 0;
+    int total = producers + consumers;
+    int i = 0;
+
+    rb = rb_new(BENCH_RING_SIZE);
+    queue = g_async_queue_new();
+
+    /* consumers are the worker pool of the message handler */
+    if (consumerFunc == NULL) {
+        mh = mh_new();
+        mh_add_word(mh, "BENCH", bench_mh_callback);
+        mh_set_workers(mh, consumers);
+        mh_set_queue(mh, BENCH_RING_SIZE, MSG_QUEUE_BLOCK);
+        total = producers;
+    }
+
+    threads = g_new0(benchThread, total);
+    handles = g_new0(GThread*, total);
+    latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    for (i = 0; i < total; i++) {
+        threads[i].rb = rb;
+        threads[i].queue = queue;
+        threads[i].mh = mh;
+        threads[i].latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+        if (i < producers) {
+            threads[i].items = BENCH_ITEMS / producers;
+            threads[i].stamps = g_new(gint64, threads[i].items);
+        } else {
+            threads[i].items = (BENCH_ITEMS / producers) * producers / consumers;
+        }
+    }
+
+    start = bench_now();
+
+    for (i = 0; i < total; i++) {
+        handles[i] = g_thread_new("bench", i < producers ? producerFunc : consumerFunc, &threads[i]);
+    }
+
+    for (i = 0; i < total; i++) {
+        g_thread_join(handles[i]);
+    }
+
+    if (mh != NULL)
+        mh_flush(mh);
+
+    seconds = (double)(bench_now() - start) / 1e9;
+
+    for (i = 0; i < total; i++) {
+        g_array_append_vals(latencies, threads[i].latencies->data, threads[i].latencies->len);
+        g_array_free(threads[i].latencies, TRUE);
+        g_free(threads[i].stamps);
+    }
+
+    qsort(latencies->data, latencies->len, sizeof(gint64), bench_compare_latency);
+
+    if (latencies->len > 0) {
+        printf("%-14s %5d %5d %12.2f %12.2f %12.2f\n", name, producers, consumers,
+            (BENCH_ITEMS / producers) * producers / seconds / 1e6,
+            g_array_index(latencies, gint64, latencies->len / 2) / 1e3,
+            g_array_index(latencies, gint64, latencies->len * 99 / 100) / 1e3);
+    } else {
+        printf("%-14s %5d %5d %12.2f %12s %12s\n", name, producers, consumers,
+            (BENCH_ITEMS / producers) * producers / seconds / 1e6, "-", "-");
+    }
+
+    if (mh != NULL)
+        mh_free(mh);
+
+    g_array_free(latencies, TRUE);
+    g_free(handles);
+    g_free(threads);
+    g_async_queue_unref(queue);
+    rb_free(rb);
+}
+
+int main(int argc, char** argv) {
+    const int counts[] = { 1, 2, 4 };
+    size_t p = 0;
+    size_t c = 0;
+
+    printf("%-14s %5s %5s %12s %12s %12s\n", "queue", "prod", "cons", "Mmsg/s", "p50 [us]", "p99 [us]");
+
+    for (p = 0; p < G_N_ELEMENTS(counts); p++) {
+        for (c = 0; c < G_N_ELEMENTS(counts); c++) {
+            bench_run("RingBuffer", counts[p], counts[c], bench_ring_producer, bench_ring_consumer);
+            bench_run("GAsyncQueue", counts[p], counts[c], bench_queue_producer, bench_queue_consumer);
+            bench_run("mh_try_post", counts[p], counts[c], bench_mh_producer, NULL);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * bench_shm.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include "../src/messages.h"
+#include "../src/shm_channel.h"
+
+#define BENCH_CALLS 200000
+#define BENCH_REPEAT 3
+
+static WireField _fields[] = { { WIRE_FIELD_INT, 0 }, { WIRE_FIELD_BLOB, 0 } };
+static WireDescriptor _desc = { 2, _fields };
+
+/* the handler returns the package it received */
+static void bench_echo(const PackageData* data, Package* output, unsigned int* sizeOutput) {
+    PackageData* outputData = mh_alloc_output(2);
+
+    outputData[0].field = data[0].field;
+    outputData[1].field = data[1].field;
+
+    output->name = "ECHO";
+    output->size = 2;
+    output->data = outputData;
+    *sizeOutput = 2;
+}
+
+/* It returns the best time of a call, in ns */
+static double bench_run(MessageHandler* mh, Package pkg) {
+    Package output;
+    unsigned int size = 0;
+    gint64 start = 0;
+    gint64 best = G_MAXINT64;
+    int i = 0;
+    int j = 0;
+
+    for (j = 0; j < BENCH_REPEAT; j++) {
+        start = g_get_monotonic_time();
+
+        for (i = 0; i < BENCH_CALLS; i++) {
+            pkg.data[0].field = GINT_TO_POINTER(i);
+            mh_send_data(mh, pkg, &output, &size);
+
+            g_assert(size == 2 && GPOINTER_TO_INT(output.data[0].field) == i);
+            mh_release_output(mh, &output);
+        }
+
+        best = MIN(best, g_get_monotonic_time() - start);
+    }
+
+    return best * 1e3 / BENCH_CALLS;
+}
+
+int main(int argc, char** argv) {
+    const unsigned int blobs[] = { 0, 64, 1024, 16384 };
+    MessageHandler* local = NULL;
+    MessageHandler* remote = NULL;
+    ShmChannel* channel = NULL;
+    PackageData data[2];
+    Package pkg;
+    guint8* blob = NULL;
+    double localTime = 0;
+    double remoteTime = 0;
+    pid_t child = 0;
+    size_t i = 0;
+
+    blob = g_malloc0(blobs[G_N_ELEMENTS(blobs) - 1]);
+
+    data[1].field = blob;
+
+    pkg.name = "ECHO";
+    pkg.size = 2;
+    pkg.data = data;
+
+    printf("%10s %14s %14s %10s\n", "blob [B]", "local [ns]", "remote [ns]", "ratio");
+
+    for (i = 0; i < G_N_ELEMENTS(blobs); i++) {
+        _fields[1].length = blobs[i];
+
+        channel = shm_channel_new(1024 * 1024);
+        g_assert(channel != NULL);
+
+        child = fork();
+        g_assert(child >= 0);
+
+        if (child == 0) {
+            remote = mh_new();
+            mh_add_word(remote, "ECHO", bench_echo);
+            shm_channel_add_output(channel, "ECHO", &_desc);
+            shm_channel_serve(channel, remote);
+            mh_free(remote);
+            _exit(0);
+        }
+
+        local = mh_new();
+        mh_add_word(local, "ECHO", bench_echo);
+
+        remote = mh_new();
+        shm_channel_add_remote_word(channel, remote, "ECHO", &_desc);
+
+        localTime = bench_run(local, pkg);
+        remoteTime = bench_run(remote, pkg);
+
+        printf("%10u %14.1f %14.1f %9.1fx\n", blobs[i], localTime, remoteTime, remoteTime / localTime);
+
+        shm_channel_close(channel);
+        waitpid(child, NULL, 0);
+
+        mh_free(local);
+        mh_free(remote);
+        shm_channel_free(channel);
+    }
+
+    g_free(blob);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * bench_wire.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "../src/wire.h"
+
+#define BENCH_BYTES (256 * 1024 * 1024)
+#define BENCH_REPEAT 3
+
+/* It encodes packages until the buffer is full, and returns the bytes written */
+static size_t bench_encode(const Package* pkg, const WireDescriptor* desc, guint8* buffer, size_t size, unsigned int* count) {
+    size_t offset = 0;
+    size_t written = 0;
+
+    *count = 0;
+
+    while ((written = wire_encode(pkg, desc, buffer + offset, size - offset)) > 0) {
+        offset += written;
+        (*count)++;
+    }
+
+    return offset;
+}
+
+/* It decodes all the packages of the buffer, and returns the sum of their first field */
+static gint64 bench_decode(const guint8* buffer, size_t size) {
+    PackageData data[4];
+    Package pkg;
+    size_t offset = 0;
+    size_t read = 0;
+    gint64 sum = 0;
+
+    while (offset < size && (read = wire_decode(buffer + offset, size - offset, &pkg, data, 4, NULL)) > 0) {
+        sum += GPOINTER_TO_INT(data[0].field);
+        offset += read;
+    }
+
+    g_assert(offset == size);
+
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    const unsigned int blobs[] = { 16, 256, 4096, 65536 };
+    WireField fields[] = {
+        { WIRE_FIELD_INT, 0 },
+        { WIRE_FIELD_DOUBLE, 0 },
+        { WIRE_FIELD_STRING, 0 },
+        { WIRE_FIELD_BLOB, 0 }
+    };
+    WireDescriptor desc = { G_N_ELEMENTS(fields), fields };
+    PackageData data[4];
+    Package pkg;
+    gdouble position = 1.5;
+    guint8* buffer = NULL;
+    guint8* blob = NULL;
+    size_t bytes = 0;
+    unsigned int count = 0;
+    gint64 start = 0;
+    gint64 encode = 0;
+    gint64 decode = 0;
+    size_t i = 0;
+    int j = 0;
+
+    buffer = g_malloc(BENCH_BYTES);
+    blob = g_malloc0(blobs[G_N_ELEMENTS(blobs) - 1]);
+
+    data[0].field = GINT_TO_POINTER(1);
+    data[1].field = &position;
+    data[2].field = "axis position";
+    data[3].field = blob;
+
+    pkg.name = "axis.1.position";
+    pkg.size = 4;
+    pkg.data = data;
+
+    printf("%10s %12s %12s %14s %14s\n", "blob [B]", "packages", "MB", "encode [GB/s]", "decode [GB/s]");
+
+    for (i = 0; i < G_N_ELEMENTS(blobs); i++) {
+        fields[3].length = blobs[i];
+        encode = G_MAXINT64;
+        decode = G_MAXINT64;
+
+        /* the best of BENCH_REPEAT runs */
+        for (j = 0; j < BENCH_REPEAT; j++) {
+            start = g_get_monotonic_time();
+            bytes = bench_encode(&pkg, &desc, buffer, BENCH_BYTES, &count);
+            encode = MIN(encode, g_get_monotonic_time() - start);
+
+            start = g_get_monotonic_time();
+            g_assert(bench_decode(buffer, bytes) == count);
+            decode = MIN(decode, g_get_monotonic_time() - start);
+        }
+
+        printf("%10u %12u %12.1f %14.2f %14.2f\n", blobs[i], count, bytes / 1e6,
+            bytes / 1e3 / MAX(encode, 1), bytes / 1e3 / MAX(decode, 1));
+    }
+
+    g_free(blob);
+    g_free(buffer);
+
+    return 0;
+}
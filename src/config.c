@@ -17,30 +17,349 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* st_mtim, the modification time in nanoseconds */
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "config.h"
 #include "definitions.h"
+#include "ini.h"
 #include "utils.h"
 
+#define CFG_STRINGS_BLOCK_SIZE 4096
+
+/* A read-only view of the configuration items. Readers hold a reference while they
+ * access it, so a reload can swap in a new snapshot without waiting for them. */
+typedef struct {
+    GHashTable* data;
+    GPtrArray* index;       /* keys of data, in ascending order */
+    GStringChunk* strings;  /* arena of keys and values */
+    gsize stringsSize;      /* bytes stored in the arena */
+    gsize garbageSize;      /* bytes of the replaced values */
+    int refCount;
+} CfgSnapshot;
+
+/* The context of a configuration parsing */
+typedef struct {
+    const char* name;
+    CfgSnapshot* snapshot;
+    int found;
+} CfgLoadContext;
+
+/* A change event handler container */
+typedef struct {
+    cfgChangeFunc callback;
+    void* userData;
+} CfgEventContainer;
+
+/* A layer of the layered view */
+typedef struct {
+    CfgLayers* layers;
+    CfgFile* cfg;
+    unsigned int level;
+} CfgLayer;
+
+/* An effective item of the layered view */
+typedef struct {
+    char* value;
+    unsigned int level;
+} CfgLayerItem;
+
+/* The layered view. Items are merged once and updated on every layer change */
+struct CfgLayers_type {
+    GPtrArray* layers;
+    GHashTable* items;
+    GRWLock lock;
+};
+
 /* Define the abstract data type */
 struct CfgFile_type {
-    const char* file;
-    const char* name;
-    GHashTable* data;
+    char* file;
+    char* name;
+
+    /* current snapshot, swapped under lock */
+    CfgSnapshot* snapshot;
+    GMutex lock;
+
+    /* serializes reloads and changes, so that change events are notified in order */
+    GRecMutex notifyLock;
+    gint64 fileTime;            /* modification time of the parsed file, in ns */
+    gint64 fileSize;
+
+    /* file watcher */
+    GThread* watcher;
+    GMutex watchLock;
+    GCond watchCond;
+    int watching;
+    unsigned int interval;
+
+    /* Event handlers */
+    GSList* changeEventHandler;
 };
 
-static CfgFile* cfg_mask_new(const char* file, const char* name, GHashTable* data) {
+static int cfg_index_compare(const void* a, const void* b) {
+    return g_strcmp0(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* Returns the position of the first key which is not lower than key */
+static unsigned int cfg_index_lower_bound(GPtrArray* index, const char* key) {
+    unsigned int low = 0;
+    unsigned int high = index->len;
+    unsigned int middle = 0;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+
+        if (g_strcmp0(g_ptr_array_index(index, middle), key) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+/* Returns the position of the first key which is greater than all the keys starting with prefix */
+static unsigned int cfg_index_prefix_end(GPtrArray* index, const char* prefix) {
+    unsigned int low = 0;
+    unsigned int high = index->len;
+    unsigned int middle = 0;
+    size_t length = strlen(prefix);
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+
+        if (strncmp(g_ptr_array_index(index, middle), prefix, length) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static CfgSnapshot* cfg_snapshot_new(void) {
+    CfgSnapshot* snapshot = NULL;
+
+    snapshot = g_new(CfgSnapshot, 1);
+    snapshot->data = g_hash_table_new(g_str_hash, g_str_equal);
+    snapshot->index = g_ptr_array_new();
+    snapshot->strings = g_string_chunk_new(CFG_STRINGS_BLOCK_SIZE);
+    snapshot->stringsSize = 0;
+    snapshot->garbageSize = 0;
+    snapshot->refCount = 1;
+
+    return snapshot;
+}
+
+static char* cfg_snapshot_store(CfgSnapshot* snapshot, const char* string, gsize length) {
+    snapshot->stringsSize += length + 1;
+
+    return g_string_chunk_insert_len(snapshot->strings, string, length);
+}
+
+static void cfg_snapshot_unref(CfgSnapshot* snapshot) {
+    g_assert(snapshot != NULL);
+
+    if (g_atomic_int_dec_and_test(&snapshot->refCount)) {
+        g_ptr_array_free(snapshot->index, TRUE);
+        g_hash_table_destroy(snapshot->data);
+        g_string_chunk_free(snapshot->strings);
+        g_free(snapshot);
+    }
+}
+
+/* It sets a value without sorting the index. Used while parsing, then cfg_snapshot_sort() is called */
+static void cfg_snapshot_append(CfgSnapshot* snapshot, const IniString* key, const IniString* value) {
+    char* keyPtr = NULL;
+    void* oldKey = NULL;
+    void* oldValue = NULL;
+
+    keyPtr = cfg_snapshot_store(snapshot, key->str, key->len);
+
+    if (g_hash_table_lookup_extended(snapshot->data, keyPtr, &oldKey, &oldValue)) {
+        snapshot->garbageSize += key->len + strlen(oldValue) + 2;
+        g_hash_table_insert(snapshot->data, oldKey, cfg_snapshot_store(snapshot, value->str, value->len));
+        return;
+    }
+
+    g_hash_table_insert(snapshot->data, keyPtr, cfg_snapshot_store(snapshot, value->str, value->len));
+    g_ptr_array_add(snapshot->index, keyPtr);
+}
+
+static void cfg_snapshot_sort(CfgSnapshot* snapshot) {
+    g_ptr_array_sort(snapshot->index, cfg_index_compare);
+}
+
+/* It sets a value, keeping the index sorted */
+static void cfg_snapshot_insert(CfgSnapshot* snapshot, const char* key, const char* value) {
+    char* keyPtr = NULL;
+    void* oldKey = NULL;
+    void* oldValue = NULL;
+
+    if (g_hash_table_lookup_extended(snapshot->data, key, &oldKey, &oldValue)) {
+        snapshot->garbageSize += strlen(oldValue) + 1;
+        g_hash_table_insert(snapshot->data, oldKey, cfg_snapshot_store(snapshot, value, strlen(value)));
+        return;
+    }
+
+    keyPtr = cfg_snapshot_store(snapshot, key, strlen(key));
+
+    g_hash_table_insert(snapshot->data, keyPtr, cfg_snapshot_store(snapshot, value, strlen(value)));
+    g_ptr_array_insert(snapshot->index, cfg_index_lower_bound(snapshot->index, keyPtr), keyPtr);
+}
+
+/* It copies the live items into a new arena */
+static CfgSnapshot* cfg_snapshot_copy(CfgSnapshot* snapshot) {
+    CfgSnapshot* copy = NULL;
+    const char* key = NULL;
+    const char* value = NULL;
+    char* keyPtr = NULL;
+    unsigned int i = 0;
+
+    copy = cfg_snapshot_new();
+
+    /* walk the index, so the copy is already sorted */
+    for (i = 0; i < snapshot->index->len; i++) {
+        key = g_ptr_array_index(snapshot->index, i);
+        value = g_hash_table_lookup(snapshot->data, key);
+
+        keyPtr = cfg_snapshot_store(copy, key, strlen(key));
+
+        g_hash_table_insert(copy->data, keyPtr, cfg_snapshot_store(copy, value, strlen(value)));
+        g_ptr_array_add(copy->index, keyPtr);
+    }
+
+    return copy;
+}
+
+/* It returns a NULL terminated copy of the keys in the [start, end) range of the index */
+static char** cfg_snapshot_get_keys(CfgSnapshot* snapshot, unsigned int start, unsigned int end, unsigned int* size) {
+    char** keys = NULL;
+    unsigned int i = 0;
+
+    keys = g_new(char*, end - start + 1);
+
+    for (i = start; i < end; i++) {
+        keys[i - start] = g_strdup(g_ptr_array_index(snapshot->index, i));
+    }
+
+    keys[end - start] = NULL;
+
+    if (size != NULL)
+        *size = end - start;
+
+    return keys;
+}
+
+/* Returns a reference to the current snapshot. The lock is only held for the
+ * pointer read, never while a file is parsed. */
+static CfgSnapshot* cfg_snapshot_acquire(CfgFile* cfg) {
+    CfgSnapshot* snapshot = NULL;
+
+    g_mutex_lock(&cfg->lock);
+
+    snapshot = cfg->snapshot;
+    g_atomic_int_inc(&snapshot->refCount);
+
+    g_mutex_unlock(&cfg->lock);
+
+    return snapshot;
+}
+
+/* The seconds of st_mtime would miss a change of the same size within the same second */
+static gint64 cfg_get_file_time(GStatBuf* st) {
+    return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st->st_mtim.tv_nsec;
+}
+
+static void cfg_update_file_stamp(CfgFile* cfg, GStatBuf* st) {
+    cfg->fileTime = cfg_get_file_time(st);
+    cfg->fileSize = (gint64)st->st_size;
+}
+
+static GSList* cfg_get_change_events(CfgFile* cfg) {
+    GSList* handlers = NULL;
+
+    g_mutex_lock(&cfg->lock);
+    handlers = g_slist_copy(cfg->changeEventHandler);
+    g_mutex_unlock(&cfg->lock);
+
+    return handlers;
+}
+
+static void rise_change_events(CfgFile* cfg, GSList* list, const char* key, const char* oldValue, const char* newValue) {
+    GSList* item = NULL;
+    CfgEventContainer* container = NULL;
+
+    item = list;
+
+    while (item) {
+        container = (CfgEventContainer*)item->data;
+        container->callback(cfg, key, oldValue, newValue, container->userData);
+
+        item = g_slist_next(item);
+    }
+}
+
+/* It notifies the keys whose value differs between two tables */
+static void rise_diff_events(CfgFile* cfg, GHashTable* oldData, GHashTable* newData) {
+    GSList* handlers = NULL;
+    GHashTableIter iter;
+    void* key = NULL;
+    void* value = NULL;
+    const char* oldValue = NULL;
+
+    handlers = cfg_get_change_events(cfg);
+    if (handlers == NULL)
+        return;
+
+    /* added or modified keys */
+    g_hash_table_iter_init(&iter, newData);
+
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        oldValue = g_hash_table_lookup(oldData, key);
+
+        if (g_strcmp0(oldValue, value) != 0) {
+            rise_change_events(cfg, handlers, key, oldValue, value);
+        }
+    }
+
+    /* removed keys */
+    g_hash_table_iter_init(&iter, oldData);
+
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (g_hash_table_contains(newData, key) == FALSE) {
+            rise_change_events(cfg, handlers, key, value, NULL);
+        }
+    }
+
+    g_slist_free(handlers);
+}
+
+static CfgFile* cfg_mask_new(const char* file, const char* name, CfgSnapshot* snapshot) {
     CfgFile* cfgPtr = NULL;
+    GStatBuf st;
 
-    g_return_if_fail(file != NULL);
-    g_return_if_fail(name != NULL);
-    g_return_if_fail(data != NULL);
+    g_return_val_if_fail(file != NULL, NULL);
+    g_return_val_if_fail(name != NULL, NULL);
+    g_return_val_if_fail(snapshot != NULL, NULL);
 
-    cfgPtr = g_new(CfgFile, 1);
+    cfgPtr = g_new0(CfgFile, 1);
 
     cfgPtr->file = g_strdup(file);
     cfgPtr->name = g_strdup(name);
-    cfgPtr->data = data;
+    cfgPtr->snapshot = snapshot;
+
+    g_mutex_init(&cfgPtr->lock);
+    g_rec_mutex_init(&cfgPtr->notifyLock);
+    g_mutex_init(&cfgPtr->watchLock);
+    g_cond_init(&cfgPtr->watchCond);
+
+    if (g_stat(file, &st) == 0) {
+        cfg_update_file_stamp(cfgPtr, &st);
+    }
 
     return cfgPtr;
 }
@@ -91,60 +410,115 @@ static void cfg_mask_store(const char* file, const char* cfgname, GHashTable* cf
     g_key_file_free(keyFile);
 }
 
-static GHashTable* cfg_mask_load(const char* file, const char* cfgname) {
-    GHashTable* cfg = NULL;
-    GKeyFile* keyFile = NULL;
-    void* key = NULL;
-    void* value = NULL;
-    char** keys = NULL;
-    GError* error = NULL;
-    unsigned long length = 0;
-    size_t i = 0;
+static void cfg_mask_load_entry(const IniEntry* entry, void* userData) {
+    CfgLoadContext* context = (CfgLoadContext*)userData;
+    IniString key;
 
-    g_return_if_fail(STRING_IS_VALID(file));
-    g_return_if_fail(STRING_IS_VALID(cfgname));
+    if (ini_string_equal(&entry->group, context->name) == FALSE)
+        return;
 
-    /* try to open the key-value file */
-    keyFile = g_key_file_new();
+    context->found = TRUE;
 
-    if (g_key_file_load_from_file(keyFile, file, G_KEY_FILE_NONE, &error) == FALSE) {
-        print_error(error);
-        return NULL;
-    }
+    /* translated keys are stored with their locale, ie. Key[it] */
+    key = entry->key;
 
-    g_return_if_fail(g_key_file_has_group(keyFile, cfgname) == TRUE);
+    if (entry->locale.len > 0)
+        key.len = (unsigned int)(entry->locale.str + entry->locale.len + 1 - entry->key.str);
 
-    /* create the hash table */
-    cfg = g_hash_table_new(g_str_hash, g_str_equal);
+    cfg_snapshot_append(context->snapshot, &key, &entry->value);
+}
 
-    /* get the keys associated to the configuration name */
-    keys = g_key_file_get_keys(keyFile, cfgname, &length, &error);
-    if (error) {
-        print_error(error);
+static CfgSnapshot* cfg_mask_load(const char* file, const char* cfgname) {
+    CfgLoadContext context;
+
+    g_return_val_if_fail(STRING_IS_VALID(file), NULL);
+    g_return_val_if_fail(STRING_IS_VALID(cfgname), NULL);
+
+    context.name = cfgname;
+    context.snapshot = cfg_snapshot_new();
+    context.found = FALSE;
+
+    /* parse the memory mapped file in a single pass */
+    if (ini_parse_file(file, cfg_mask_load_entry, &context) == FALSE) {
+        cfg_snapshot_unref(context.snapshot);
         return NULL;
     }
 
-    for (i = 0; i < length; i++) {
-        key = STRING_TO_POINTER(g_strdup(keys[i]));
-        value = g_key_file_get_value(keyFile, cfgname, key, &error);
-        if (error) {
-            print_error(error);
-            continue;
+    if (context.found == FALSE) {
+        cfg_snapshot_unref(context.snapshot);
+        g_return_val_if_reached(NULL);
+    }
+
+    cfg_snapshot_sort(context.snapshot);
+
+    return context.snapshot;
+}
+
+/* It swaps in the content of the file and notifies the changes. notifyLock must be held */
+static void cfg_mask_reload(CfgFile* cfg) {
+    CfgSnapshot* oldSnapshot = NULL;
+    CfgSnapshot* newSnapshot = NULL;
+
+    /* parse without holding the snapshot lock, readers keep using the current one */
+    newSnapshot = cfg_mask_load(cfg->file, cfg->name);
+    if (newSnapshot == NULL)
+        return;
+
+    /* keep a reference to the new snapshot, so cfg_add_item() won't modify it while diffing */
+    g_atomic_int_inc(&newSnapshot->refCount);
+
+    g_mutex_lock(&cfg->lock);
+    oldSnapshot = cfg->snapshot;
+    cfg->snapshot = newSnapshot;
+    g_mutex_unlock(&cfg->lock);
+
+    rise_diff_events(cfg, oldSnapshot->data, newSnapshot->data);
+
+    cfg_snapshot_unref(newSnapshot);
+    cfg_snapshot_unref(oldSnapshot);
+}
+
+/* It stops once it isn't the watcher anymore, even if cfg_watch() started a new one meanwhile */
+static void* cfg_watcher_thread(void* data) {
+    CfgFile* cfg = (CfgFile*)data;
+    GThread* self = g_thread_self();
+    GStatBuf st;
+    gint64 endTime = 0;
+    int running = TRUE;
+
+    while (running) {
+        g_mutex_lock(&cfg->watchLock);
+
+        endTime = g_get_monotonic_time() + cfg->interval * G_TIME_SPAN_MILLISECOND;
+
+        while (cfg->watcher == self && g_cond_wait_until(&cfg->watchCond, &cfg->watchLock, endTime))
+            ;
+
+        running = (cfg->watcher == self);
+
+        g_mutex_unlock(&cfg->watchLock);
+
+        if (running == FALSE)
+            break;
+
+        /* reload only if the file has been modified since the last parsing */
+        g_rec_mutex_lock(&cfg->notifyLock);
+
+        if (g_stat(cfg->file, &st) == 0 &&
+            (cfg_get_file_time(&st) != cfg->fileTime || (gint64)st.st_size != cfg->fileSize)) {
+            cfg_update_file_stamp(cfg, &st);
+            cfg_mask_reload(cfg);
         }
 
-        /* populate the hash table */
-        g_hash_table_insert(cfg, key, value);
+        g_rec_mutex_unlock(&cfg->notifyLock);
     }
 
-    /* free up some memory */
-    g_key_file_free(keyFile);
-
-    return cfg;
+    return NULL;
 }
 
 /* Implementations */
 CfgFile* cfg_new(const char* file, const char* name) {
-    return cfg_mask_new(file, name, g_hash_table_new(g_str_hash, g_str_equal));
+    return cfg_mask_new(file, name, cfg_snapshot_new());
 }
 
 void cfg_free(CfgFile* cfg) {
@@ -152,13 +526,26 @@ void cfg_free(CfgFile* cfg) {
 
     g_assert(cfg->file != NULL);
     g_assert(cfg->name != NULL);
-    g_assert(cfg->data != NULL);
+    g_assert(cfg->snapshot != NULL);
+
+    cfg_unwatch(cfg);
+
+    cfg_snapshot_unref(cfg->snapshot);
 
-    g_hash_table_destroy(cfg->data);
+    g_slist_free_full(cfg->changeEventHandler, g_free);
+
+    g_mutex_clear(&cfg->lock);
+    g_rec_mutex_clear(&cfg->notifyLock);
+    g_mutex_clear(&cfg->watchLock);
+    g_cond_clear(&cfg->watchCond);
+
+    g_free(cfg->file);
+    g_free(cfg->name);
 
     cfg->file = NULL;
     cfg->name = NULL;
-    cfg->data = NULL;
+    cfg->snapshot = NULL;
+    cfg->changeEventHandler = NULL;
 
     g_free(cfg);
 
@@ -166,9 +553,13 @@ void cfg_free(CfgFile* cfg) {
 }
 
 void cfg_store(CfgFile* cfg) {
+    CfgSnapshot* snapshot = NULL;
+
     g_return_if_fail(cfg != NULL);
 
-    cfg_mask_store(cfg->file, cfg->name, cfg->data);
+    snapshot = cfg_snapshot_acquire(cfg);
+    cfg_mask_store(cfg->file, cfg->name, snapshot->data);
+    cfg_snapshot_unref(snapshot);
 }
 
 CfgFile* cfg_load(const char* file, const char* name) {
@@ -176,43 +567,449 @@ CfgFile* cfg_load(const char* file, const char* name) {
 }
 
 void cfg_add_item(CfgFile* cfg, const char* key, const char* value) {
+    CfgSnapshot* snapshot = NULL;
+    char* oldValue = NULL;
+    GSList* handlers = NULL;
+
     g_return_if_fail(cfg != NULL);
     g_return_if_fail(key != NULL);
     g_return_if_fail(value != NULL);
 
-    g_hash_table_insert(cfg->data, STRING_TO_POINTER(key), STRING_TO_POINTER(value));
+    g_rec_mutex_lock(&cfg->notifyLock);
+    g_mutex_lock(&cfg->lock);
+
+    snapshot = cfg->snapshot;
+    oldValue = g_strdup(g_hash_table_lookup(snapshot->data, key));
+
+    if (g_strcmp0(oldValue, value) == 0) {
+        g_mutex_unlock(&cfg->lock);
+        g_rec_mutex_unlock(&cfg->notifyLock);
+        g_free(oldValue);
+        return;
+    }
+
+    /* copy on write if a reader is holding the current snapshot */
+    if (g_atomic_int_get(&snapshot->refCount) > 1) {
+        cfg->snapshot = cfg_snapshot_copy(snapshot);
+        cfg_snapshot_unref(snapshot);
+    }
+
+    cfg_snapshot_insert(cfg->snapshot, key, value);
+
+    /* compact the arena when most of it contains replaced values */
+    snapshot = cfg->snapshot;
+
+    if (snapshot->garbageSize > CFG_STRINGS_BLOCK_SIZE && snapshot->garbageSize > snapshot->stringsSize / 2) {
+        cfg->snapshot = cfg_snapshot_copy(snapshot);
+        cfg_snapshot_unref(snapshot);
+    }
+
+    g_mutex_unlock(&cfg->lock);
+
+    /* notify the event */
+    handlers = cfg_get_change_events(cfg);
+    rise_change_events(cfg, handlers, key, oldValue, value);
+
+    g_rec_mutex_unlock(&cfg->notifyLock);
+
+    g_slist_free(handlers);
+    g_free(oldValue);
 }
 
 const char* cfg_get_item_value(CfgFile* cfg, const char* key) {
-    void* valuePtr = NULL;
+    CfgSnapshot* snapshot = NULL;
     char* value = NULL;
 
     g_return_val_if_fail(cfg != NULL, NULL);
     g_return_val_if_fail(key != NULL, NULL);
 
-    value = NULL;
+    snapshot = cfg_snapshot_acquire(cfg);
+    value = g_strdup(g_hash_table_lookup(snapshot->data, key));
+    cfg_snapshot_unref(snapshot);
 
-    if (g_hash_table_contains(cfg->data, POINTER_TO_STRING(key)) == FALSE)
-        return NULL;
+    return value;
+}
 
-    valuePtr = g_hash_table_lookup(cfg->data, POINTER_TO_STRING(key));
+unsigned int cfg_get_size(CfgFile* cfg) {
+    CfgSnapshot* snapshot = NULL;
+    unsigned int size = 0;
 
-    g_assert(valuePtr != NULL);
+    g_return_val_if_fail(cfg != NULL, 0);
 
-    value = g_strdup(POINTER_TO_STRING(valuePtr));
+    snapshot = cfg_snapshot_acquire(cfg);
+    size = g_hash_table_size(snapshot->data);
+    cfg_snapshot_unref(snapshot);
 
-    return value;
+    return size;
 }
 
-unsigned int cfg_get_size(CfgFile* cfg) {
+char** cfg_get_keys(CfgFile* cfg, unsigned int* size) {
+    CfgSnapshot* snapshot = NULL;
+    char** keys = NULL;
+
     g_return_val_if_fail(cfg != NULL, NULL);
-    
-    return g_hash_table_size(cfg->data);
+
+    snapshot = cfg_snapshot_acquire(cfg);
+    keys = cfg_snapshot_get_keys(snapshot, 0, snapshot->index->len, size);
+    cfg_snapshot_unref(snapshot);
+
+    return keys;
 }
 
-const char* const* cfg_get_keys(CfgFile* cfg, unsigned int* size) {
+char** cfg_get_keys_with_prefix(CfgFile* cfg, const char* prefix, unsigned int* size) {
+    CfgSnapshot* snapshot = NULL;
+    char** keys = NULL;
+
     g_return_val_if_fail(cfg != NULL, NULL);
-    
-    return g_hash_table_return_keys_to_array(cfg->data, &size);
+    g_return_val_if_fail(prefix != NULL, NULL);
+
+    snapshot = cfg_snapshot_acquire(cfg);
+
+    keys = cfg_snapshot_get_keys(snapshot,
+        cfg_index_lower_bound(snapshot->index, prefix),
+        cfg_index_prefix_end(snapshot->index, prefix),
+        size);
+
+    cfg_snapshot_unref(snapshot);
+
+    return keys;
+}
+
+void cfg_iter_init(CfgIter* iter, CfgFile* cfg, const char* from, const char* to) {
+    CfgSnapshot* snapshot = NULL;
+
+    g_return_if_fail(iter != NULL);
+    g_return_if_fail(cfg != NULL);
+
+    snapshot = cfg_snapshot_acquire(cfg);
+
+    iter->snapshot = snapshot;
+    iter->position = from ? cfg_index_lower_bound(snapshot->index, from) : 0;
+    iter->end = to ? cfg_index_lower_bound(snapshot->index, to) : snapshot->index->len;
+}
+
+void cfg_iter_init_prefix(CfgIter* iter, CfgFile* cfg, const char* prefix) {
+    CfgSnapshot* snapshot = NULL;
+
+    g_return_if_fail(iter != NULL);
+    g_return_if_fail(cfg != NULL);
+    g_return_if_fail(prefix != NULL);
+
+    snapshot = cfg_snapshot_acquire(cfg);
+
+    iter->snapshot = snapshot;
+    iter->position = cfg_index_lower_bound(snapshot->index, prefix);
+    iter->end = cfg_index_prefix_end(snapshot->index, prefix);
+}
+
+int cfg_iter_next(CfgIter* iter, const char** key, const char** value) {
+    CfgSnapshot* snapshot = NULL;
+    const char* item = NULL;
+
+    g_return_val_if_fail(iter != NULL, FALSE);
+
+    snapshot = (CfgSnapshot*)iter->snapshot;
+
+    if (snapshot == NULL || iter->position >= iter->end)
+        return FALSE;
+
+    item = g_ptr_array_index(snapshot->index, iter->position);
+    iter->position++;
+
+    if (key)
+        *key = item;
+
+    if (value)
+        *value = g_hash_table_lookup(snapshot->data, item);
+
+    return TRUE;
+}
+
+void cfg_iter_clear(CfgIter* iter) {
+    g_return_if_fail(iter != NULL);
+
+    if (iter->snapshot != NULL) {
+        cfg_snapshot_unref((CfgSnapshot*)iter->snapshot);
+        iter->snapshot = NULL;
+    }
+}
+
+void cfg_add_change_event(CfgFile* cfg, cfgChangeFunc handler, void* userData) {
+    CfgEventContainer* container = NULL;
+
+    g_return_if_fail(cfg != NULL);
+    g_return_if_fail(handler != NULL);
+
+    container = g_new(CfgEventContainer, 1);
+    container->callback = handler;
+    container->userData = userData;
+
+    g_mutex_lock(&cfg->lock);
+    cfg->changeEventHandler = g_slist_append(cfg->changeEventHandler, (void*)container);
+    g_mutex_unlock(&cfg->lock);
+}
+
+void cfg_remove_change_event(CfgFile* cfg, cfgChangeFunc handler, void* userData) {
+    GSList* item = NULL;
+    CfgEventContainer* container = NULL;
+
+    g_return_if_fail(cfg != NULL);
+    g_return_if_fail(handler != NULL);
+
+    /* wait for the notifications in progress */
+    g_rec_mutex_lock(&cfg->notifyLock);
+    g_mutex_lock(&cfg->lock);
+
+    for (item = cfg->changeEventHandler; item; item = g_slist_next(item)) {
+        container = (CfgEventContainer*)item->data;
+
+        if (container->callback == handler && container->userData == userData) {
+            cfg->changeEventHandler = g_slist_remove(cfg->changeEventHandler, container);
+            g_free(container);
+            break;
+        }
+    }
+
+    g_mutex_unlock(&cfg->lock);
+    g_rec_mutex_unlock(&cfg->notifyLock);
+}
+
+void cfg_reload(CfgFile* cfg) {
+    GStatBuf st;
+
+    g_return_if_fail(cfg != NULL);
+    g_return_if_fail(g_file_test(cfg->file, G_FILE_TEST_IS_REGULAR));
+
+    g_rec_mutex_lock(&cfg->notifyLock);
+
+    if (g_stat(cfg->file, &st) == 0) {
+        cfg_update_file_stamp(cfg, &st);
+    }
+
+    cfg_mask_reload(cfg);
+
+    g_rec_mutex_unlock(&cfg->notifyLock);
+}
+
+void cfg_watch(CfgFile* cfg, unsigned int interval) {
+    g_return_if_fail(cfg != NULL);
+    g_return_if_fail(interval > 0);
+
+    g_mutex_lock(&cfg->watchLock);
+
+    cfg->interval = interval;
+
+    if (cfg->watching) {
+        g_mutex_unlock(&cfg->watchLock);
+        return;
+    }
+
+    /* the watcher is set under the lock, so cfg_unwatch() always finds it */
+    cfg->watching = TRUE;
+    cfg->watcher = g_thread_new("cfg-watcher", cfg_watcher_thread, cfg);
+
+    g_mutex_unlock(&cfg->watchLock);
+}
+
+void cfg_unwatch(CfgFile* cfg) {
+    GThread* watcher = NULL;
+
+    g_return_if_fail(cfg != NULL);
+
+    g_mutex_lock(&cfg->watchLock);
+
+    if (cfg->watching == FALSE) {
+        g_mutex_unlock(&cfg->watchLock);
+        return;
+    }
+
+    cfg->watching = FALSE;
+    g_cond_broadcast(&cfg->watchCond);
+
+    watcher = cfg->watcher;
+    cfg->watcher = NULL;
+
+    g_mutex_unlock(&cfg->watchLock);
+
+    g_thread_join(watcher);
+}
+
+/* Layered view helpers */
+static void cfg_layer_item_free(void* data) {
+    CfgLayerItem* item = (CfgLayerItem*)data;
+
+    g_free(item->value);
+    g_free(item);
+}
+
+static void cfg_layers_set_item(CfgLayers* layers, const char* key, const char* value, unsigned int level) {
+    CfgLayerItem* item = NULL;
+
+    item = g_new(CfgLayerItem, 1);
+    item->value = g_strdup(value);
+    item->level = level;
+
+    g_hash_table_insert(layers->items, g_strdup(key), item);
 }
 
+/* It updates the effective value of a key changed in a layer. The write lock must be held */
+static void cfg_layers_resolve(CfgLayers* layers, const char* key, const char* value, unsigned int level) {
+    CfgLayerItem* item = NULL;
+    CfgLayer* layer = NULL;
+    CfgSnapshot* snapshot = NULL;
+    const char* lowerValue = NULL;
+    unsigned int i = 0;
+
+    item = g_hash_table_lookup(layers->items, key);
+
+    /* overridden by an upper layer */
+    if (item != NULL && item->level > level)
+        return;
+
+    if (value != NULL) {
+        cfg_layers_set_item(layers, key, value, level);
+        return;
+    }
+
+    /* the key has been removed, fall back to the lower layers */
+    for (i = level; i > 0; i--) {
+        layer = g_ptr_array_index(layers->layers, i - 1);
+
+        snapshot = cfg_snapshot_acquire(layer->cfg);
+        lowerValue = g_hash_table_lookup(snapshot->data, key);
+
+        if (lowerValue != NULL) {
+            cfg_layers_set_item(layers, key, lowerValue, i - 1);
+            cfg_snapshot_unref(snapshot);
+            return;
+        }
+
+        cfg_snapshot_unref(snapshot);
+    }
+
+    g_hash_table_remove(layers->items, key);
+}
+
+static void cfg_layers_change_callback(CfgFile* cfg, const char* key, const char* oldValue, const char* newValue, void* userData) {
+    CfgLayer* layer = (CfgLayer*)userData;
+
+    g_rw_lock_writer_lock(&layer->layers->lock);
+    cfg_layers_resolve(layer->layers, key, newValue, layer->level);
+    g_rw_lock_writer_unlock(&layer->layers->lock);
+}
+
+CfgLayers* cfg_layers_new(void) {
+    CfgLayers* layers = NULL;
+
+    layers = g_new(CfgLayers, 1);
+    layers->layers = g_ptr_array_new();
+    layers->items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cfg_layer_item_free);
+
+    g_rw_lock_init(&layers->lock);
+
+    return layers;
+}
+
+void cfg_layers_free(CfgLayers* layers) {
+    CfgLayer* layer = NULL;
+    unsigned int i = 0;
+
+    g_return_if_fail(layers != NULL);
+
+    /* stop the notifications before releasing the items */
+    for (i = 0; i < layers->layers->len; i++) {
+        layer = g_ptr_array_index(layers->layers, i);
+
+        cfg_remove_change_event(layer->cfg, cfg_layers_change_callback, layer);
+        g_free(layer);
+    }
+
+    g_ptr_array_free(layers->layers, TRUE);
+    g_hash_table_destroy(layers->items);
+    g_rw_lock_clear(&layers->lock);
+
+    layers->layers = NULL;
+    layers->items = NULL;
+
+    g_free(layers);
+}
+
+void cfg_layers_push(CfgLayers* layers, CfgFile* cfg) {
+    CfgLayer* layer = NULL;
+    CfgSnapshot* snapshot = NULL;
+    GHashTableIter iter;
+    void* key = NULL;
+    void* value = NULL;
+
+    g_return_if_fail(layers != NULL);
+    g_return_if_fail(cfg != NULL);
+
+    g_rw_lock_writer_lock(&layers->lock);
+
+    layer = g_new(CfgLayer, 1);
+    layer->layers = layers;
+    layer->cfg = cfg;
+    layer->level = layers->layers->len;
+
+    g_ptr_array_add(layers->layers, layer);
+
+    /* listen before merging, so that a concurrent reload can't be lost */
+    cfg_add_change_event(cfg, cfg_layers_change_callback, layer);
+
+    /* the new layer overrides all the current items */
+    snapshot = cfg_snapshot_acquire(cfg);
+
+    g_hash_table_iter_init(&iter, snapshot->data);
+
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        cfg_layers_set_item(layers, key, value, layer->level);
+    }
+
+    cfg_snapshot_unref(snapshot);
+
+    g_rw_lock_writer_unlock(&layers->lock);
+}
+
+unsigned int cfg_layers_get_size(CfgLayers* layers) {
+    g_return_val_if_fail(layers != NULL, 0);
+
+    return layers->layers->len;
+}
+
+const char* cfg_layers_get_item_value(CfgLayers* layers, const char* key) {
+    CfgLayerItem* item = NULL;
+    char* value = NULL;
+
+    g_return_val_if_fail(layers != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    g_rw_lock_reader_lock(&layers->lock);
+
+    item = g_hash_table_lookup(layers->items, key);
+    if (item != NULL) {
+        value = g_strdup(item->value);
+    }
+
+    g_rw_lock_reader_unlock(&layers->lock);
+
+    return value;
+}
+
+CfgFile* cfg_layers_get_item_layer(CfgLayers* layers, const char* key) {
+    CfgLayerItem* item = NULL;
+    CfgLayer* layer = NULL;
+
+    g_return_val_if_fail(layers != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    g_rw_lock_reader_lock(&layers->lock);
+
+    item = g_hash_table_lookup(layers->items, key);
+    if (item != NULL) {
+        layer = g_ptr_array_index(layers->layers, item->level);
+    }
+
+    g_rw_lock_reader_unlock(&layers->lock);
+
+    return layer ? layer->cfg : NULL;
+}
@@ -24,6 +24,21 @@
 struct CfgFile_type;
 typedef struct CfgFile_type CfgFile;
 
+/* Abstract data type that rapresents a stack of configurations, where upper layers override the lower ones */
+struct CfgLayers_type;
+typedef struct CfgLayers_type CfgLayers;
+
+/* Iterator over configuration items in ascending key order. It holds the items it has been
+ * initialized with, even if the configuration changes, until cfg_iter_clear() is called */
+typedef struct {
+    void* snapshot;
+    unsigned int position;
+    unsigned int end;
+} CfgIter;
+
+/* Change event handler. newValue is NULL when the key has been removed, oldValue is NULL when it has been added */
+typedef void (*cfgChangeFunc)(CfgFile* cfg, const char* key, const char* oldValue, const char* newValue, void* userData);
+
 /* Creates a custom configuration */
 CfgFile* cfg_new(const char* file, const char* name);
 
@@ -45,7 +60,56 @@ const char* cfg_get_item_value(CfgFile* cfg, const char* key);
 /* Returns the number of configuration items */
 unsigned int cfg_get_size(CfgFile* cfg);
 
-/* Returns the list of configuration keys */
-const char* const* cfg_get_keys(CfgFile* cfg, unsigned int* size);
+/* Returns a copy of the configuration keys, in ascending order. The list is NULL terminated and it
+ * must be freed with g_strfreev(). The number of keys is stored in size, which can be NULL */
+char** cfg_get_keys(CfgFile* cfg, unsigned int* size);
+
+/* Like cfg_get_keys(), but only the keys starting with prefix */
+char** cfg_get_keys_with_prefix(CfgFile* cfg, const char* prefix, unsigned int* size);
+
+/* Initializes an iterator over the keys in the [from, to) range. NULL bounds are unlimited */
+void cfg_iter_init(CfgIter* iter, CfgFile* cfg, const char* from, const char* to);
+
+/* Initializes an iterator over the keys starting with prefix */
+void cfg_iter_init_prefix(CfgIter* iter, CfgFile* cfg, const char* prefix);
+
+/* Advances the iterator. Key and value are valid until cfg_iter_clear() is called */
+int cfg_iter_next(CfgIter* iter, const char** key, const char** value);
+
+/* Releases the items held by the iterator */
+void cfg_iter_clear(CfgIter* iter);
+
+/* Adds a handler called for every key whose value changes */
+void cfg_add_change_event(CfgFile* cfg, cfgChangeFunc handler, void* userData);
+
+/* Removes a change handler, waiting for the notifications in progress */
+void cfg_remove_change_event(CfgFile* cfg, cfgChangeFunc handler, void* userData);
+
+/* Reparses the configuration file and notifies the changed keys */
+void cfg_reload(CfgFile* cfg);
+
+/* Starts watching the configuration file, checking it every interval milliseconds */
+void cfg_watch(CfgFile* cfg, unsigned int interval);
+
+/* Stops watching the configuration file */
+void cfg_unwatch(CfgFile* cfg);
+
+/* Creates an empty layered view */
+CfgLayers* cfg_layers_new(void);
+
+/* Free up layered view resources. The configurations are not released */
+void cfg_layers_free(CfgLayers* layers);
+
+/* Pushes a configuration on top of the view, overriding the current layers */
+void cfg_layers_push(CfgLayers* layers, CfgFile* cfg);
+
+/* Returns the number of layers */
+unsigned int cfg_layers_get_size(CfgLayers* layers);
+
+/* Returns the effective value of a configuration item */
+const char* cfg_layers_get_item_value(CfgLayers* layers, const char* key);
+
+/* Returns the configuration which provides the effective value of an item */
+CfgFile* cfg_layers_get_item_layer(CfgLayers* layers, const char* key);
 
 #endif
@@ -0,0 +1,232 @@
+/*
+ * ini.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "ini.h"
+#include "definitions.h"
+
+/* strings shorter than this are copied on the stack by ini_string_insert_const() */
+#define INI_STACK_STRING_SIZE 256
+
+/* Error messages */
+static const char* _iniInvalidLineMsg = "%s:%u: line is not a key-value pair, group, or comment.";
+static const char* _iniNoGroupMsg = "%s:%u: key-value pair outside of a group.";
+
+static void ini_string_set(IniString* string, const char* start, const char* end) {
+    string->str = start;
+    string->len = (unsigned int)(end - start);
+}
+
+static void ini_mask_parse(const char* name, const char* data, size_t length, iniEntryFunc callback, void* userData) {
+    const char* end = data + length;
+    const char* line = data;
+    const char* next = NULL;
+    const char* start = NULL;
+    const char* stop = NULL;
+    const char* separator = NULL;
+    const char* keyEnd = NULL;
+    const char* valueStart = NULL;
+    const char* locale = NULL;
+    unsigned int lineNumber = 0;
+    IniEntry entry;
+
+    memset(&entry, 0, sizeof(IniEntry));
+
+    /* skip the UTF-8 byte order mark */
+    if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+        line += 3;
+
+    for (; line < end; line = next) {
+        lineNumber++;
+
+        stop = memchr(line, '\n', end - line);
+        if (stop == NULL)
+            stop = end;
+
+        next = stop + 1;
+        start = line;
+
+        /* trim the line */
+        while (start < stop && g_ascii_isspace(*start))
+            start++;
+
+        while (stop > start && g_ascii_isspace(*(stop - 1)))
+            stop--;
+
+        /* blank lines and comments */
+        if (start == stop || *start == '#')
+            continue;
+
+        /* group */
+        if (*start == '[') {
+            if (*(stop - 1) != ']') {
+                g_warning(_iniInvalidLineMsg, name, lineNumber);
+                continue;
+            }
+
+            ini_string_set(&entry.group, start + 1, stop - 1);
+            continue;
+        }
+
+        /* key-value pair */
+        separator = memchr(start, '=', stop - start);
+        if (separator == NULL || separator == start) {
+            g_warning(_iniInvalidLineMsg, name, lineNumber);
+            continue;
+        }
+
+        if (entry.group.str == NULL) {
+            g_warning(_iniNoGroupMsg, name, lineNumber);
+            continue;
+        }
+
+        keyEnd = separator;
+        while (keyEnd > start && g_ascii_isspace(*(keyEnd - 1)))
+            keyEnd--;
+
+        valueStart = separator + 1;
+        while (valueStart < stop && g_ascii_isspace(*valueStart))
+            valueStart++;
+
+        /* translated key, ie. Save[it] */
+        locale = NULL;
+
+        if (*(keyEnd - 1) == ']')
+            locale = memchr(start, '[', keyEnd - start);
+
+        if (locale != NULL) {
+            ini_string_set(&entry.key, start, locale);
+            ini_string_set(&entry.locale, locale + 1, keyEnd - 1);
+        } else {
+            ini_string_set(&entry.key, start, keyEnd);
+            ini_string_set(&entry.locale, keyEnd, keyEnd);
+        }
+
+        ini_string_set(&entry.value, valueStart, stop);
+
+        callback(&entry, userData);
+    }
+}
+
+/* Implementations */
+int ini_parse_file(const char* path, iniEntryFunc callback, void* userData) {
+    GMappedFile* file = NULL;
+    GError* error = NULL;
+
+    g_return_val_if_fail(STRING_IS_VALID(path), FALSE);
+    g_return_val_if_fail(callback != NULL, FALSE);
+
+    file = g_mapped_file_new(path, FALSE, &error);
+    if (file == NULL) {
+        print_error(error);
+        return FALSE;
+    }
+
+    ini_mask_parse(path,
+        g_mapped_file_get_contents(file),
+        g_mapped_file_get_length(file),
+        callback,
+        userData);
+
+    g_mapped_file_unref(file);
+
+    return TRUE;
+}
+
+void ini_parse_data(const char* data, size_t length, iniEntryFunc callback, void* userData) {
+    g_return_if_fail(data != NULL || length == 0);
+    g_return_if_fail(callback != NULL);
+
+    ini_mask_parse("data", data, length, callback, userData);
+}
+
+int ini_string_equal(const IniString* string, const char* other) {
+    g_return_val_if_fail(string != NULL, FALSE);
+    g_return_val_if_fail(other != NULL, FALSE);
+
+    return strncmp(string->str, other, string->len) == 0 && other[string->len] == '\0';
+}
+
+char* ini_string_insert(GStringChunk* arena, const IniString* string) {
+    g_return_val_if_fail(arena != NULL, NULL);
+    g_return_val_if_fail(string != NULL, NULL);
+
+    return g_string_chunk_insert_len(arena, string->str, string->len);
+}
+
+char* ini_string_insert_const(GStringChunk* arena, const IniString* string) {
+    char buffer[INI_STACK_STRING_SIZE];
+    char* copy = buffer;
+    char* value = NULL;
+
+    g_return_val_if_fail(arena != NULL, NULL);
+    g_return_val_if_fail(string != NULL, NULL);
+
+    /* the arena needs a NUL terminated string to look it up */
+    if (string->len >= INI_STACK_STRING_SIZE)
+        copy = g_malloc(string->len + 1);
+
+    memcpy(copy, string->str, string->len);
+    copy[string->len] = '\0';
+
+    value = g_string_chunk_insert_const(arena, copy);
+
+    if (copy != buffer)
+        g_free(copy);
+
+    return value;
+}
+
+char* ini_string_insert_unescaped(GStringChunk* arena, const IniString* string) {
+    char* value = NULL;
+    char* in = NULL;
+    char* out = NULL;
+
+    value = ini_string_insert(arena, string);
+
+    if (value == NULL || memchr(value, '\\', string->len) == NULL)
+        return value;
+
+    /* unescaping never grows the string, so it's done in place */
+    for (in = value, out = value; *in; in++, out++) {
+        if (*in != '\\' || *(in + 1) == '\0') {
+            *out = *in;
+            continue;
+        }
+
+        in++;
+
+        switch (*in) {
+            case 's': *out = ' '; break;
+            case 'n': *out = '\n'; break;
+            case 't': *out = '\t'; break;
+            case 'r': *out = '\r'; break;
+            case '\\': *out = '\\'; break;
+            default:
+                *out++ = '\\';
+                *out = *in;
+                break;
+        }
+    }
+
+    *out = '\0';
+
+    return value;
+}
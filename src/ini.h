@@ -0,0 +1,60 @@
+/*
+ * ini.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INI_H
+#define INI_H
+
+#include <glib.h>
+
+/* A string inside the parsed data. It's not NUL terminated */
+typedef struct {
+    const char* str;
+    unsigned int len;
+} IniString;
+
+/* A key-value pair of the file */
+typedef struct {
+    IniString group;    /* the group name, ie. "locale" for [locale] */
+    IniString key;      /* the key name, without locale */
+    IniString locale;   /* the locale of a translated key, ie. "it" for Save[it]. Empty otherwise */
+    IniString value;    /* the raw value, not unescaped */
+} IniEntry;
+
+/* The callback called for every key-value pair. The entry is valid only during the call */
+typedef void (*iniEntryFunc)(const IniEntry* entry, void* userData);
+
+/* Parses a .ini file in a single pass over the memory mapped file. Returns FALSE if it can't be read */
+int ini_parse_file(const char* path, iniEntryFunc callback, void* userData);
+
+/* Parses .ini data in a single pass */
+void ini_parse_data(const char* data, size_t length, iniEntryFunc callback, void* userData);
+
+/* Returns TRUE if the string is equal to the NUL terminated one */
+int ini_string_equal(const IniString* string, const char* other);
+
+/* Copies a string into the arena */
+char* ini_string_insert(GStringChunk* arena, const IniString* string);
+
+/* Copies a string into the arena once, so equal strings share the same copy */
+char* ini_string_insert_const(GStringChunk* arena, const IniString* string);
+
+/* Copies a value into the arena, replacing the \s, \n, \t, \r and \\ escape sequences */
+char* ini_string_insert_unescaped(GStringChunk* arena, const IniString* string);
+
+#endif
@@ -17,47 +17,644 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <glib.h>
 #include "localization.h"
 #include "errors.h"
 #include "definitions.h"
+#include "ini.h"
 
 #define DEFAULT_LANGUAGE "en"
 #define DEFAULT_GROUP "locale"
+#define STRINGS_BLOCK_SIZE 4096
+
+/* The binary catalog: a header, the languages directory, the keys index (sorted by key),
+ * the keys pool and a section per language, with the value offsets in the keys order
+ * followed by the values pool. Offsets are from the start of the file, 0 for a missing value */
+#define CATALOG_MAGIC "LHCAT\0\0\0"
+#define CATALOG_MAGIC_SIZE 8
+#define CATALOG_VERSION 1
+
+/* the untranslated strings are the section of this language */
+#define CATALOG_UNTRANSLATED ""
+
+typedef struct {
+    char magic[CATALOG_MAGIC_SIZE];
+    guint32 version;
+    guint32 languages;
+    guint32 keys;
+    guint32 reserved;
+} catalogHeader;
+
+typedef struct {
+    guint32 name;
+    guint32 values;
+} catalogLanguage;
+
+/* Error messages */
+static const char* _lhCatalogCorruptedMsg = "The catalog %s is corrupted.";
+static const char* _lhIdsMismatchMsg = "The strings of %s don't match the string identifiers, generate them again.";
+
+/* The strings of a language, resolved once with their fallbacks */
+typedef struct {
+    char* language;
+    GHashTable* strings;    /* key -> value, both in the arena */
+    const char** byId;      /* values indexed by string identifier */
+    unsigned int idCount;
+} languageTable;
+
+/* The tables and the strings replaced by a reload, which lookups in progress can still use */
+typedef struct {
+    void* data;
+    GDestroyNotify destroy;
+} lhRetired;
+
+/* A change event handler */
+typedef struct {
+    lhChangeFunc callback;
+    void* userData;
+} lhEventContainer;
 
 /* The localization handler */
 struct LocalizationHandler_type  {
     char* path;
     char* language;
-    GKeyFile* file;
+    GHashTable* strings;    /* translated keys, ie. Save[it], and untranslated ones */
+    GHashTable* keys;       /* the keys without locale, ie. Save. Empty for a catalog, which has its index */
+    GStringChunk* arena;    /* keys and values of strings */
     const char* const* supportedLanguages;
+
+    GMutex lock;            /* it protects the strings and the tables while they are built or replaced */
+    GHashTable* tables;     /* language -> languageTable */
+    languageTable* active;  /* the table of the current language, swapped atomically. NULL if it's not set */
+    GPtrArray* retired;     /* lhRetired, freed when no lookup is in progress */
+    gint retiredCount;      /* the length of retired, read without the lock */
+    gint readers;           /* lookups in progress */
+
+    GSList* changeEventHandler; /* lhEventContainer, protected by lock */
+    GRecMutex notifyLock;       /* held while the handlers are called */
+
+    char** idKeys;          /* the keys of the string identifiers, see lh_set_string_ids() */
+    unsigned int idCount;
+
+    GMappedFile* catalog;   /* the binary catalog, NULL if the strings have been parsed */
+    const catalogHeader* header;
+    const catalogLanguage* directory;
+    const guint32* keyIndex;
 };
 
-static char* get_supported_language(LocalizationHandler* lh, const char* language) {
-    int languageFound = FALSE;
-    char* supportedLanguage = NULL;
+static void free_table(void* data) {
+    languageTable* table = (languageTable*)data;
+
+    g_hash_table_destroy(table->strings);
+    g_free(table->byId);
+    g_free(table->language);
+    g_free(table);
+}
 
-    if (g_strcmp0(language, DEFAULT_LANGUAGE))
-        return DEFAULT_LANGUAGE;
+static void free_retired(void* data) {
+    lhRetired* retired = (lhRetired*)data;
+
+    retired->destroy(retired->data);
+    g_free(retired);
+}
+
+/* Lookups take the tables without locks, so the replaced ones are kept until no lookup is in
+ * progress, instead of reference counting every table. A lookup starting after the replacement
+ * gets the new table, so the retired ones can be freed as soon as the readers drop to 0 */
+static void retire(LocalizationHandler* lh, void* data, GDestroyNotify destroy) {
+    lhRetired* retired = NULL;
+
+    if (data == NULL)
+        return;
 
-    if (language != NULL) {
-        languageFound = lh_language_is_supported(lh, language);
-        g_return_val_if_fail(languageFound == TRUE, NULL);
+    retired = g_new(lhRetired, 1);
+    retired->data = data;
+    retired->destroy = destroy;
 
-        supportedLanguage = g_strdup(language);
-    } else {
-        supportedLanguage = g_strdup(DEFAULT_LANGUAGE);
+    g_ptr_array_add(lh->retired, retired);
+    g_atomic_int_set(&lh->retiredCount, lh->retired->len);
+}
+
+/* It frees the retired tables and strings, if no lookup is in progress. The lock must be held */
+static void collect_retired(LocalizationHandler* lh) {
+    if (lh->retired->len == 0 || g_atomic_int_get(&lh->readers) > 0)
+        return;
+
+    g_ptr_array_set_size(lh->retired, 0);
+    g_atomic_int_set(&lh->retiredCount, 0);
+}
+
+/* A lookup starts: the tables it takes from now on are not freed until it ends */
+static void enter_lookup(LocalizationHandler* lh) {
+    g_atomic_int_inc(&lh->readers);
+}
+
+/* The last lookup in progress frees what has been retired meanwhile, unless a reload is running */
+static void leave_lookup(LocalizationHandler* lh) {
+    if (!g_atomic_int_dec_and_test(&lh->readers) || G_LIKELY(g_atomic_int_get(&lh->retiredCount) == 0))
+        return;
+
+    if (g_mutex_trylock(&lh->lock)) {
+        collect_retired(lh);
+        g_mutex_unlock(&lh->lock);
     }
-    
-    return supportedLanguage;
+}
+
+/* It replaces the tables, while the current one is still in use */
+static void retire_tables(LocalizationHandler* lh) {
+    retire(lh, lh->tables, (GDestroyNotify)g_hash_table_destroy);
+    lh->tables = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_table);
+}
+
+static void load_string_entry(const IniEntry* entry, void* userData) {
+    LocalizationHandler* lh = (LocalizationHandler*)userData;
+    IniString key;
+
+    if (ini_string_equal(&entry->group, DEFAULT_GROUP) == FALSE)
+        return;
+
+    /* translated keys are stored with their locale, ie. Save[it] */
+    key = entry->key;
+
+    if (entry->locale.len > 0)
+        key.len = (unsigned int)(entry->locale.str + entry->locale.len + 1 - entry->key.str);
+
+    g_hash_table_insert(lh->strings,
+        ini_string_insert(lh->arena, &key),
+        ini_string_insert_unescaped(lh->arena, &entry->value));
+
+    g_hash_table_add(lh->keys, ini_string_insert_const(lh->arena, &entry->key));
+}
+
+static const char* lookup_string(LocalizationHandler* lh, const char* key, const char* language) {
+    char** variants = NULL;
+    char* localeKey = NULL;
+    const char* value = NULL;
+    size_t i = 0;
+
+    /* try the language variants first, ie. it_IT, then it */
+    variants = g_get_locale_variants(language);
+
+    for (i = 0; variants[i] && value == NULL; i++) {
+        localeKey = g_strdup_printf("%s[%s]", key, variants[i]);
+        value = g_hash_table_lookup(lh->strings, localeKey);
+        g_free(localeKey);
+    }
+
+    g_strfreev(variants);
+
+    /* fall back to the untranslated string */
+    if (value == NULL)
+        value = g_hash_table_lookup(lh->strings, key);
+
+    return value;
+}
+
+static const char* catalog_string(LocalizationHandler* lh, guint32 offset) {
+    if (offset == 0 || offset >= g_mapped_file_get_length(lh->catalog))
+        return NULL;
+
+    return g_mapped_file_get_contents(lh->catalog) + offset;
+}
+
+/* Returns TRUE if the catalog has the key, by a binary search of the keys index */
+static int catalog_has_key(LocalizationHandler* lh, const char* key) {
+    guint32 low = 0;
+    guint32 high = lh->header->keys;
+    guint32 middle = 0;
+    int cmp = 0;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        cmp = strcmp(key, catalog_string(lh, lh->keyIndex[middle]));
+
+        if (cmp == 0)
+            return TRUE;
+
+        if (cmp < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    return FALSE;
+}
+
+/* it adds the value offsets of the sections of the language variants */
+static void add_catalog_sections(LocalizationHandler* lh, GPtrArray* sections, const char* language) {
+    const char* contents = g_mapped_file_get_contents(lh->catalog);
+    char** variants = NULL;
+    size_t i = 0;
+    guint32 j = 0;
+
+    variants = g_get_locale_variants(language);
+
+    for (i = 0; variants[i]; i++) {
+        for (j = 0; j < lh->header->languages; j++) {
+            if (g_strcmp0(catalog_string(lh, lh->directory[j].name), variants[i]) == 0)
+                g_ptr_array_add(sections, (void*)(contents + lh->directory[j].values));
+        }
+    }
+
+    g_strfreev(variants);
+}
+
+/* It resolves the strings of a language from the binary catalog. Only the sections of the
+ * language and of its fallbacks are read, so the pages of the other languages aren't touched */
+static void resolve_catalog_strings(LocalizationHandler* lh, GHashTable* strings, const char* language) {
+    const guint32* values = NULL;
+    GPtrArray* sections = NULL;
+    const char* value = NULL;
+    guint32 i = 0;
+    guint32 j = 0;
+
+    sections = g_ptr_array_new();
+
+    add_catalog_sections(lh, sections, language);
+    add_catalog_sections(lh, sections, CATALOG_UNTRANSLATED);
+    add_catalog_sections(lh, sections, DEFAULT_LANGUAGE);
+
+    for (i = 0; i < lh->header->keys; i++) {
+        value = NULL;
+
+        for (j = 0; j < sections->len && value == NULL; j++) {
+            values = g_ptr_array_index(sections, j);
+            value = catalog_string(lh, values[i]);
+        }
+
+        if (value != NULL)
+            g_hash_table_insert(strings, (void*)catalog_string(lh, lh->keyIndex[i]), (void*)value);
+    }
+
+    g_ptr_array_free(sections, TRUE);
+}
+
+/* It resolves the strings of a language from the parsed file */
+static void resolve_parsed_strings(LocalizationHandler* lh, GHashTable* strings, const char* language) {
+    GHashTableIter iter;
+    const char* key = NULL;
+    const char* value = NULL;
+
+    g_hash_table_iter_init(&iter, lh->keys);
+
+    while (g_hash_table_iter_next(&iter, (void**)&key, NULL)) {
+        value = lookup_string(lh, key, language);
+
+        if (value == NULL)
+            value = lookup_string(lh, key, DEFAULT_LANGUAGE);
+
+        if (value != NULL)
+            g_hash_table_insert(strings, (void*)key, (void*)value);
+    }
+}
+
+/* It resolves the strings of a language: its translation, the untranslated string
+ * or the translation of the default language, in this order */
+static languageTable* build_table(LocalizationHandler* lh, const char* language) {
+    languageTable* table = NULL;
+    unsigned int i = 0;
+
+    table = g_new(languageTable, 1);
+    table->language = g_strdup(language);
+    table->strings = g_hash_table_new(g_str_hash, g_str_equal);
+    table->byId = g_new(const char*, lh->idCount);
+    table->idCount = lh->idCount;
+
+    if (lh->catalog != NULL)
+        resolve_catalog_strings(lh, table->strings, language);
+    else
+        resolve_parsed_strings(lh, table->strings, language);
+
+    for (i = 0; i < lh->idCount; i++) {
+        table->byId[i] = g_hash_table_lookup(table->strings, lh->idKeys[i]);
+    }
+
+    return table;
+}
+
+/* Returns the table of a language, building it the first time. The lock must be held */
+static languageTable* find_table(LocalizationHandler* lh, const char* language) {
+    languageTable* table = NULL;
+
+    table = g_hash_table_lookup(lh->tables, language);
+
+    if (table == NULL) {
+        table = build_table(lh, language);
+        g_hash_table_insert(lh->tables, table->language, table);
+    }
+
+    return table;
+}
+
+static languageTable* get_table(LocalizationHandler* lh, const char* language) {
+    languageTable* table = NULL;
+
+    g_mutex_lock(&lh->lock);
+    table = find_table(lh, language);
+    g_mutex_unlock(&lh->lock);
+
+    return table;
+}
+
+/* It maps and checks a binary catalog. The catalog is NULL if the file isn't one, ie. a source
+ * file. Returns FALSE if the catalog is truncated or corrupted */
+static int load_catalog(const char* path, GMappedFile** catalog) {
+    GMappedFile* file = NULL;
+    const catalogHeader* header = NULL;
+    const catalogLanguage* directory = NULL;
+    const guint32* keyIndex = NULL;
+    const char* contents = NULL;
+    guint64 size = 0;
+    guint64 end = 0;
+    guint32 i = 0;
+    int valid = TRUE;
+
+    *catalog = NULL;
+
+    /* the source file reports its own errors */
+    file = g_mapped_file_new(path, FALSE, NULL);
+    if (file == NULL)
+        return TRUE;
+
+    contents = g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+
+    if (size < CATALOG_MAGIC_SIZE || memcmp(contents, CATALOG_MAGIC, CATALOG_MAGIC_SIZE) != 0) {
+        g_mapped_file_unref(file);
+        return TRUE;
+    }
+
+    if (size < sizeof(catalogHeader)) {
+        g_warning(_lhCatalogCorruptedMsg, path);
+        g_mapped_file_unref(file);
+        return FALSE;
+    }
+
+    header = (const catalogHeader*)contents;
+    directory = (const catalogLanguage*)(contents + sizeof(catalogHeader));
+    keyIndex = (const guint32*)(directory + header->languages);
+
+    end = sizeof(catalogHeader) + (guint64)header->languages * sizeof(catalogLanguage) + (guint64)header->keys * sizeof(guint32);
+
+    /* the file ends with a NUL, so every string inside it is terminated */
+    valid = header->version == CATALOG_VERSION && end <= size && contents[size - 1] == '\0';
+
+    for (i = 0; valid && i < header->languages; i++) {
+        valid = directory[i].name < size && directory[i].values % sizeof(guint32) == 0 &&
+            directory[i].values + (guint64)header->keys * sizeof(guint32) <= size;
+    }
+
+    /* the keys are sorted and unique, so they can be binary searched */
+    for (i = 0; valid && i < header->keys; i++) {
+        valid = keyIndex[i] != 0 && keyIndex[i] < size &&
+            (i == 0 || strcmp(contents + keyIndex[i - 1], contents + keyIndex[i]) < 0);
+    }
+
+    if (!valid) {
+        g_warning(_lhCatalogCorruptedMsg, path);
+        g_mapped_file_unref(file);
+        return FALSE;
+    }
+
+    *catalog = file;
+
+    return TRUE;
+}
+
+/* it uses the strings of a checked catalog */
+static void set_catalog(LocalizationHandler* lh, GMappedFile* catalog) {
+    const char* contents = g_mapped_file_get_contents(catalog);
+
+    lh->catalog = catalog;
+    lh->header = (const catalogHeader*)contents;
+    lh->directory = (const catalogLanguage*)(contents + sizeof(catalogHeader));
+    lh->keyIndex = (const guint32*)(lh->directory + lh->header->languages);
+}
+
+/* The strings of a source file, by language */
+typedef struct {
+    GStringChunk* arena;
+    GHashTable* keys;           /* the keys without locale */
+    GHashTable* languages;      /* language -> GHashTable of key -> value. "" for the untranslated strings */
+} catalogSource;
+
+static void compile_string_entry(const IniEntry* entry, void* userData) {
+    catalogSource* source = (catalogSource*)userData;
+    GHashTable* values = NULL;
+    char* language = NULL;
+    char* key = NULL;
+
+    if (ini_string_equal(&entry->group, DEFAULT_GROUP) == FALSE)
+        return;
+
+    language = ini_string_insert_const(source->arena, &entry->locale);
+    key = ini_string_insert_const(source->arena, &entry->key);
+
+    values = g_hash_table_lookup(source->languages, language);
+
+    if (values == NULL) {
+        values = g_hash_table_new(g_str_hash, g_str_equal);
+        g_hash_table_insert(source->languages, language, values);
+    }
+
+    g_hash_table_add(source->keys, key);
+    g_hash_table_insert(values, key, ini_string_insert_unescaped(source->arena, &entry->value));
+}
+
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Returns the strings of the table, sorted */
+static GPtrArray* get_sorted_keys(GHashTable* table) {
+    GPtrArray* keys = NULL;
+    GHashTableIter iter;
+    void* key = NULL;
+
+    keys = g_ptr_array_sized_new(g_hash_table_size(table));
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_ptr_array_add(keys, key);
+    }
+
+    g_ptr_array_sort(keys, compare_strings);
+
+    return keys;
+}
+
+static guint32 append_catalog_string(GByteArray* data, const char* string) {
+    guint32 offset = data->len;
+
+    g_byte_array_append(data, (const guint8*)string, strlen(string) + 1);
+
+    return offset;
+}
+
+static void set_catalog_offset(GByteArray* data, guint32 position, guint32 offset) {
+    memcpy(data->data + position, &offset, sizeof(guint32));
+}
+
+static void align_catalog(GByteArray* data) {
+    static const guint8 padding[sizeof(guint32)] = { 0 };
+
+    g_byte_array_append(data, padding, (sizeof(guint32) - data->len % sizeof(guint32)) % sizeof(guint32));
+}
+
+/* It writes the binary catalog of the source strings */
+static GByteArray* write_catalog(catalogSource* source) {
+    static const guint8 terminator[sizeof(guint32)] = { 0 };
+    GByteArray* data = NULL;
+    GPtrArray* keys = NULL;
+    GPtrArray* languages = NULL;
+    GHashTable* values = NULL;
+    catalogHeader header;
+    guint32 directory = sizeof(catalogHeader);
+    guint32 keyIndex = 0;
+    guint32 section = 0;
+    const char* value = NULL;
+    guint32 i = 0;
+    guint32 j = 0;
+
+    keys = get_sorted_keys(source->keys);
+    languages = get_sorted_keys(source->languages);
+
+    memset(&header, 0, sizeof(catalogHeader));
+    memcpy(header.magic, CATALOG_MAGIC, CATALOG_MAGIC_SIZE);
+    header.version = CATALOG_VERSION;
+    header.languages = languages->len;
+    header.keys = keys->len;
+
+    keyIndex = directory + languages->len * sizeof(catalogLanguage);
+
+    data = g_byte_array_new();
+    g_byte_array_set_size(data, keyIndex + keys->len * sizeof(guint32));
+    memcpy(data->data, &header, sizeof(catalogHeader));
+
+    /* the keys and the language names, shared by every language */
+    for (i = 0; i < keys->len; i++) {
+        set_catalog_offset(data, keyIndex + i * sizeof(guint32), append_catalog_string(data, g_ptr_array_index(keys, i)));
+    }
+
+    for (j = 0; j < languages->len; j++) {
+        set_catalog_offset(data, directory + j * sizeof(catalogLanguage),
+            append_catalog_string(data, g_ptr_array_index(languages, j)));
+    }
+
+    /* a section per language, so only the pages of the used ones are read */
+    for (j = 0; j < languages->len; j++) {
+        align_catalog(data);
+
+        values = g_hash_table_lookup(source->languages, g_ptr_array_index(languages, j));
+        section = data->len;
+
+        set_catalog_offset(data, directory + j * sizeof(catalogLanguage) + sizeof(guint32), section);
+        g_byte_array_set_size(data, section + keys->len * sizeof(guint32));
+        memset(data->data + section, 0, keys->len * sizeof(guint32));
+
+        for (i = 0; i < keys->len; i++) {
+            value = g_hash_table_lookup(values, g_ptr_array_index(keys, i));
+
+            if (value != NULL)
+                set_catalog_offset(data, section + i * sizeof(guint32), append_catalog_string(data, value));
+        }
+    }
+
+    g_byte_array_append(data, terminator, sizeof(terminator));
+
+    g_ptr_array_free(languages, TRUE);
+    g_ptr_array_free(keys, TRUE);
+
+    return data;
+}
+
+/* It calls the change handlers with the current language */
+static void rise_change_events(LocalizationHandler* lh) {
+    lhEventContainer* container = NULL;
+    languageTable* table = NULL;
+    GSList* handlers = NULL;
+    GSList* item = NULL;
+
+    g_rec_mutex_lock(&lh->notifyLock);
+
+    g_mutex_lock(&lh->lock);
+    handlers = g_slist_copy(lh->changeEventHandler);
+    g_mutex_unlock(&lh->lock);
+
+    enter_lookup(lh);
+
+    table = g_atomic_pointer_get(&lh->active);
+
+    for (item = handlers; item; item = g_slist_next(item)) {
+        container = (lhEventContainer*)item->data;
+        container->callback(lh, table != NULL ? table->language : NULL, container->userData);
+    }
+
+    leave_lookup(lh);
+
+    g_slist_free(handlers);
+
+    g_rec_mutex_unlock(&lh->notifyLock);
+}
+
+/* Returns TRUE if the keys of the string identifiers are the keys of the catalog */
+static int check_string_ids(LocalizationHandler* lh) {
+    unsigned int i = 0;
+
+    if (lh->catalog != NULL) {
+        if (lh->idCount != lh->header->keys)
+            return FALSE;
+
+        for (i = 0; i < lh->idCount; i++) {
+            if (!catalog_has_key(lh, lh->idKeys[i]))
+                return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    if (lh->idCount != g_hash_table_size(lh->keys))
+        return FALSE;
+
+    for (i = 0; i < lh->idCount; i++) {
+        if (!g_hash_table_contains(lh->keys, lh->idKeys[i]))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Returns the table of the current language, or of the default one if it's not set. It's taken
+ * once per call, so all the strings of a bulk lookup are of the same language */
+static languageTable* get_active_table(LocalizationHandler* lh) {
+    languageTable* table = g_atomic_pointer_get(&lh->active);
+
+    if (G_UNLIKELY(table == NULL))
+        table = get_table(lh, DEFAULT_LANGUAGE);
+
+    return table;
 }
 
 /* Implementations */
 LocalizationHandler* lh_new(const char* filePath, const char* language) {
     LocalizationHandler* lh = NULL;
 
-    lh = g_new(LocalizationHandler, 1);
-    lh->file = g_key_file_new();
+    lh = g_new0(LocalizationHandler, 1);
+    lh->strings = g_hash_table_new(g_str_hash, g_str_equal);
+    lh->keys = g_hash_table_new(g_str_hash, g_str_equal);
+    lh->arena = g_string_chunk_new(STRINGS_BLOCK_SIZE);
+    lh->tables = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_table);
+    lh->active = NULL;
+    lh->retired = g_ptr_array_new_with_free_func(free_retired);
+    lh->retiredCount = 0;
+    lh->readers = 0;
+    lh->idKeys = NULL;
+    lh->idCount = 0;
+    lh->catalog = NULL;
+    lh->changeEventHandler = NULL;
+    g_mutex_init(&lh->lock);
+    g_rec_mutex_init(&lh->notifyLock);
     lh->supportedLanguages = g_get_language_names();
 
     g_return_if_fail(lh->supportedLanguages != NULL);
@@ -71,11 +668,31 @@ LocalizationHandler* lh_new(const char* filePath, const char* language) {
 void lh_free(LocalizationHandler* lh) {
     g_return_if_fail(lh != NULL);
 
-    g_key_file_free(lh->file);
+    g_hash_table_destroy(lh->tables);
+    g_ptr_array_free(lh->retired, TRUE);
+    g_hash_table_destroy(lh->keys);
+
+    if (lh->catalog != NULL)
+        g_mapped_file_unref(lh->catalog);
+
+    g_hash_table_destroy(lh->strings);
+    g_string_chunk_free(lh->arena);
+    g_mutex_clear(&lh->lock);
+    g_rec_mutex_clear(&lh->notifyLock);
+    g_slist_free_full(lh->changeEventHandler, g_free);
+    g_strfreev(lh->idKeys);
     g_free(lh->path);
     g_free(lh->language);
     
-    lh->file = NULL;
+    lh->strings = NULL;
+    lh->keys = NULL;
+    lh->tables = NULL;
+    lh->active = NULL;
+    lh->retired = NULL;
+    lh->idKeys = NULL;
+    lh->catalog = NULL;
+    lh->changeEventHandler = NULL;
+    lh->arena = NULL;
     lh->supportedLanguages = NULL;
     lh->path = NULL;
     lh->language = NULL;
@@ -84,31 +701,74 @@ void lh_free(LocalizationHandler* lh) {
 }
 
 void lh_load_file(LocalizationHandler* lh, const char* path) {
-    GKeyFileFlags flags;
-    GError *error = NULL;
+    languageTable* table = NULL;
+    GMappedFile* catalog = NULL;
+    int matching = TRUE;
 
     g_return_if_fail(lh != NULL);
     g_return_if_fail(path != NULL);
     g_return_if_fail(g_file_test(path, G_FILE_TEST_EXISTS) == TRUE);
     g_return_if_fail(g_file_test(path, G_FILE_TEST_IS_REGULAR) == TRUE);
 
+    /* a corrupted catalog leaves the strings loaded before */
+    if (!load_catalog(path, &catalog))
+        return;
+
+    g_mutex_lock(&lh->lock);
+
     /* copy the localization file string */
+    g_free(lh->path);
     lh->path = g_strdup(path);
 
-    /* load localization file */
-    flags = G_KEY_FILE_KEEP_TRANSLATIONS;
+    /* the current table and its strings stay valid for the threads looking them up */
+    retire_tables(lh);
+    retire(lh, lh->arena, (GDestroyNotify)g_string_chunk_free);
+    retire(lh, lh->catalog, (GDestroyNotify)g_mapped_file_unref);
 
-    if (!g_key_file_load_from_file(lh->file, path, flags, &error)) {
-        print_error(error);
-        return;
-    }
+    lh->arena = g_string_chunk_new(STRINGS_BLOCK_SIZE);
+    lh->catalog = NULL;
+
+    /* load localization file, keeping all the translations */
+    g_hash_table_remove_all(lh->keys);
+    g_hash_table_remove_all(lh->strings);
+
+    /* a binary catalog is mapped, a source file is parsed */
+    if (catalog != NULL)
+        set_catalog(lh, catalog);
+    else
+        ini_parse_file(path, load_string_entry, lh);
+
+    /* the compiled identifiers must match the catalog */
+    if (lh->idCount > 0)
+        matching = check_string_ids(lh);
+
+    /* the strings of the current language are resolved again */
+    if (lh->language != NULL)
+        table = find_table(lh, lh->language);
+
+    g_atomic_pointer_set(&lh->active, table);
+    collect_retired(lh);
+
+    g_mutex_unlock(&lh->lock);
+
+    if (!matching)
+        g_warning(_lhIdsMismatchMsg, path);
+
+    rise_change_events(lh);
 }
 
-const char* lh_get_file_path(LocalizationHandler* lh) {
+char* lh_get_file_path(LocalizationHandler* lh) {
+    char* path = NULL;
+
     g_return_val_if_fail(lh != NULL, NULL);
-    g_return_val_if_fail(lh->path != NULL, NULL);
-    
-    return g_strdup(lh->path);
+
+    g_mutex_lock(&lh->lock);
+    path = g_strdup(lh->path);
+    g_mutex_unlock(&lh->lock);
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    return path;
 }
 
 const char* const* lh_get_supported_languages(LocalizationHandler* lh) {
@@ -143,6 +803,8 @@ int lh_language_is_supported(LocalizationHandler* lh, const char* language) {
 }
 
 void lh_set_language(LocalizationHandler* lh, const char* language) {
+    languageTable* table = NULL;
+    int changed = FALSE;
     GError* error = NULL;
     char* errorMsg = NULL;
 
@@ -162,35 +824,261 @@ void lh_set_language(LocalizationHandler* lh, const char* language) {
          return;
     }
 
-    /* setup the language if supported */
+    /* the strings are resolved once per language, then the tables are swapped. Both under the lock,
+     * so a reload can't retire the table in between */
+    g_mutex_lock(&lh->lock);
+
+    table = find_table(lh, language);
+
+    g_free(lh->language);
     lh->language = g_strdup(language);
+
+    changed = g_atomic_pointer_exchange(&lh->active, table) != table;
+
+    g_mutex_unlock(&lh->lock);
+
+    if (changed)
+        rise_change_events(lh);
+}
+
+void lh_prepare_language(LocalizationHandler* lh, const char* language) {
+    g_return_if_fail(lh != NULL);
+    g_return_if_fail(language != NULL);
+
+    get_table(lh, language);
 }
 
 const char* lh_get_language(LocalizationHandler* lh) {
-    char* language = NULL;
+    languageTable* table = NULL;
 
     g_return_val_if_fail(lh != NULL, NULL);
 
-    language = g_strdup(lh->language);
+    /* the string of the table, which is replaced only by a reload or new identifiers */
+    table = g_atomic_pointer_get(&lh->active);
+
+    return table != NULL ? table->language : NULL;
+}
+
+void lh_add_change_event(LocalizationHandler* lh, lhChangeFunc handler, void* userData) {
+    lhEventContainer* container = NULL;
+
+    g_return_if_fail(lh != NULL);
+    g_return_if_fail(handler != NULL);
+
+    container = g_new(lhEventContainer, 1);
+    container->callback = handler;
+    container->userData = userData;
 
-    return language;
+    g_mutex_lock(&lh->lock);
+    lh->changeEventHandler = g_slist_append(lh->changeEventHandler, (void*)container);
+    g_mutex_unlock(&lh->lock);
+}
+
+void lh_remove_change_event(LocalizationHandler* lh, lhChangeFunc handler, void* userData) {
+    lhEventContainer* container = NULL;
+    GSList* item = NULL;
+
+    g_return_if_fail(lh != NULL);
+    g_return_if_fail(handler != NULL);
+
+    /* wait for the notifications in progress */
+    g_rec_mutex_lock(&lh->notifyLock);
+    g_mutex_lock(&lh->lock);
+
+    for (item = lh->changeEventHandler; item; item = g_slist_next(item)) {
+        container = (lhEventContainer*)item->data;
+
+        if (container->callback == handler && container->userData == userData) {
+            lh->changeEventHandler = g_slist_remove(lh->changeEventHandler, container);
+            g_free(container);
+            break;
+        }
+    }
+
+    g_mutex_unlock(&lh->lock);
+    g_rec_mutex_unlock(&lh->notifyLock);
 }
 
 const char* lh_get_string(LocalizationHandler* lh, const char* key) {
-    return lh_get_localized_string(lh, key, DEFAULT_LANGUAGE);
+    languageTable* table = NULL;
+    const char* string = NULL;
+
+    g_return_val_if_fail(lh != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    enter_lookup(lh);
+
+    /* without a language, the strings are the default language ones */
+    table = get_active_table(lh);
+    string = g_hash_table_lookup(table->strings, key);
+
+    leave_lookup(lh);
+
+    return string;
 }
 
 const char* lh_get_localized_string(LocalizationHandler* lh, const char* key, const char* language) {
-    char* value = NULL;
-    char* supportedLanguage = NULL;
+    languageTable* table = NULL;
+    const char* string = NULL;
 
     g_return_val_if_fail(lh != NULL, NULL);
     g_return_val_if_fail(key != NULL, NULL);
 
-    supportedLanguage = get_supported_language(lh, language);
+    if (language == NULL)
+        return lh_get_string(lh, key);
 
-    value = g_key_file_get_locale_string(lh->file, DEFAULT_GROUP, key, supportedLanguage, NULL);
+    enter_lookup(lh);
 
-    return value;
+    table = g_atomic_pointer_get(&lh->active);
+
+    if (table == NULL || g_strcmp0(table->language, language) != 0)
+        table = get_table(lh, language);
+
+    string = g_hash_table_lookup(table->strings, key);
+
+    leave_lookup(lh);
+
+    return string;
+}
+
+int lh_set_string_ids(LocalizationHandler* lh, const char* const* keys, unsigned int count) {
+    languageTable* table = NULL;
+    int matching = FALSE;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(lh != NULL, FALSE);
+    g_return_val_if_fail(keys != NULL || count == 0, FALSE);
+
+    g_mutex_lock(&lh->lock);
+
+    /* the keys are only read while the tables are built */
+    g_strfreev(lh->idKeys);
+
+    lh->idKeys = g_new(char*, count + 1);
+    lh->idCount = count;
+
+    for (i = 0; i < count; i++) {
+        lh->idKeys[i] = g_strdup(keys[i]);
+    }
+
+    lh->idKeys[count] = NULL;
+
+    /* the tables are built again with the identifiers */
+    retire_tables(lh);
+
+    if (lh->language != NULL)
+        table = find_table(lh, lh->language);
+
+    matching = check_string_ids(lh);
+
+    g_atomic_pointer_set(&lh->active, table);
+    collect_retired(lh);
+
+    g_mutex_unlock(&lh->lock);
+
+    rise_change_events(lh);
+
+    return matching;
 }
 
+const char* lh_get_string_id(LocalizationHandler* lh, unsigned int id) {
+    languageTable* table = NULL;
+    const char* string = NULL;
+    int valid = FALSE;
+
+    g_return_val_if_fail(lh != NULL, NULL);
+
+    enter_lookup(lh);
+
+    table = get_active_table(lh);
+    valid = id < table->idCount;
+
+    if (valid)
+        string = table->byId[id];
+
+    leave_lookup(lh);
+
+    g_return_val_if_fail(valid, NULL);
+
+    return string;
+}
+
+int lh_compile_catalog(const char* sourcePath, const char* path) {
+    catalogSource source;
+    GByteArray* data = NULL;
+    GError* error = NULL;
+    int written = FALSE;
+
+    g_return_val_if_fail(STRING_IS_VALID(sourcePath), FALSE);
+    g_return_val_if_fail(STRING_IS_VALID(path), FALSE);
+
+    source.arena = g_string_chunk_new(STRINGS_BLOCK_SIZE);
+    source.keys = g_hash_table_new(g_str_hash, g_str_equal);
+    source.languages = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+
+    if (ini_parse_file(sourcePath, compile_string_entry, &source)) {
+        data = write_catalog(&source);
+        written = g_file_set_contents(path, (const char*)data->data, data->len, &error);
+
+        if (!written)
+            print_error(error);
+
+        g_byte_array_free(data, TRUE);
+    }
+
+    g_hash_table_destroy(source.languages);
+    g_hash_table_destroy(source.keys);
+    g_string_chunk_free(source.arena);
+
+    return written;
+}
+
+unsigned int lh_get_strings(LocalizationHandler* lh, const char* const* keys, unsigned int count, const char** strings) {
+    languageTable* table = NULL;
+    unsigned int found = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(lh != NULL, 0);
+    g_return_val_if_fail(keys != NULL || count == 0, 0);
+    g_return_val_if_fail(strings != NULL || count == 0, 0);
+
+    enter_lookup(lh);
+
+    table = get_active_table(lh);
+
+    for (i = 0; i < count; i++) {
+        strings[i] = keys[i] != NULL ? g_hash_table_lookup(table->strings, keys[i]) : NULL;
+
+        if (strings[i] != NULL)
+            found++;
+    }
+
+    leave_lookup(lh);
+
+    return found;
+}
+
+unsigned int lh_get_strings_id(LocalizationHandler* lh, const unsigned int* ids, unsigned int count, const char** strings) {
+    languageTable* table = NULL;
+    unsigned int found = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(lh != NULL, 0);
+    g_return_val_if_fail(ids != NULL || count == 0, 0);
+    g_return_val_if_fail(strings != NULL || count == 0, 0);
+
+    enter_lookup(lh);
+
+    table = get_active_table(lh);
+
+    for (i = 0; i < count; i++) {
+        strings[i] = ids[i] < table->idCount ? table->byId[ids[i]] : NULL;
+
+        if (strings[i] != NULL)
+            found++;
+    }
+
+    leave_lookup(lh);
+
+    return found;
+}
@@ -24,17 +24,32 @@
 struct LocalizationHandler_type;
 typedef struct LocalizationHandler_type LocalizationHandler;
 
+/* Change event handler, called after the current language changes, the file is reloaded or the string
+ * identifiers are bound */
+typedef void (*lhChangeFunc)(LocalizationHandler* lh, const char* language, void* userData);
+
 /* Creates a localization handler */
 LocalizationHandler* lh_new(const char* path, const char* language);
 
 /* Releases a localization handler resources */
 void lh_free(LocalizationHandler* lh);
 
-/* Loads the localization file  */
+/* Loads the localization file. A binary catalog, see lh_compile_catalog(), is mapped in memory
+ * and only the pages of the languages in use are read. Other threads can look up strings meanwhile:
+ * the old strings are freed once no lookup is in progress, so the strings returned before the reload
+ * must not be used after it. The change handlers are called to look them up again. A truncated or
+ * corrupted catalog is reported and the strings loaded before are kept. */
 void lh_load_file(LocalizationHandler* lh, const char* path);
 
-/* Returns the localization file path */
-const char* lh_get_file_path(LocalizationHandler* lh);
+/* It compiles a localization source file into a binary catalog, with a section per language, the
+ * sorted keys and the unescaped strings. The keys are binary searched, not hashed at load time.
+ * It's in the byte order of the machine that compiled it.
+ * Returns FALSE if the source can't be read or the catalog can't be written. */
+int lh_compile_catalog(const char* sourcePath, const char* path);
+
+/* Returns a copy of the localization file path, which must be freed with g_free(). It's a copy
+ * because lh_load_file() replaces the path while other threads may be reading it. */
+char* lh_get_file_path(LocalizationHandler* lh);
 
 /* Returns TRUE if language is supported. FALSE otherwise  */
 int lh_language_is_supported(LocalizationHandler* lh, const char* language);
@@ -42,16 +57,51 @@ int lh_language_is_supported(LocalizationHandler* lh, const char* language);
 /* Returns the array of supported languages */
 const char* const* lh_get_supported_languages(LocalizationHandler* lh);
 
-/* Sets the default language */
+/* Sets the current language. Its table is built the first time, then switching is a pointer swap,
+ * safe while other threads look up strings, which get the old or the new language. The change
+ * handlers are called when the language actually changes. */
 void lh_set_language(LocalizationHandler* lh, const char* language);
 
-/* Returns the current language */
+/* Builds the table of a language in advance, so switching to it doesn't resolve the strings.
+ * It can be called from any thread, ie. a background one at startup. */
+void lh_prepare_language(LocalizationHandler* lh, const char* language);
+
+/* Adds a handler called when the language changes, so the UI can refresh its text in one pass */
+void lh_add_change_event(LocalizationHandler* lh, lhChangeFunc handler, void* userData);
+
+/* Removes a change handler, waiting for the notifications in progress */
+void lh_remove_change_event(LocalizationHandler* lh, lhChangeFunc handler, void* userData);
+
+/* Returns the current language. The string belongs to the handler: it's valid until the next
+ * lh_set_language(), lh_load_file() or lh_set_string_ids(), so copy it to keep it longer. */
 const char* lh_get_language(LocalizationHandler* lh);
 
-/* Returns a localized string */
+/* Returns a localized string. Like every string returned by the lookups, it belongs to the handler
+ * and it's valid until the next lh_load_file(). */
 const char* lh_get_string(LocalizationHandler* lh, const char* key);
 
 /* Returns a string, localized for the given language */
 const char* lh_get_localized_string(LocalizationHandler* lh, const char* key, const char* language);
 
+/* It binds the string identifiers generated by lh_gen_ids (see "make ids") to their keys, ie.
+ *
+ *     static const char* const keys[] = LH_STRING_KEYS;
+ *     lh_set_string_ids(lh, keys, LH_STRING_COUNT);
+ *
+ * The tables are built again and swapped like a reload, so it can run while other threads look up
+ * strings. Returns FALSE if the keys don't match the loaded catalog. lh_load_file() checks them again. */
+int lh_set_string_ids(LocalizationHandler* lh, const char* const* keys, unsigned int count);
+
+/* Returns the localized string of an identifier, with a direct index in the table of the current language */
+const char* lh_get_string_id(LocalizationHandler* lh, unsigned int id);
+
+/* It looks up many strings in one pass over the table of the current language, ie. all the labels of a
+ * panel, filling the strings array with borrowed strings, NULL for the missing ones. The fallbacks are
+ * already resolved and all the strings are of the same language, even if it changes meanwhile.
+ * Returns the number of strings found. */
+unsigned int lh_get_strings(LocalizationHandler* lh, const char* const* keys, unsigned int count, const char** strings);
+
+/* Like lh_get_strings(), with string identifiers instead of keys */
+unsigned int lh_get_strings_id(LocalizationHandler* lh, const unsigned int* ids, unsigned int count, const char** strings);
+
 #endif
@@ -0,0 +1,22 @@
+/*
+ * localization_ids.h
+ *
+ * Generated by lh_gen_ids from localization.txt, do not edit.
+ */
+
+#ifndef LOCALIZATION_IDS_H
+#define LOCALIZATION_IDS_H
+
+/* The identifiers of the localized strings, see lh_get_string_id() */
+typedef enum {
+    LH_STRING_SAVE,
+    LH_STRING_OPEN,
+    LH_STRING_CLOSE,
+    LH_STRING_EXIT,
+    LH_STRING_COUNT
+} lhStringId;
+
+/* The keys of the identifiers, in the same order, for lh_set_string_ids() */
+#define LH_STRING_KEYS { "Save", "Open", "Close", "Exit" }
+
+#endif
@@ -17,101 +17,2831 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
 #include <glib.h>
 #include "messages.h"
 #include "definitions.h"
 #include "utils.h"
+#include "ring_buffer.h"
+#include "topic_trie.h"
+#include "perfect_hash.h"
+
+#define MSG_QUEUE_DEFAULT_SIZE 4096
+
+/* times a worker polls the empty queue before sleeping */
+#define MSG_QUEUE_SPINS 64
+
+/* us between two runs of the main loop sources of the thread waiting for a flush */
+#define MSG_FLUSH_POLL 1000
+
+/* one pop out of MSG_PRIORITY_FAIR_SHARE serves a lower priority first, so
+ * a flood of higher priority messages can't starve it */
+#define MSG_PRIORITY_FAIR_SHARE 8
+
+/* the priority and deadline of a posted message are the word ones */
+#define MSG_PRIORITY_OF_WORD (-1)
+
+/* matched topics whose subscribers are cached */
+#define MSG_TOPICS_CACHE_SIZE 4096
+
+/* output blocks are pooled in power of two sizes, up to 2^(classes - 1) PackageData */
+#define MSG_OUTPUT_CLASSES 11
+#define MSG_OUTPUT_UNPOOLED MSG_OUTPUT_CLASSES
+
+/* free blocks a thread keeps for every size, the others go back to the handler */
+#define MSG_OUTPUT_CACHE_SIZE 64
+
+/* pooled blocks are carved from chunks aligned to their size, so the chunk of
+ * a pointer tells whether the handler allocated it */
+#define MSG_OUTPUT_CHUNK_BITS 16
+#define MSG_OUTPUT_CHUNK_SIZE (1u << MSG_OUTPUT_CHUNK_BITS)
+
+/* slots of the first set of chunks */
+#define MSG_OUTPUT_CHUNK_SLOTS 64
+
+/* The chunks of the output blocks, an open addressing set of their addresses */
+typedef struct {
+    unsigned int mask;
+    gpointer slots[];           /* NULL if empty */
+} outputChunks;
 
 /* The message handler */
 struct MessageHandler_type {
-    GHashTable* dictionary;
+    GHashTable* dictionary;     /* word -> message id + 1 */
+    GPtrArray* words;           /* callbackContainer, indexed by message id */
+    PerfectHash* frozen;        /* word -> message id, used instead of the dictionary once frozen */
+
+    /* asynchronous dispatch */
+    GMutex lock;                /* it protects the serial queues and the idle condition */
+    GCond idle;                 /* signaled when there are no pending messages */
+    gint pending;               /* posted messages not completed yet */
+    unsigned int numWorkers;
+    GPtrArray* workers;         /* running GThreads, empty until the first post */
+
+    RingBuffer* queues[MSG_PRIORITY_LEVELS];   /* messageJob, one queue per priority */
+    GMutex deadlineLock;        /* it protects the deadline queues */
+    GPtrArray* deadlines[MSG_PRIORITY_LEVELS]; /* messageJob with a deadline, min-heaps served before the queues */
+    gint numDeadlines;          /* queued messages with a deadline, so the lock is skipped without them */
+    guint64 lastSequence;       /* it keeps the post order of equal deadlines */
+    msgQueuePolicy policy;
+    gint dropped;               /* messages dropped or rejected because the queue was full */
+    gint pops;                  /* messages taken from the queues */
+    gint missedDeadlines;
+    gint coalesced;             /* messages replaced by newer ones of a coalescing word */
+
+    /* rate limited coalescing words, protected by lock */
+    GThread* timer;             /* it queues the words when their interval has elapsed */
+    GCond timerCond;
+    GPtrArray* timers;          /* callbackContainer waiting for their interval */
+    int timerQuit;
+    GMutex queueLock;           /* only used to sleep on the queue */
+    GCond notEmpty;
+    GCond notFull;
+    gint sleepingWorkers;
+    gint sleepingProducers;
+
+    /* publish/subscribe */
+    GMutex topicsLock;          /* it protects the topics, the subscribers and the cache */
+    TopicTrie* topics;          /* msgSubscriber */
+    GHashTable* subscribers;    /* subscription -> msgSubscriber */
+    GHashTable* topicsCache;    /* topic -> GPtrArray of msgSubscriber, sorted by subscription */
+    unsigned int lastSubscription;
+
+    /* output arena */
+    guint id;                   /* unique, unlike the address of a freed handler */
+    GMutex outputLock;          /* it protects the pool, the chunks and the big blocks */
+    GPtrArray* freeOutputs[MSG_OUTPUT_CLASSES];    /* outputBlock given back by the threads */
+    outputChunks* chunks;       /* read without locking, replaced when it's half full */
+    GPtrArray* retiredChunks;   /* replaced sets, which readers may still be probing */
+    unsigned int numChunks;
+    char* chunk;                /* the chunk being carved */
+    unsigned int chunkUsed;
+    GHashTable* bigOutputs;     /* data -> outputBlock too big to be pooled, not released yet */
+
+    GPtrArray* mailboxes;       /* MessageMailbox, freed with the handler */
+    GPtrArray* sources;         /* messageSource, destroyed with the handler */
+
+    msgTraceFunc trace;         /* called with every dispatched package, NULL if it's not traced */
+    void* traceData;
+
+    gint statsEnabled;
 };
 
+/* A buffer of output data, allocated by mh_alloc_output(). The header lies
+ * in front of the data, so releasing the data finds it without a lookup */
+typedef struct {
+    unsigned int sizeClass;     /* MSG_OUTPUT_UNPOOLED if it's too big to be pooled */
+    PackageData data[];
+} outputBlock;
+
+/* The free blocks a thread keeps for the last handler it used, taken and
+ * given back without locking */
+typedef struct {
+    MessageHandler* mh;         /* NULL if it's not bound */
+    guint id;
+    GPtrArray* blocks[MSG_OUTPUT_CLASSES];
+} outputCache;
+
+/* The dispatch running on the current thread. Blocks allocated by a callback
+ * are freed when it returns, unless the output refers to them */
+typedef struct {
+    MessageHandler* mh;
+    GPtrArray* blocks;          /* outputBlock allocated by the running callbacks */
+    outputCache cache;
+} dispatchContext;
+
+/* handlers not freed yet, so a thread gives its cached blocks back only to a live one */
+static GMutex _handlersLock;
+static GHashTable* _handlers = NULL;   /* id -> MessageHandler */
+static guint _lastHandlerId = 0;
+
+/* it gives the cached blocks back to their handler, if it's still alive */
+static void flush_cache(outputCache* cache) {
+    MessageHandler* mh = cache->mh;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    if (mh == NULL)
+        return;
+
+    g_mutex_lock(&_handlersLock);
+
+    if (_handlers != NULL && g_hash_table_lookup(_handlers, GUINT_TO_POINTER(cache->id)) == mh) {
+        g_mutex_lock(&mh->outputLock);
+
+        for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+            for (j = 0; j < cache->blocks[i]->len; j++) {
+                g_ptr_array_add(mh->freeOutputs[i], g_ptr_array_index(cache->blocks[i], j));
+            }
+        }
+
+        g_mutex_unlock(&mh->outputLock);
+    }
+
+    g_mutex_unlock(&_handlersLock);
+
+    /* the blocks of a freed handler have been freed with its chunks */
+    for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+        g_ptr_array_set_size(cache->blocks[i], 0);
+    }
+
+    cache->mh = NULL;
+}
+
+static void free_dispatch_context(void* data) {
+    dispatchContext* ctx = (dispatchContext*)data;
+    unsigned int i = 0;
+
+    flush_cache(&ctx->cache);
+
+    for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+        g_ptr_array_free(ctx->cache.blocks[i], TRUE);
+    }
+
+    g_ptr_array_free(ctx->blocks, TRUE);
+    g_free(ctx);
+}
+
+static GPrivate _dispatchContext = G_PRIVATE_INIT(free_dispatch_context);
+
+/* The statistics of a word. Workers update them with relaxed atomics, so they
+ * can be read while messages are dispatched without slowing the dispatch down.
+ * GLib has no 64 bits atomics, so the GCC builtins are used */
 typedef struct {
+    guint calls;
+    guint64 totalTime;          /* ns */
+    guint64 maxTime;            /* ns */
+    guint histogram[MSG_STATS_BUCKETS];
+    guint missedDeadlines;
+} wordStats;
+
+#define STATS_GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STATS_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define STATS_ADD(x, v) __atomic_fetch_add(&(x), (v), __ATOMIC_RELAXED)
+
+typedef struct {
+	char* word;
 	msgCallback callback;
+	msgCallbackFull callbackFull;    /* it's used instead of callback, with userData */
+	void* userData;
+	msgBatchCallback batchCallback;  /* NULL if the word doesn't handle batches */
+	MessageMailbox* mailbox;    /* messages run one at a time in the mailbox, NULL if they run in parallel */
+	MessageMailbox* ownMailbox; /* the mailbox of a serial word */
+	struct messageSource_type* source;  /* the main loop running the posted messages, NULL for the workers */
+	msgPriority priority;
+	unsigned int deadline;      /* us from the post, 0 if there's no deadline */
+	msgDeadlinePolicy deadlinePolicy;
+	MessageFuture* trigger;     /* queued in place of the messages of a coalescing word, NULL otherwise */
+	MessageFuture* latest;      /* the pending message of a coalescing word */
+	int scheduled;              /* the trigger is queued or waiting, or its message is running */
+	unsigned int interval;      /* minimum time between two calls of a coalescing word, in us */
+	gint64 nextRun;             /* monotonic time of the next call of a coalescing word */
+	wordStats stats;
 } callbackContainer;
 
-static callbackContainer* new_callbackContainer(msgCallback callback) {
+typedef struct {
+    unsigned int subscription;
+    char* pattern;
+    msgSubscriberFunc func;
+    void* userData;
+    gint refCount;              /* the handler and the cached topics */
+} msgSubscriber;
+
+/* The messages of the words of a mailbox run one at a time, on any worker. They are queued
+ * to the mailbox when they are posted, and the workers get only its token */
+struct MessageMailbox_type {
+    char* name;
+    GMutex lock;
+    GCond notFull;
+    int scheduled;              /* the token is queued, or a worker is running the messages */
+    int blocked;                /* producers waiting for the queue, which holds as many messages as a worker queue */
+    GQueue queue;               /* messages in post order */
+    struct MessageFuture_type* token;   /* queued to the workers to run the messages */
+};
+
+/* A posted message. It's also the future returned to the caller */
+struct MessageFuture_type {
+    MessageHandler* mh;
+    callbackContainer* cont;
+    msgSubscriber* subscriber;  /* the subscriber to call instead of the word callback */
+    Package pkg;
+    Package output;
+    unsigned int sizeOutput;
+    msgDoneFunc done;
+    void* userData;
+    msgPriority priority;
+    gint64 deadline;            /* monotonic time, 0 if there's no deadline */
+    gint64 expiry;              /* monotonic time the caller stops waiting, 0 if it waits forever */
+    int dropExpired;            /* it's dropped if it starts after the deadline, otherwise it runs late */
+    guint64 sequence;           /* post order in the deadline queue */
+    int trigger;                /* it stands for the pending message of a coalescing word */
+    MessageMailbox* mailbox;    /* the mailbox to run, for the token of a mailbox */
+    int latest;                 /* it has been taken by the trigger of its coalescing word */
+
+    GMutex lock;
+    GCond cond;
+    int completed;
+    int processed;              /* FALSE if it has been dropped */
+    gint refCount;              /* the caller and the worker */
+};
+
+typedef MessageFuture messageJob;
+
+/* A main loop source, which runs the posted messages of its words in batches. Producers
+ * wake the main loop up only when the queue was empty, so there's one wakeup per batch */
+typedef struct messageSource_type {
+    GSource source;
+    MessageHandler* mh;
+    GMutex lock;                /* it protects the queue and the flags */
+    GQueue queue;               /* messageJob waiting for the main loop */
+    int scheduled;              /* the source is ready or running, so it doesn't need a wakeup */
+    int closed;                 /* the message handler is being freed */
+    gint budget;                /* time per main loop iteration, in us. 0 for no limit */
+} messageSource;
+
+/* it's pushed once per worker to stop the pool */
+static messageJob _quitJob;
+
+static MessageMailbox* new_mailbox(const char* name) {
+    MessageMailbox* mailbox = NULL;
+
+    mailbox = g_new(MessageMailbox, 1);
+    mailbox->name = g_strdup(name);
+    mailbox->scheduled = FALSE;
+    mailbox->blocked = 0;
+    g_mutex_init(&mailbox->lock);
+    g_cond_init(&mailbox->notFull);
+    g_queue_init(&mailbox->queue);
+
+    mailbox->token = g_new0(messageJob, 1);
+    mailbox->token->mailbox = mailbox;
+
+    return mailbox;
+}
+
+static void free_mailbox(void* data) {
+    MessageMailbox* mailbox = (MessageMailbox*)data;
+
+    g_mutex_clear(&mailbox->lock);
+    g_cond_clear(&mailbox->notFull);
+    g_free(mailbox->token);
+    g_free(mailbox->name);
+    g_free(mailbox);
+}
+
+static callbackContainer* new_callbackContainer(const char* word) {
 	callbackContainer* cont;
 
-	cont = g_new(callbackContainer, 1);
-	cont->callback = callback;
+	cont = g_new0(callbackContainer, 1);
+	cont->word = g_strdup(word);
+	cont->callback = NULL;
+	cont->callbackFull = NULL;
+	cont->userData = NULL;
+	cont->batchCallback = NULL;
+	cont->mailbox = NULL;
+	cont->ownMailbox = NULL;
+	cont->source = NULL;
+	cont->priority = MSG_PRIORITY_NORMAL;
+	cont->deadline = 0;
+	cont->deadlinePolicy = MSG_DEADLINE_RUN_LATE;
+	cont->trigger = NULL;
+	cont->latest = NULL;
+	cont->interval = 0;
+	cont->nextRun = 0;
 
 	return cont;
 }
 
-static void add_item_to_dictionary(GHashTable* dict, const char* word, msgCallback callback) {
-	void* wordPtr = NULL;
+static void free_callbackContainer(void* data) {
+	callbackContainer* cont = (callbackContainer*)data;
+
+	g_free(cont->trigger);
+	g_free(cont->word);
+	g_free(cont);
+}
+
+static void add_item_to_dictionary(MessageHandler* mh, const char* word, msgCallback callback, msgCallbackFull callbackFull, void* userData) {
 	callbackContainer* cont = NULL;
-	
-	g_return_if_fail(dict != NULL);
+	msgId id = MSG_ID_INVALID;
+
+	g_return_if_fail(mh != NULL);
 	g_return_if_fail(word != NULL);
-	g_return_if_fail(callback != NULL);
+	g_return_if_fail(callback != NULL || callbackFull != NULL);
+
+	/* a known word keeps its identifier */
+	id = mh_resolve_word(mh, word);
+
+	if (id != MSG_ID_INVALID) {
+		cont = g_ptr_array_index(mh->words, id);
+	} else {
+		cont = new_callbackContainer(word);
+		id = mh->words->len;
 
-	wordPtr = (void**)g_strdup(word);
-	cont = new_callbackContainer(callback);
-	
-	g_hash_table_insert(dict, wordPtr, cont);
+		g_ptr_array_add(mh->words, cont);
+		g_hash_table_insert(mh->dictionary, cont->word, GINT_TO_POINTER(id + 1));
+
+		/* a frozen dictionary is built again with the new word */
+		if (mh->frozen != NULL && !mh_freeze(mh)) {
+			ph_free(mh->frozen);
+			mh->frozen = NULL;
+		}
+	}
+
+	cont->callback = callback;
+	cont->callbackFull = callbackFull;
+	cont->userData = userData;
 }
 
-/* Implementations */
-MessageHandler* mh_new(void) {
-    MessageHandler* mh = NULL;
+static msgSubscriber* new_subscriber(unsigned int subscription, const char* pattern, msgSubscriberFunc func, void* userData) {
+    msgSubscriber* subscriber = NULL;
 
-    mh = g_new(MessageHandler, 1);
-    mh->dictionary = g_hash_table_new(g_str_hash, g_str_equal);
+    subscriber = g_new(msgSubscriber, 1);
+    subscriber->subscription = subscription;
+    subscriber->pattern = g_strdup(pattern);
+    subscriber->func = func;
+    subscriber->userData = userData;
+    subscriber->refCount = 1;
 
-    return mh;
+    return subscriber;
 }
 
-void mh_free(MessageHandler* mh) {
-    g_assert(mh != NULL);
+static msgSubscriber* ref_subscriber(msgSubscriber* subscriber) {
+    g_atomic_int_inc(&subscriber->refCount);
 
-    /* remove dictionary */
-    g_hash_table_remove_all(mh->dictionary);
+    return subscriber;
+}
 
-    mh->dictionary = NULL;
-    g_free(mh);
-    
-    mh = NULL;
+static void unref_subscriber(void* data) {
+    msgSubscriber* subscriber = (msgSubscriber*)data;
+
+    if (!g_atomic_int_dec_and_test(&subscriber->refCount))
+        return;
+
+    g_free(subscriber->pattern);
+    g_free(subscriber);
 }
 
-const char* const* mh_get_dictionary(MessageHandler* mh, unsigned int* size) {
-    g_return_val_if_fail(mh != NULL, NULL);
+static int compare_subscribers(const void* a, const void* b) {
+    const msgSubscriber* first = *(msgSubscriber* const*)a;
+    const msgSubscriber* second = *(msgSubscriber* const*)b;
 
-    return g_hash_table_return_keys_to_array(mh->dictionary, &size);
+    return (first->subscription > second->subscription) - (first->subscription < second->subscription);
 }
 
-void mh_add_word(MessageHandler* mh, const char* word, msgCallback callback) {
-    g_return_if_fail(mh != NULL);
-    g_return_if_fail(word != NULL);
-    g_return_if_fail(callback != NULL);
+/* Returns the subscribers of a topic, in subscription order. The patterns are matched
+ * once per topic, then the result is cached until the subscriptions change */
+static GPtrArray* get_subscribers(MessageHandler* mh, const char* topic) {
+    GPtrArray* subscribers = NULL;
+    unsigned int i = 0;
+
+    g_mutex_lock(&mh->topicsLock);
+
+    subscribers = g_hash_table_lookup(mh->topicsCache, topic);
+
+    if (subscribers == NULL) {
+        subscribers = g_ptr_array_new_with_free_func(unref_subscriber);
+
+        tt_match(mh->topics, topic, subscribers);
+        g_ptr_array_sort(subscribers, compare_subscribers);
+
+        for (i = 0; i < subscribers->len; i++) {
+            ref_subscriber(g_ptr_array_index(subscribers, i));
+        }
+
+        if (g_hash_table_size(mh->topicsCache) >= MSG_TOPICS_CACHE_SIZE)
+            g_hash_table_remove_all(mh->topicsCache);
 
-	add_item_to_dictionary(mh->dictionary, word, callback);
+        g_hash_table_insert(mh->topicsCache, g_strdup(topic), subscribers);
+    }
+
+    g_ptr_array_ref(subscribers);
+
+    g_mutex_unlock(&mh->topicsLock);
+
+    return subscribers;
 }
 
-void mh_send_data(MessageHandler* mh, const Package pkg, Package* output, unsigned int* sizeOutput) {
-	void* key = NULL;
-	void* val = NULL;
-	msgCallback callback = NULL;
-	
-    g_return_if_fail(mh != NULL);
-	g_return_if_fail(output != NULL);
-	g_return_if_fail(sizeOutput != NULL);
-	g_return_if_fail(pkg.size <= G_MAXUINT);
-	
-	/* find the dictionary element */
-	key = g_strdup(pkg.name);
-	
-	if (g_hash_table_contains(mh->dictionary, key)) {
-		val = g_hash_table_lookup(mh->dictionary, key);
-
-		g_assert(val != NULL);
-
-		/* get the callback */
-		callback = ((callbackContainer*)val)->callback;
-		
-		/* run the callback */
-		((msgCallback)callback) (pkg.data, output, sizeOutput);
-	}
+static dispatchContext* get_dispatch_context(void) {
+    dispatchContext* ctx = NULL;
+    unsigned int i = 0;
+
+    ctx = g_private_get(&_dispatchContext);
+
+    if (G_UNLIKELY(ctx == NULL)) {
+        ctx = g_new(dispatchContext, 1);
+        ctx->mh = NULL;
+        ctx->blocks = g_ptr_array_new();
+        ctx->cache.mh = NULL;
+        ctx->cache.id = 0;
+
+        for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+            ctx->cache.blocks[i] = g_ptr_array_new();
+        }
+
+        g_private_set(&_dispatchContext, ctx);
+    }
+
+    return ctx;
+}
+
+/* it returns the free blocks of the current thread, bound to the handler */
+static outputCache* get_cache(MessageHandler* mh) {
+    outputCache* cache = &get_dispatch_context()->cache;
+
+    if (G_UNLIKELY(cache->mh != mh || cache->id != mh->id)) {
+        flush_cache(cache);
+
+        cache->mh = mh;
+        cache->id = mh->id;
+    }
+
+    return cache;
+}
+
+static guint chunk_hash(gconstpointer chunk) {
+    return (guint)(GPOINTER_TO_SIZE(chunk) >> MSG_OUTPUT_CHUNK_BITS) * 2654435761u;
+}
+
+static gpointer data_chunk(gconstpointer data) {
+    return GSIZE_TO_POINTER(GPOINTER_TO_SIZE(data) & ~(gsize)(MSG_OUTPUT_CHUNK_SIZE - 1));
+}
+
+/* it tells whether the data lies in a chunk of the handler, without locking */
+static int owns_data(MessageHandler* mh, const PackageData* data) {
+    outputChunks* chunks = g_atomic_pointer_get(&mh->chunks);
+    gpointer chunk = data_chunk(data);
+    gpointer slot = NULL;
+    guint i = chunk_hash(chunk) & chunks->mask;
+
+    while ((slot = g_atomic_pointer_get(&chunks->slots[i])) != NULL) {
+        if (slot == chunk)
+            return TRUE;
+
+        i = (i + 1) & chunks->mask;
+    }
+
+    return FALSE;
+}
+
+static outputChunks* new_chunks(unsigned int slots) {
+    outputChunks* chunks = NULL;
+
+    chunks = g_malloc0(sizeof(outputChunks) + slots * sizeof(gpointer));
+    chunks->mask = slots - 1;
+
+    return chunks;
+}
+
+static void insert_chunk(outputChunks* chunks, gpointer chunk) {
+    guint i = chunk_hash(chunk) & chunks->mask;
+
+    while (chunks->slots[i] != NULL) {
+        i = (i + 1) & chunks->mask;
+    }
+
+    g_atomic_pointer_set(&chunks->slots[i], chunk);
+}
+
+/* it adds a chunk to the handler, the output lock must be held */
+static void add_chunk(MessageHandler* mh) {
+    outputChunks* chunks = mh->chunks;
+    outputChunks* grown = NULL;
+    void* chunk = NULL;
+    unsigned int i = 0;
+
+    if (posix_memalign(&chunk, MSG_OUTPUT_CHUNK_SIZE, MSG_OUTPUT_CHUNK_SIZE) != 0)
+        g_error("%s: out of memory", G_STRFUNC);
+
+    /* the readers keep probing the old set until they see the new one */
+    if ((mh->numChunks + 1) * 2 > chunks->mask + 1) {
+        grown = new_chunks((chunks->mask + 1) * 2);
+
+        for (i = 0; i <= chunks->mask; i++) {
+            if (chunks->slots[i] != NULL)
+                insert_chunk(grown, chunks->slots[i]);
+        }
+
+        g_ptr_array_add(mh->retiredChunks, chunks);
+        g_atomic_pointer_set(&mh->chunks, grown);
+        chunks = grown;
+    }
+
+    insert_chunk(chunks, chunk);
+    mh->numChunks++;
+
+    mh->chunk = chunk;
+    mh->chunkUsed = 0;
+}
+
+/* it takes free blocks from the handler, or carves a new one */
+static void refill_cache(MessageHandler* mh, outputCache* cache, unsigned int sizeClass) {
+    GPtrArray* pool = mh->freeOutputs[sizeClass];
+    outputBlock* block = NULL;
+    unsigned int size = sizeof(outputBlock) + (1u << sizeClass) * sizeof(PackageData);
+
+    g_mutex_lock(&mh->outputLock);
+
+    while (pool->len > 0 && cache->blocks[sizeClass]->len < MSG_OUTPUT_CACHE_SIZE / 2) {
+        g_ptr_array_add(cache->blocks[sizeClass], g_ptr_array_remove_index_fast(pool, pool->len - 1));
+    }
+
+    if (cache->blocks[sizeClass]->len == 0) {
+        if (mh->chunk == NULL || mh->chunkUsed + size > MSG_OUTPUT_CHUNK_SIZE)
+            add_chunk(mh);
+
+        block = (outputBlock*)(mh->chunk + mh->chunkUsed);
+        block->sizeClass = sizeClass;
+        mh->chunkUsed += size;
+
+        g_ptr_array_add(cache->blocks[sizeClass], block);
+    }
+
+    g_mutex_unlock(&mh->outputLock);
+}
+
+static void release_block(MessageHandler* mh, outputBlock* block) {
+    outputCache* cache = get_cache(mh);
+    GPtrArray* blocks = cache->blocks[block->sizeClass];
+
+    /* half of a full cache goes back to the handler, for the other threads */
+    if (G_UNLIKELY(blocks->len >= MSG_OUTPUT_CACHE_SIZE)) {
+        g_mutex_lock(&mh->outputLock);
+
+        while (blocks->len > MSG_OUTPUT_CACHE_SIZE / 2) {
+            g_ptr_array_add(mh->freeOutputs[block->sizeClass], g_ptr_array_remove_index_fast(blocks, blocks->len - 1));
+        }
+
+        g_mutex_unlock(&mh->outputLock);
+    }
+
+    g_ptr_array_add(blocks, block);
+}
+
+static outputBlock* alloc_block(MessageHandler* mh, unsigned int count) {
+    outputCache* cache = NULL;
+    outputBlock* block = NULL;
+    unsigned int sizeClass = 0;
+
+    while (sizeClass < MSG_OUTPUT_CLASSES && (1u << sizeClass) < count)
+        sizeClass++;
+
+    if (G_UNLIKELY(sizeClass == MSG_OUTPUT_CLASSES)) {
+        block = g_malloc(sizeof(outputBlock) + count * sizeof(PackageData));
+        block->sizeClass = MSG_OUTPUT_UNPOOLED;
+
+        g_mutex_lock(&mh->outputLock);
+        g_hash_table_insert(mh->bigOutputs, block->data, block);
+        g_mutex_unlock(&mh->outputLock);
+
+        return block;
+    }
+
+    cache = get_cache(mh);
+
+    if (cache->blocks[sizeClass]->len == 0)
+        refill_cache(mh, cache, sizeClass);
+
+    return g_ptr_array_remove_index_fast(cache->blocks[sizeClass], cache->blocks[sizeClass]->len - 1);
+}
+
+/* it releases the data, if it has been allocated by mh_alloc_output() */
+static void release_data(MessageHandler* mh, PackageData* data) {
+    if (data == NULL)
+        return;
+
+    if (owns_data(mh, data)) {
+        release_block(mh, (outputBlock*)((char*)data - offsetof(outputBlock, data)));
+        return;
+    }
+
+    /* big blocks, or data the handler didn't allocate */
+    g_mutex_lock(&mh->outputLock);
+    g_hash_table_remove(mh->bigOutputs, data);
+    g_mutex_unlock(&mh->outputLock);
+}
+
+static dispatchContext* begin_dispatch(MessageHandler* mh, MessageHandler** previous, unsigned int* mark) {
+    dispatchContext* ctx = get_dispatch_context();
+
+    /* callbacks can send messages too */
+    *previous = ctx->mh;
+    *mark = ctx->blocks->len;
+
+    ctx->mh = mh;
+
+    return ctx;
+}
+
+/* it frees the blocks allocated by the callback, which are not used by the outputs */
+static void end_dispatch(dispatchContext* ctx, MessageHandler* previous, unsigned int mark, Package* outputs, unsigned int count) {
+    outputBlock* block = NULL;
+    int used = FALSE;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    for (i = mark; i < ctx->blocks->len; i++) {
+        block = g_ptr_array_index(ctx->blocks, i);
+        used = FALSE;
+
+        for (j = 0; j < count && !used; j++) {
+            used = outputs[j].data == block->data;
+        }
+
+        if (!used)
+            release_data(ctx->mh, block->data);
+    }
+
+    g_ptr_array_set_size(ctx->blocks, mark);
+
+    ctx->mh = previous;
+}
+
+/* it runs a word callback, with the output arena of the handler */
+static gint64 stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* it returns the start time of a call, or 0 if statistics are disabled */
+static gint64 stats_begin(MessageHandler* mh) {
+    if (G_LIKELY(!g_atomic_int_get(&mh->statsEnabled)))
+        return 0;
+
+    return stats_now();
+}
+
+static void stats_end(callbackContainer* cont, gint64 start, unsigned int calls) {
+    wordStats* stats = &cont->stats;
+    guint64 elapsed = 0;
+    guint64 max = 0;
+    unsigned int bucket = 0;
+
+    if (G_LIKELY(start == 0))
+        return;
+
+    elapsed = stats_now() - start;
+
+    /* bucket i counts the calls lasting [2^i, 2^(i+1)) ns */
+    if (elapsed > 0)
+        bucket = MIN(g_bit_storage(elapsed) - 1, MSG_STATS_BUCKETS - 1);
+
+    STATS_ADD(stats->calls, calls);
+    STATS_ADD(stats->histogram[bucket], 1);
+    STATS_ADD(stats->totalTime, elapsed);
+
+    max = STATS_GET(stats->maxTime);
+
+    while (elapsed > max && !__atomic_compare_exchange_n(&stats->maxTime, &max, elapsed, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void dispatch(MessageHandler* mh, callbackContainer* cont, const PackageData* data, Package* output, unsigned int* sizeOutput) {
+    dispatchContext* ctx = NULL;
+    MessageHandler* previous = NULL;
+    unsigned int mark = 0;
+    gint64 start = 0;
+
+    output->data = NULL;
+
+    ctx = begin_dispatch(mh, &previous, &mark);
+
+    if (G_UNLIKELY(mh->trace != NULL))
+        mh->trace(cont->word, data, mh->traceData);
+
+    start = stats_begin(mh);
+
+    if (cont->callbackFull != NULL)
+        cont->callbackFull(data, output, sizeOutput, cont->userData);
+    else
+        cont->callback(data, output, sizeOutput);
+
+    stats_end(cont, start, 1);
+
+    end_dispatch(ctx, previous, mark, output, 1);
+}
+
+static messageJob* new_job(MessageHandler* mh, callbackContainer* cont, const Package* pkg, msgDoneFunc done, void* userData, gint refCount) {
+    messageJob* job = NULL;
+
+    job = g_new0(messageJob, 1);
+    job->mh = mh;
+    job->cont = cont;
+    job->pkg = *pkg;
+    job->done = done;
+    job->userData = userData;
+    job->priority = MSG_PRIORITY_NORMAL;
+    job->deadline = 0;
+    job->expiry = 0;
+    job->dropExpired = FALSE;
+    job->sequence = 0;
+    job->refCount = refCount;
+
+    g_mutex_init(&job->lock);
+    g_cond_init(&job->cond);
+
+    return job;
+}
+
+static void unref_job(messageJob* job) {
+    if (!g_atomic_int_dec_and_test(&job->refCount))
+        return;
+
+    if (job->subscriber != NULL)
+        unref_subscriber(job->subscriber);
+
+    release_data(job->mh, job->output.data);
+
+    g_mutex_clear(&job->lock);
+    g_cond_clear(&job->cond);
+    g_free(job);
+}
+
+static void complete_job(MessageHandler* mh, messageJob* job, int processed) {
+    if (job->done != NULL)
+        job->done(processed ? &job->output : NULL, job->sizeOutput, job->userData);
+
+    g_mutex_lock(&job->lock);
+    job->completed = TRUE;
+    job->processed = processed;
+    g_cond_broadcast(&job->cond);
+    g_mutex_unlock(&job->lock);
+
+    unref_job(job);
+
+    if (g_atomic_int_dec_and_test(&mh->pending)) {
+        g_mutex_lock(&mh->lock);
+        g_cond_broadcast(&mh->idle);
+        g_mutex_unlock(&mh->lock);
+    }
+}
+
+static void miss_deadline(MessageHandler* mh, messageJob* job) {
+    g_atomic_int_inc(&mh->missedDeadlines);
+    STATS_ADD(job->cont->stats.missedDeadlines, 1);
+}
+
+/* It takes the pending message of a coalescing word. The word stays scheduled
+ * while the message runs, so its callback never runs twice at the same time */
+static messageJob* take_latest(MessageHandler* mh, callbackContainer* cont) {
+    messageJob* job = NULL;
+
+    g_mutex_lock(&mh->lock);
+
+    job = cont->latest;
+    cont->latest = NULL;
+
+    if (job != NULL)
+        job->latest = TRUE;
+    else
+        cont->scheduled = FALSE;
+
+    if (cont->interval > 0)
+        cont->nextRun = g_get_monotonic_time() + cont->interval;
+
+    g_mutex_unlock(&mh->lock);
+
+    return job;
+}
+
+/* The message taken by the trigger has run. The one posted meanwhile runs next on the same thread,
+ * or it waits for the timer if the word interval hasn't elapsed. Returns the message to run */
+static messageJob* release_trigger(MessageHandler* mh, callbackContainer* cont) {
+    messageJob* job = NULL;
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&mh->lock);
+
+    if (cont->latest == NULL) {
+        cont->scheduled = FALSE;
+    } else if (cont->nextRun > now) {
+        g_ptr_array_add(mh->timers, cont);
+        g_cond_signal(&mh->timerCond);
+    } else {
+        job = cont->latest;
+        cont->latest = NULL;
+        job->latest = TRUE;
+
+        if (cont->interval > 0)
+            cont->nextRun = now + cont->interval;
+    }
+
+    g_mutex_unlock(&mh->lock);
+
+    return job;
+}
+
+/* the trigger of a coalescing word won't run, so the pending message is dropped */
+static void drop_trigger(MessageHandler* mh, callbackContainer* cont) {
+    messageJob* job = NULL;
+
+    g_mutex_lock(&mh->lock);
+
+    job = cont->latest;
+    cont->latest = NULL;
+    cont->scheduled = FALSE;
+
+    g_mutex_unlock(&mh->lock);
+
+    if (job != NULL)
+        complete_job(mh, job, FALSE);
+}
+
+/* It runs the message. Returns the newer message of a coalescing word, which has to run next */
+static messageJob* run_job(MessageHandler* mh, messageJob* job) {
+    messageJob* next = NULL;
+    int processed = FALSE;
+    int late = FALSE;
+    int run = TRUE;
+
+    /* a message expired in the queue runs late, unless its word drops it. A message nobody
+     * waits for anymore is dropped, without missing a deadline */
+    if (job->deadline != 0 && g_get_monotonic_time() > job->deadline) {
+        miss_deadline(mh, job);
+        late = TRUE;
+        run = !job->dropExpired;
+    } else if (job->expiry != 0 && g_get_monotonic_time() > job->expiry) {
+        run = FALSE;
+    }
+
+    if (run) {
+        if (job->subscriber != NULL)
+            job->subscriber->func(job->pkg.name, job->pkg.data, job->subscriber->userData);
+        else
+            dispatch(mh, job->cont, job->pkg.data, &job->output, &job->sizeOutput);
+
+        if (!late && job->deadline != 0 && g_get_monotonic_time() > job->deadline)
+            miss_deadline(mh, job);
+
+        processed = TRUE;
+    }
+
+    /* the trigger is released before the message is completed, so a flush waits for the next one */
+    if (job->latest)
+        next = release_trigger(mh, job->cont);
+
+    complete_job(mh, job, processed);
+
+    return next;
+}
+
+/* Producers and workers only take queueLock to sleep, after the lock-free
+ * queue has been found full or empty. The sleeping counters are updated
+ * before checking the queue again, so a wakeup can't be lost */
+static void wake_sleepers(MessageHandler* mh, gint* sleepers, GCond* cond, int all) {
+    if (g_atomic_int_get(sleepers) == 0)
+        return;
+
+    g_mutex_lock(&mh->queueLock);
+
+    if (all)
+        g_cond_broadcast(cond);
+    else
+        g_cond_signal(cond);
+
+    g_mutex_unlock(&mh->queueLock);
+}
+
+/* It tells whether the first job must run before the second one: the earliest deadline,
+ * then the first posted */
+static int deadline_before(messageJob* first, messageJob* second) {
+    if (first->deadline != second->deadline)
+        return first->deadline < second->deadline;
+
+    return first->sequence < second->sequence;
+}
+
+static void heap_swap(GPtrArray* heap, unsigned int i, unsigned int j) {
+    void* item = heap->pdata[i];
+
+    heap->pdata[i] = heap->pdata[j];
+    heap->pdata[j] = item;
+}
+
+static void heap_sift_up(GPtrArray* heap, unsigned int i) {
+    while (i > 0 && deadline_before(heap->pdata[i], heap->pdata[(i - 1) / 2])) {
+        heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_sift_down(GPtrArray* heap, unsigned int i) {
+    unsigned int child = 0;
+
+    while ((child = 2 * i + 1) < heap->len) {
+        if (child + 1 < heap->len && deadline_before(heap->pdata[child + 1], heap->pdata[child]))
+            child++;
+
+        if (!deadline_before(heap->pdata[child], heap->pdata[i]))
+            break;
+
+        heap_swap(heap, i, child);
+        i = child;
+    }
+}
+
+/* it removes the job at the index of the heap */
+static messageJob* heap_remove(GPtrArray* heap, unsigned int i) {
+    messageJob* job = heap->pdata[i];
+
+    heap->pdata[i] = heap->pdata[heap->len - 1];
+    g_ptr_array_set_size(heap, heap->len - 1);
+
+    if (i < heap->len) {
+        heap_sift_down(heap, i);
+        heap_sift_up(heap, i);
+    }
+
+    return job;
+}
+
+/* It queues a job with a deadline. Returns FALSE if its deadline queue is full */
+static int deadline_try_push(MessageHandler* mh, messageJob* job) {
+    GPtrArray* heap = mh->deadlines[job->priority];
+    int pushed = FALSE;
+
+    g_mutex_lock(&mh->deadlineLock);
+
+    if (heap->len < rb_get_capacity(mh->queues[job->priority])) {
+        job->sequence = ++mh->lastSequence;
+        g_ptr_array_add(heap, job);
+        heap_sift_up(heap, heap->len - 1);
+
+        g_atomic_int_inc(&mh->numDeadlines);
+        pushed = TRUE;
+    }
+
+    g_mutex_unlock(&mh->deadlineLock);
+
+    return pushed;
+}
+
+/* It takes the job with the earliest deadline of the level. Returns FALSE if there's none */
+static int deadline_try_pop(MessageHandler* mh, int level, void** job) {
+    GPtrArray* heap = mh->deadlines[level];
+
+    if (G_LIKELY(g_atomic_int_get(&mh->numDeadlines) == 0))
+        return FALSE;
+
+    g_mutex_lock(&mh->deadlineLock);
+
+    *job = heap->len > 0 ? heap_remove(heap, 0) : NULL;
+
+    g_mutex_unlock(&mh->deadlineLock);
+
+    if (*job == NULL)
+        return FALSE;
+
+    g_atomic_int_add(&mh->numDeadlines, -1);
+
+    return TRUE;
+}
+
+/* It takes the job with the latest deadline of the level, to make room for a new one.
+ * Returns FALSE if there's none */
+static int deadline_try_pop_latest(MessageHandler* mh, int level, void** job) {
+    GPtrArray* heap = mh->deadlines[level];
+    unsigned int latest = 0;
+    unsigned int i = 0;
+
+    g_mutex_lock(&mh->deadlineLock);
+
+    /* the latest deadline is a leaf */
+    for (i = heap->len / 2; i < heap->len; i++) {
+        if (deadline_before(heap->pdata[latest], heap->pdata[i]))
+            latest = i;
+    }
+
+    *job = heap->len > 0 ? heap_remove(heap, latest) : NULL;
+
+    g_mutex_unlock(&mh->deadlineLock);
+
+    if (*job == NULL)
+        return FALSE;
+
+    g_atomic_int_add(&mh->numDeadlines, -1);
+
+    return TRUE;
+}
+
+/* It takes the message of highest priority. Every MSG_PRIORITY_FAIR_SHARE pops, the
+ * lower priorities take turns to be served first. Returns FALSE if the queues are empty */
+static int queue_try_pop(MessageHandler* mh, void** job) {
+    guint pops = (guint)g_atomic_int_get(&mh->pops);
+    int first = MSG_PRIORITY_LEVELS - 1;
+    int level = 0;
+    int i = 0;
+
+    if (pops % MSG_PRIORITY_FAIR_SHARE == MSG_PRIORITY_FAIR_SHARE - 1)
+        first = (pops / MSG_PRIORITY_FAIR_SHARE) % (MSG_PRIORITY_LEVELS - 1);
+
+    /* from the first level down, then from the highest one */
+    for (i = 0; i < MSG_PRIORITY_LEVELS; i++) {
+        level = (first - i + MSG_PRIORITY_LEVELS) % MSG_PRIORITY_LEVELS;
+
+        if (deadline_try_pop(mh, level, job) || rb_try_pop(mh->queues[level], job)) {
+            g_atomic_int_inc(&mh->pops);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static messageJob* queue_pop(MessageHandler* mh) {
+    void* job = NULL;
+    unsigned int spins = 0;
+
+    while (!queue_try_pop(mh, &job)) {
+        if (spins++ < MSG_QUEUE_SPINS) {
+            g_thread_yield();
+            continue;
+        }
+
+        g_mutex_lock(&mh->queueLock);
+        g_atomic_int_inc(&mh->sleepingWorkers);
+
+        while (!queue_try_pop(mh, &job)) {
+            g_cond_wait(&mh->notEmpty, &mh->queueLock);
+        }
+
+        g_atomic_int_add(&mh->sleepingWorkers, -1);
+        g_mutex_unlock(&mh->queueLock);
+        break;
+    }
+
+    /* producers can wait on different queues */
+    wake_sleepers(mh, &mh->sleepingProducers, &mh->notFull, TRUE);
+
+    return job;
+}
+
+/* it completes a message dropped from the queue */
+static void drop_message(MessageHandler* mh, messageJob* job) {
+    g_atomic_int_inc(&mh->dropped);
+
+    /* the message of a trigger is dropped with the pending one */
+    if (job->trigger || job->latest)
+        drop_trigger(mh, job->cont);
+
+    if (!job->trigger)
+        complete_job(mh, job, FALSE);
+}
+
+/* The token of a mailbox has been dropped from the queue, so its oldest message is dropped. The token
+ * is queued again for the other ones, otherwise they are dropped too */
+static void drop_mailbox_job(MessageHandler* mh, MessageMailbox* mailbox) {
+    GQueue dropped = G_QUEUE_INIT;
+    messageJob* job = NULL;
+
+    g_mutex_lock(&mailbox->lock);
+
+    job = g_queue_pop_head(&mailbox->queue);
+
+    if (g_queue_is_empty(&mailbox->queue)) {
+        mailbox->scheduled = FALSE;
+    } else if (!rb_try_push(mh->queues[mailbox->token->priority], mailbox->token)) {
+        dropped = mailbox->queue;
+        g_queue_init(&mailbox->queue);
+        mailbox->scheduled = FALSE;
+    }
+
+    if (mailbox->blocked > 0)
+        g_cond_broadcast(&mailbox->notFull);
+
+    g_mutex_unlock(&mailbox->lock);
+
+    g_queue_push_head(&dropped, job);
+
+    while (!g_queue_is_empty(&dropped)) {
+        job = g_queue_pop_head(&dropped);
+
+        if (job != NULL)
+            drop_message(mh, job);
+    }
+}
+
+/* it completes a job dropped from the queue */
+static void drop_job(MessageHandler* mh, messageJob* job) {
+    if (job->mailbox != NULL)
+        drop_mailbox_job(mh, job->mailbox);
+    else
+        drop_message(mh, job);
+}
+
+/* it queues the job on the main loop of the source */
+static void source_push(MessageHandler* mh, messageSource* msrc, messageJob* job) {
+    int wakeup = FALSE;
+
+    g_mutex_lock(&msrc->lock);
+
+    if (msrc->closed) {
+        g_mutex_unlock(&msrc->lock);
+        drop_job(mh, job);
+        return;
+    }
+
+    g_queue_push_tail(&msrc->queue, job);
+
+    if (!msrc->scheduled) {
+        msrc->scheduled = TRUE;
+        wakeup = TRUE;
+    }
+
+    g_mutex_unlock(&msrc->lock);
+
+    /* it wakes the main context up, from any thread */
+    if (wakeup)
+        g_source_set_ready_time(&msrc->source, 0);
+}
+
+/* It queues the job without blocking. Returns FALSE if its queue is full */
+static int queue_try_push(MessageHandler* mh, messageJob* job) {
+    if (job->deadline != 0)
+        return deadline_try_push(mh, job);
+
+    return rb_try_push(mh->queues[job->priority], job);
+}
+
+/* it queues the job according with the policy. Returns FALSE if it has been rejected */
+static int queue_push(MessageHandler* mh, messageJob* job, msgQueuePolicy policy) {
+    void* oldest = NULL;
+    int taken = FALSE;
+
+    while (!queue_try_push(mh, job)) {
+        if (policy == MSG_QUEUE_REJECT)
+            return FALSE;
+
+        /* among the messages with a deadline, the least urgent one is dropped */
+        if (policy == MSG_QUEUE_DROP_OLDEST) {
+            if (job->deadline != 0)
+                taken = deadline_try_pop_latest(mh, job->priority, &oldest);
+            else
+                taken = rb_try_pop(mh->queues[job->priority], &oldest);
+
+            if (taken)
+                drop_job(mh, oldest);
+            continue;
+        }
+
+        g_mutex_lock(&mh->queueLock);
+        g_atomic_int_inc(&mh->sleepingProducers);
+
+        while (!queue_try_push(mh, job)) {
+            g_cond_wait(&mh->notFull, &mh->queueLock);
+        }
+
+        g_atomic_int_add(&mh->sleepingProducers, -1);
+        g_mutex_unlock(&mh->queueLock);
+        break;
+    }
+
+    wake_sleepers(mh, &mh->sleepingWorkers, &mh->notEmpty, FALSE);
+
+    return TRUE;
+}
+
+/* it queues the message to the mailbox. Returns TRUE if the mailbox was idle, so it has to be run */
+static int mailbox_push(MessageMailbox* mailbox, messageJob* job) {
+    int idle = FALSE;
+
+    g_mutex_lock(&mailbox->lock);
+
+    g_queue_push_tail(&mailbox->queue, job);
+
+    idle = !mailbox->scheduled;
+    mailbox->scheduled = TRUE;
+
+    g_mutex_unlock(&mailbox->lock);
+
+    return idle;
+}
+
+/* it runs the messages of the mailbox in post order, until it's empty */
+static void run_mailbox(MessageHandler* mh, MessageMailbox* mailbox) {
+    messageJob* job = NULL;
+
+    for (;;) {
+        g_mutex_lock(&mailbox->lock);
+
+        job = g_queue_pop_head(&mailbox->queue);
+        if (job == NULL)
+            mailbox->scheduled = FALSE;
+        else if (mailbox->blocked > 0)
+            g_cond_signal(&mailbox->notFull);
+
+        g_mutex_unlock(&mailbox->lock);
+
+        if (job == NULL)
+            break;
+
+        /* a newer message of a coalescing word waits for the queued ones */
+        job = run_job(mh, job);
+        if (job != NULL)
+            mailbox_push(mailbox, job);
+    }
+}
+
+static void process_job(MessageHandler* mh, messageJob* job) {
+    MessageMailbox* mailbox = NULL;
+
+    if (job->mailbox != NULL) {
+        run_mailbox(mh, job->mailbox);
+        return;
+    }
+
+    /* the newest message of a coalescing word runs */
+    if (job->trigger) {
+        job = take_latest(mh, job->cont);
+
+        if (job == NULL)
+            return;
+    }
+
+    /* the messages of the main loop and of the coalescing words join their mailbox when they run */
+    mailbox = job->cont != NULL ? job->cont->mailbox : NULL;
+
+    if (mailbox != NULL) {
+        if (mailbox_push(mailbox, job))
+            run_mailbox(mh, mailbox);
+        return;
+    }
+
+    while (job != NULL) {
+        job = run_job(mh, job);
+    }
+}
+
+static void* worker_thread(void* data) {
+    MessageHandler* mh = (MessageHandler*)data;
+    messageJob* job = NULL;
+
+    while ((job = queue_pop(mh)) != &_quitJob) {
+        process_job(mh, job);
+    }
+
+    return NULL;
+}
+
+static void start_workers(MessageHandler* mh) {
+    char* name = NULL;
+    unsigned int i = 0;
+
+    g_mutex_lock(&mh->lock);
+
+    for (i = mh->workers->len; i < mh->numWorkers; i++) {
+        name = g_strdup_printf("mh-worker-%u", i);
+        g_ptr_array_add(mh->workers, g_thread_new(name, worker_thread, mh));
+        g_free(name);
+    }
+
+    g_mutex_unlock(&mh->lock);
+}
+
+static void stop_workers(MessageHandler* mh) {
+    unsigned int i = 0;
+
+    mh_flush(mh);
+
+    for (i = 0; i < mh->workers->len; i++) {
+        queue_push(mh, &_quitJob, MSG_QUEUE_BLOCK);
+    }
+
+    for (i = 0; i < mh->workers->len; i++) {
+        g_thread_join(g_ptr_array_index(mh->workers, i));
+    }
+
+    g_ptr_array_set_size(mh->workers, 0);
+}
+
+/* it takes the oldest queued message, or it marks the source idle if there's none */
+static messageJob* source_pop(messageSource* msrc) {
+    messageJob* job = NULL;
+
+    g_mutex_lock(&msrc->lock);
+
+    job = g_queue_pop_head(&msrc->queue);
+    if (job == NULL)
+        msrc->scheduled = FALSE;
+
+    g_mutex_unlock(&msrc->lock);
+
+    return job;
+}
+
+/* It runs the queued messages until the budget of the main loop iteration is spent.
+ * The remaining ones keep the source ready for the next iteration */
+static gboolean source_dispatch(GSource* source, GSourceFunc callback, gpointer userData) {
+    messageSource* msrc = (messageSource*)source;
+    messageJob* job = NULL;
+    gint64 budget = g_atomic_int_get(&msrc->budget);
+    gint64 end = 0;
+
+    g_source_set_ready_time(source, -1);
+
+    if (budget > 0)
+        end = g_get_monotonic_time() + budget;
+
+    while ((job = source_pop(msrc)) != NULL) {
+        process_job(msrc->mh, job);
+
+        if (end != 0 && g_get_monotonic_time() >= end) {
+            g_source_set_ready_time(source, 0);
+            break;
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void source_finalize(GSource* source) {
+    messageSource* msrc = (messageSource*)source;
+
+    g_mutex_clear(&msrc->lock);
+}
+
+static GSourceFuncs _sourceFuncs = { NULL, NULL, source_dispatch, source_finalize, NULL, NULL };
+
+/* it drops the queued messages, and the ones posted later */
+static void close_source(MessageHandler* mh, messageSource* msrc) {
+    messageJob* job = NULL;
+
+    g_mutex_lock(&msrc->lock);
+    msrc->closed = TRUE;
+    g_mutex_unlock(&msrc->lock);
+
+    while (TRUE) {
+        g_mutex_lock(&msrc->lock);
+        job = g_queue_pop_head(&msrc->queue);
+        g_mutex_unlock(&msrc->lock);
+
+        if (job == NULL)
+            break;
+
+        drop_job(mh, job);
+    }
+
+    g_source_destroy(&msrc->source);
+}
+
+/* It runs the queued messages of the sources whose main context the calling thread owns, or can
+ * acquire, because nobody else would run them while it waits. Returns FALSE if there's none */
+static int run_own_sources(MessageHandler* mh) {
+    GPtrArray* own = NULL;
+    GMainContext* context = NULL;
+    messageSource* msrc = NULL;
+    messageJob* job = NULL;
+    unsigned int count = 0;
+    unsigned int i = 0;
+
+    own = g_ptr_array_new();
+
+    g_mutex_lock(&mh->lock);
+
+    for (i = 0; i < mh->sources->len; i++) {
+        msrc = g_ptr_array_index(mh->sources, i);
+
+        /* closed sources are destroyed */
+        if (g_atomic_int_get(&msrc->closed))
+            continue;
+
+        context = g_source_get_context(&msrc->source);
+
+        if (context != NULL && g_main_context_acquire(context))
+            g_ptr_array_add(own, g_source_ref(&msrc->source));
+    }
+
+    g_mutex_unlock(&mh->lock);
+
+    for (i = 0; i < own->len; i++) {
+        msrc = g_ptr_array_index(own, i);
+
+        while ((job = source_pop(msrc)) != NULL) {
+            process_job(mh, job);
+        }
+
+        g_main_context_release(g_source_get_context(&msrc->source));
+        g_source_unref(&msrc->source);
+    }
+
+    count = own->len;
+    g_ptr_array_free(own, TRUE);
+
+    return count > 0;
+}
+
+/* it queues the job for the workers. Returns FALSE if it has been rejected */
+static int queue_job(MessageHandler* mh, messageJob* job, msgQueuePolicy policy) {
+    if (G_UNLIKELY(mh->workers->len == 0))
+        start_workers(mh);
+
+    g_atomic_int_inc(&mh->pending);
+
+    if (!queue_push(mh, job, policy)) {
+        g_atomic_int_inc(&mh->dropped);
+        g_atomic_int_add(&mh->pending, -1);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* It queues the message to the mailbox of its word when it's posted, so the mailbox runs the messages
+ * in post order. A full mailbox follows the queue policy, and only the token of an idle mailbox is
+ * queued to the workers. Returns FALSE if the message has been rejected */
+static int post_mailbox_job(MessageHandler* mh, MessageMailbox* mailbox, messageJob* job, msgQueuePolicy policy) {
+    unsigned int capacity = rb_get_capacity(mh->queues[MSG_PRIORITY_NORMAL]);
+    messageJob* oldest = NULL;
+    int idle = FALSE;
+    int others = FALSE;
+
+    if (G_UNLIKELY(mh->workers->len == 0))
+        start_workers(mh);
+
+    g_atomic_int_inc(&mh->pending);
+
+    g_mutex_lock(&mailbox->lock);
+
+    if (policy == MSG_QUEUE_BLOCK) {
+        mailbox->blocked++;
+
+        while (g_queue_get_length(&mailbox->queue) >= capacity) {
+            g_cond_wait(&mailbox->notFull, &mailbox->lock);
+        }
+
+        mailbox->blocked--;
+    }
+
+    if (g_queue_get_length(&mailbox->queue) >= capacity) {
+        if (policy == MSG_QUEUE_REJECT) {
+            g_mutex_unlock(&mailbox->lock);
+
+            g_atomic_int_inc(&mh->dropped);
+            g_atomic_int_add(&mh->pending, -1);
+            return FALSE;
+        }
+
+        oldest = g_queue_pop_head(&mailbox->queue);
+    }
+
+    g_queue_push_tail(&mailbox->queue, job);
+
+    idle = !mailbox->scheduled;
+    mailbox->scheduled = TRUE;
+
+    g_mutex_unlock(&mailbox->lock);
+
+    if (oldest != NULL) {
+        g_atomic_int_inc(&mh->dropped);
+        complete_job(mh, oldest, FALSE);
+    }
+
+    if (!idle)
+        return TRUE;
+
+    mailbox->token->priority = job->priority;
+
+    if (queue_push(mh, mailbox->token, policy))
+        return TRUE;
+
+    /* the message is taken back, but the ones posted meanwhile have been accepted */
+    g_mutex_lock(&mailbox->lock);
+
+    g_queue_remove(&mailbox->queue, job);
+
+    others = !g_queue_is_empty(&mailbox->queue);
+    if (!others)
+        mailbox->scheduled = FALSE;
+    else if (mailbox->blocked > 0)
+        g_cond_signal(&mailbox->notFull);
+
+    g_mutex_unlock(&mailbox->lock);
+
+    if (others)
+        queue_push(mh, mailbox->token, MSG_QUEUE_BLOCK);
+
+    g_atomic_int_inc(&mh->dropped);
+    g_atomic_int_add(&mh->pending, -1);
+
+    return FALSE;
+}
+
+/* A package of a batch, sorted by word */
+typedef struct {
+    msgId id;
+    unsigned int index;         /* position in the batch */
+} batchEntry;
+
+static int compare_batch_entries(const void* a, const void* b) {
+    const batchEntry* first = (const batchEntry*)a;
+    const batchEntry* second = (const batchEntry*)b;
+
+    if (first->id != second->id)
+        return (first->id > second->id) - (first->id < second->id);
+
+    return (first->index > second->index) - (first->index < second->index);
+}
+
+/* it calls the batch callback once per word, with the packages of the word
+ * copied into a contiguous slice, then it copies the outputs back in place */
+static void send_batch_groups(MessageHandler* mh, const Package* pkgs, batchEntry* entries, unsigned int count,
+                              Package* outputs, unsigned int* sizeOutputs) {
+    callbackContainer* cont = NULL;
+    dispatchContext* ctx = NULL;
+    MessageHandler* previous = NULL;
+    Package* slice = NULL;
+    Package* sliceOutputs = NULL;
+    unsigned int* sliceSizes = NULL;
+    unsigned int mark = 0;
+    gint64 begin = 0;
+    unsigned int start = 0;
+    unsigned int end = 0;
+    unsigned int i = 0;
+
+    qsort(entries, count, sizeof(batchEntry), compare_batch_entries);
+
+    slice = g_new(Package, count * 2);
+    sliceOutputs = slice + count;
+    sliceSizes = g_new0(unsigned int, count);
+
+    for (i = 0; i < count; i++) {
+        slice[i] = pkgs[entries[i].index];
+        sliceOutputs[i] = outputs[entries[i].index];
+        sliceOutputs[i].data = NULL;
+    }
+
+    ctx = begin_dispatch(mh, &previous, &mark);
+
+    for (start = 0; start < count; start = end) {
+        for (end = start + 1; end < count && entries[end].id == entries[start].id; end++);
+
+        cont = g_ptr_array_index(mh->words, entries[start].id);
+
+        if (G_UNLIKELY(mh->trace != NULL)) {
+            for (i = start; i < end; i++) {
+                mh->trace(cont->word, slice[i].data, mh->traceData);
+            }
+        }
+
+        begin = stats_begin(mh);
+        cont->batchCallback(slice + start, end - start, sliceOutputs + start, sliceSizes + start);
+        stats_end(cont, begin, end - start);
+    }
+
+    end_dispatch(ctx, previous, mark, sliceOutputs, count);
+
+    for (i = 0; i < count; i++) {
+        outputs[entries[i].index] = sliceOutputs[i];
+        sizeOutputs[entries[i].index] = sliceSizes[i];
+    }
+
+    g_free(sliceSizes);
+    g_free(slice);
+}
+
+/* The subscribers of a parallel publish, still running on the workers. The publisher and every
+ * queued subscriber hold a reference, so the last one to let it go frees it */
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    unsigned int remaining;
+    unsigned int called;        /* subscribers that ran, the dropped ones don't count */
+    gint refs;
+} publishGroup;
+
+static void unref_publish_group(publishGroup* group) {
+    if (!g_atomic_int_dec_and_test(&group->refs))
+        return;
+
+    g_mutex_clear(&group->lock);
+    g_cond_clear(&group->cond);
+    g_free(group);
+}
+
+static void publish_done(const Package* output, unsigned int sizeOutput, void* userData) {
+    publishGroup* group = (publishGroup*)userData;
+
+    g_mutex_lock(&group->lock);
+
+    if (output != NULL)
+        group->called++;
+
+    if (--group->remaining == 0)
+        g_cond_signal(&group->cond);
+
+    g_mutex_unlock(&group->lock);
+
+    unref_publish_group(group);
+}
+
+/* it queues the trigger of a coalescing word, or it drops its pending message if it's rejected */
+static void queue_trigger(MessageHandler* mh, callbackContainer* cont, msgQueuePolicy policy) {
+    messageSource* msrc = g_atomic_pointer_get(&cont->source);
+
+    if (msrc != NULL) {
+        source_push(mh, msrc, cont->trigger);
+        return;
+    }
+
+    if (G_UNLIKELY(mh->workers->len == 0))
+        start_workers(mh);
+
+    if (queue_push(mh, cont->trigger, policy))
+        return;
+
+    g_atomic_int_inc(&mh->dropped);
+    drop_trigger(mh, cont);
+}
+
+static void* timer_thread(void* data) {
+    MessageHandler* mh = (MessageHandler*)data;
+    callbackContainer* cont = NULL;
+    GPtrArray* due = NULL;
+    gint64 now = 0;
+    gint64 next = 0;
+    unsigned int i = 0;
+
+    due = g_ptr_array_new();
+
+    g_mutex_lock(&mh->lock);
+
+    while (!mh->timerQuit) {
+        now = g_get_monotonic_time();
+        next = G_MAXINT64;
+
+        for (i = 0; i < mh->timers->len; i++) {
+            cont = g_ptr_array_index(mh->timers, i);
+
+            if (cont->nextRun > now) {
+                next = MIN(next, cont->nextRun);
+                continue;
+            }
+
+            g_ptr_array_add(due, cont);
+            g_ptr_array_remove_index_fast(mh->timers, i--);
+        }
+
+        /* the queue can be full, so the words are queued without the lock */
+        if (due->len > 0) {
+            g_mutex_unlock(&mh->lock);
+
+            for (i = 0; i < due->len; i++) {
+                queue_trigger(mh, g_ptr_array_index(due, i), mh->policy);
+            }
+
+            g_ptr_array_set_size(due, 0);
+            g_mutex_lock(&mh->lock);
+            continue;
+        }
+
+        if (next == G_MAXINT64)
+            g_cond_wait(&mh->timerCond, &mh->lock);
+        else
+            g_cond_wait_until(&mh->timerCond, &mh->lock, next);
+    }
+
+    g_mutex_unlock(&mh->lock);
+
+    g_ptr_array_free(due, TRUE);
+
+    return NULL;
+}
+
+/* While a message of a coalescing word is pending, a newer one takes its place. The word trigger
+ * is queued only if the word isn't scheduled yet, right away or when the word interval has elapsed.
+ * Otherwise the running message leaves the newer one to the trigger when it's done */
+static messageJob* post_coalescing_job(MessageHandler* mh, callbackContainer* cont, messageJob* job, msgQueuePolicy policy) {
+    messageJob* previous = NULL;
+    int queued = FALSE;
+
+    g_atomic_int_inc(&mh->pending);
+
+    g_mutex_lock(&mh->lock);
+
+    previous = cont->latest;
+    cont->latest = job;
+
+    if (!cont->scheduled) {
+        cont->scheduled = TRUE;
+        cont->trigger->priority = job->priority;
+
+        if (cont->nextRun > g_get_monotonic_time()) {
+            g_ptr_array_add(mh->timers, cont);
+            g_cond_signal(&mh->timerCond);
+        } else {
+            queued = TRUE;
+        }
+    }
+
+    g_mutex_unlock(&mh->lock);
+
+    if (previous != NULL) {
+        g_atomic_int_inc(&mh->coalesced);
+        complete_job(mh, previous, FALSE);
+    }
+
+    if (queued)
+        queue_trigger(mh, cont, policy);
+
+    return job;
+}
+
+/* it posts a message with the given priority and deadline, or with the word ones if the priority is
+ * MSG_PRIORITY_OF_WORD. Then, the given deadline is used if it's earlier than the word one.
+ * The message is dropped if it didn't start within expiry us, unless it's 0 */
+static messageJob* post_job(MessageHandler* mh, const Package* pkg, msgDoneFunc done, void* userData, gint refCount,
+                            msgQueuePolicy policy, int priority, unsigned int deadline, unsigned int expiry) {
+    callbackContainer* cont = NULL;
+    messageSource* msrc = NULL;
+    messageJob* job = NULL;
+    msgId id = MSG_ID_INVALID;
+    int posted = FALSE;
+
+    id = mh_resolve_word(mh, pkg->name);
+    if (id == MSG_ID_INVALID)
+        return NULL;
+
+    cont = g_ptr_array_index(mh->words, id);
+    job = new_job(mh, cont, pkg, done, userData, refCount);
+
+    if (priority == MSG_PRIORITY_OF_WORD) {
+        priority = cont->priority;
+
+        if (deadline == 0 || (cont->deadline > 0 && cont->deadline < deadline))
+            deadline = cont->deadline;
+    }
+
+    job->priority = priority;
+    job->dropExpired = cont->deadlinePolicy == MSG_DEADLINE_DROP;
+
+    if (deadline > 0)
+        job->deadline = g_get_monotonic_time() + deadline;
+
+    if (expiry > 0)
+        job->expiry = g_get_monotonic_time() + expiry;
+
+    if (cont->trigger != NULL)
+        return post_coalescing_job(mh, cont, job, policy);
+
+    msrc = g_atomic_pointer_get(&cont->source);
+    if (msrc != NULL) {
+        g_atomic_int_inc(&mh->pending);
+        source_push(mh, msrc, job);
+
+        return job;
+    }
+
+    if (cont->mailbox != NULL)
+        posted = post_mailbox_job(mh, cont->mailbox, job, policy);
+    else
+        posted = queue_job(mh, job, policy);
+
+    if (!posted) {
+        /* the caller doesn't get the future */
+        job->refCount = 1;
+        unref_job(job);
+
+        return NULL;
+    }
+
+    return job;
+}
+
+/* Implementations */
+MessageHandler* mh_new(void) {
+    MessageHandler* mh = NULL;
+    unsigned int i = 0;
+
+    mh = g_new(MessageHandler, 1);
+    mh->dictionary = g_hash_table_new(g_str_hash, g_str_equal);
+    mh->words = g_ptr_array_new_with_free_func(free_callbackContainer);
+    mh->frozen = NULL;
+
+    g_mutex_init(&mh->lock);
+    g_cond_init(&mh->idle);
+    mh->pending = 0;
+    mh->numWorkers = g_get_num_processors();
+    mh->workers = g_ptr_array_new();
+
+    for (i = 0; i < MSG_PRIORITY_LEVELS; i++) {
+        mh->queues[i] = rb_new(MSG_QUEUE_DEFAULT_SIZE);
+        mh->deadlines[i] = g_ptr_array_new();
+    }
+
+    g_mutex_init(&mh->deadlineLock);
+    mh->numDeadlines = 0;
+    mh->lastSequence = 0;
+
+    mh->policy = MSG_QUEUE_BLOCK;
+    mh->dropped = 0;
+    mh->pops = 0;
+    mh->missedDeadlines = 0;
+    mh->coalesced = 0;
+
+    mh->timer = NULL;
+    g_cond_init(&mh->timerCond);
+    mh->timers = g_ptr_array_new();
+    mh->timerQuit = FALSE;
+    g_mutex_init(&mh->queueLock);
+    g_cond_init(&mh->notEmpty);
+    g_cond_init(&mh->notFull);
+    mh->sleepingWorkers = 0;
+    mh->sleepingProducers = 0;
+
+    g_mutex_init(&mh->topicsLock);
+    mh->topics = tt_new();
+    mh->subscribers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, unref_subscriber);
+    mh->topicsCache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+    mh->lastSubscription = 0;
+
+    mh->statsEnabled = FALSE;
+
+    g_mutex_init(&mh->outputLock);
+    mh->chunks = new_chunks(MSG_OUTPUT_CHUNK_SLOTS);
+    mh->retiredChunks = g_ptr_array_new_with_free_func(g_free);
+    mh->numChunks = 0;
+    mh->chunk = NULL;
+    mh->chunkUsed = 0;
+    mh->bigOutputs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+        mh->freeOutputs[i] = g_ptr_array_new();
+    }
+
+    g_mutex_lock(&_handlersLock);
+
+    if (_handlers == NULL)
+        _handlers = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    mh->id = ++_lastHandlerId;
+    g_hash_table_insert(_handlers, GUINT_TO_POINTER(mh->id), mh);
+
+    g_mutex_unlock(&_handlersLock);
+
+    mh->mailboxes = g_ptr_array_new_with_free_func(free_mailbox);
+    mh->sources = g_ptr_array_new_with_free_func((GDestroyNotify)g_source_unref);
+
+    mh->trace = NULL;
+    mh->traceData = NULL;
+
+    return mh;
+}
+
+void mh_free(MessageHandler* mh) {
+    unsigned int i = 0;
+
+    g_assert(mh != NULL);
+
+    /* the main loops can't run the posted messages anymore */
+    for (i = 0; i < mh->sources->len; i++) {
+        close_source(mh, g_ptr_array_index(mh->sources, i));
+    }
+
+    /* complete the posted messages */
+    stop_workers(mh);
+
+    if (mh->timer != NULL) {
+        g_mutex_lock(&mh->lock);
+        mh->timerQuit = TRUE;
+        g_cond_signal(&mh->timerCond);
+        g_mutex_unlock(&mh->lock);
+
+        g_thread_join(mh->timer);
+    }
+
+    g_ptr_array_free(mh->timers, TRUE);
+    g_cond_clear(&mh->timerCond);
+
+    g_ptr_array_free(mh->mailboxes, TRUE);
+    g_ptr_array_free(mh->sources, TRUE);
+
+    g_ptr_array_free(mh->workers, TRUE);
+
+    for (i = 0; i < MSG_PRIORITY_LEVELS; i++) {
+        rb_free(mh->queues[i]);
+        g_ptr_array_free(mh->deadlines[i], TRUE);
+    }
+
+    g_mutex_clear(&mh->deadlineLock);
+    g_mutex_clear(&mh->queueLock);
+    g_cond_clear(&mh->notEmpty);
+    g_cond_clear(&mh->notFull);
+
+    g_hash_table_destroy(mh->topicsCache);
+    g_hash_table_destroy(mh->subscribers);
+    tt_free(mh->topics);
+    g_mutex_clear(&mh->topicsLock);
+
+    /* the threads don't give their blocks back anymore */
+    g_mutex_lock(&_handlersLock);
+    g_hash_table_remove(_handlers, GUINT_TO_POINTER(mh->id));
+    g_mutex_unlock(&_handlersLock);
+
+    /* the outputs not released yet are freed too */
+    for (i = 0; i <= mh->chunks->mask; i++) {
+        free(mh->chunks->slots[i]);
+    }
+
+    g_free(mh->chunks);
+    g_ptr_array_free(mh->retiredChunks, TRUE);
+    g_hash_table_destroy(mh->bigOutputs);
+    g_mutex_clear(&mh->outputLock);
+
+    for (i = 0; i < MSG_OUTPUT_CLASSES; i++) {
+        g_ptr_array_free(mh->freeOutputs[i], TRUE);
+    }
+    g_mutex_clear(&mh->lock);
+    g_cond_clear(&mh->idle);
+
+    /* remove dictionary */
+    if (mh->frozen != NULL)
+        ph_free(mh->frozen);
+
+    g_hash_table_destroy(mh->dictionary);
+    g_ptr_array_free(mh->words, TRUE);
+
+    mh->dictionary = NULL;
+    mh->words = NULL;
+    g_free(mh);
+    
+    mh = NULL;
+}
+
+const char* const* mh_get_dictionary(MessageHandler* mh, unsigned int* size) {
+    const char** words = NULL;
+    callbackContainer* cont = NULL;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, NULL);
+    g_return_val_if_fail(size != NULL, NULL);
+
+    /* words are returned in identifier order */
+    words = g_malloc(mh->words->len * sizeof(char*));
+
+    for (i = 0; i < mh->words->len; i++) {
+        cont = g_ptr_array_index(mh->words, i);
+        words[i] = g_strdup(cont->word);
+    }
+
+    *size = mh->words->len;
+
+    return words;
+}
+
+int mh_freeze(MessageHandler* mh) {
+    const char** words = NULL;
+    PerfectHash* frozen = NULL;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    /* the identifiers are the positions of the words */
+    words = g_new(const char*, mh->words->len);
+
+    for (i = 0; i < mh->words->len; i++) {
+        words[i] = ((callbackContainer*)g_ptr_array_index(mh->words, i))->word;
+    }
+
+    frozen = ph_new(words, mh->words->len);
+    g_free(words);
+
+    if (frozen == NULL)
+        return FALSE;
+
+    if (mh->frozen != NULL)
+        ph_free(mh->frozen);
+
+    mh->frozen = frozen;
+
+    return TRUE;
+}
+
+int mh_is_frozen(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    return mh->frozen != NULL;
+}
+
+void mh_add_word(MessageHandler* mh, const char* word, msgCallback callback) {
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(callback != NULL);
+
+	add_item_to_dictionary(mh, word, callback, NULL, NULL);
+}
+
+void mh_add_word_full(MessageHandler* mh, const char* word, msgCallbackFull callback, void* userData) {
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(callback != NULL);
+
+	add_item_to_dictionary(mh, word, NULL, callback, userData);
+}
+
+void mh_send_data(MessageHandler* mh, const Package pkg, Package* output, unsigned int* sizeOutput) {
+    g_return_if_fail(mh != NULL);
+	g_return_if_fail(pkg.name != NULL);
+
+	mh_send_id(mh, mh_resolve_word(mh, pkg.name), pkg, output, sizeOutput);
+}
+
+msgId mh_resolve_word(MessageHandler* mh, const char* word) {
+	g_return_val_if_fail(mh != NULL, MSG_ID_INVALID);
+	g_return_val_if_fail(word != NULL, MSG_ID_INVALID);
+
+	if (mh->frozen != NULL)
+		return ph_lookup(mh->frozen, word);
+
+	/* identifiers are stored shifted by one, since NULL means not found */
+	return GPOINTER_TO_INT(g_hash_table_lookup(mh->dictionary, word)) - 1;
+}
+
+void mh_send_id(MessageHandler* mh, msgId id, const Package pkg, Package* output, unsigned int* sizeOutput) {
+	callbackContainer* cont = NULL;
+
+    g_return_if_fail(mh != NULL);
+	g_return_if_fail(output != NULL);
+	g_return_if_fail(sizeOutput != NULL);
+
+	/* unknown words are ignored */
+	if (id < 0 || (unsigned int)id >= mh->words->len)
+		return;
+
+	cont = g_ptr_array_index(mh->words, id);
+
+	/* run the callback */
+	dispatch(mh, cont, pkg.data, output, sizeOutput);
+}
+
+void mh_set_batch_callback(MessageHandler* mh, const char* word, msgBatchCallback callback) {
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    ((callbackContainer*)g_ptr_array_index(mh->words, id))->batchCallback = callback;
+}
+
+unsigned int mh_send_batch(MessageHandler* mh, const Package* pkgs, unsigned int count, Package* outputs, unsigned int* sizeOutputs) {
+    callbackContainer* cont = NULL;
+    batchEntry* entries = NULL;
+    const char* lastName = NULL;
+    msgId id = MSG_ID_INVALID;
+    unsigned int batched = 0;
+    unsigned int sent = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, 0);
+    g_return_val_if_fail(pkgs != NULL || count == 0, 0);
+    g_return_val_if_fail(outputs != NULL || count == 0, 0);
+    g_return_val_if_fail(sizeOutputs != NULL || count == 0, 0);
+
+    entries = g_new(batchEntry, count);
+
+    for (i = 0; i < count; i++) {
+        sizeOutputs[i] = 0;
+
+        /* bursts usually repeat the same word */
+        if (pkgs[i].name != lastName) {
+            lastName = pkgs[i].name;
+            id = lastName != NULL ? mh_resolve_word(mh, lastName) : MSG_ID_INVALID;
+        }
+
+        if (id == MSG_ID_INVALID)
+            continue;
+
+        cont = g_ptr_array_index(mh->words, id);
+        sent++;
+
+        /* the words without batch callback run right away */
+        if (cont->batchCallback == NULL) {
+            dispatch(mh, cont, pkgs[i].data, &outputs[i], &sizeOutputs[i]);
+            continue;
+        }
+
+        entries[batched].id = id;
+        entries[batched].index = i;
+        batched++;
+    }
+
+    if (batched > 0)
+        send_batch_groups(mh, pkgs, entries, batched, outputs, sizeOutputs);
+
+    g_free(entries);
+
+    return sent;
+}
+
+void mh_set_workers(MessageHandler* mh, unsigned int workers) {
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(workers > 0);
+
+    /* the pool is restarted with the new size on the next post */
+    stop_workers(mh);
+
+    mh->numWorkers = workers;
+}
+
+unsigned int mh_get_workers(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, 0);
+
+    return mh->numWorkers;
+}
+
+void mh_set_word_mode(MessageHandler* mh, const char* word, msgWordMode mode) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    /* a serial word is the only word of its mailbox */
+    if (mode == MSG_WORD_SERIAL && cont->ownMailbox == NULL)
+        cont->ownMailbox = mh_mailbox_new(mh, word);
+
+    mh_set_word_mailbox(mh, word, mode == MSG_WORD_SERIAL ? cont->ownMailbox : NULL);
+}
+
+MessageMailbox* mh_mailbox_new(MessageHandler* mh, const char* name) {
+    MessageMailbox* mailbox = NULL;
+
+    g_return_val_if_fail(mh != NULL, NULL);
+    g_return_val_if_fail(name != NULL, NULL);
+
+    mailbox = new_mailbox(name);
+
+    g_mutex_lock(&mh->lock);
+    g_ptr_array_add(mh->mailboxes, mailbox);
+    g_mutex_unlock(&mh->lock);
+
+    return mailbox;
+}
+
+const char* mh_mailbox_get_name(MessageMailbox* mailbox) {
+    g_return_val_if_fail(mailbox != NULL, NULL);
+
+    return mailbox->name;
+}
+
+void mh_set_word_mailbox(MessageHandler* mh, const char* word, MessageMailbox* mailbox) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    /* the queued messages run in the mailbox they have been posted to */
+    mh_flush(mh);
+
+    g_mutex_lock(&mh->lock);
+    cont->mailbox = mailbox;
+    g_mutex_unlock(&mh->lock);
+}
+
+GSource* mh_source_new(MessageHandler* mh, unsigned int budget) {
+    messageSource* msrc = NULL;
+
+    g_return_val_if_fail(mh != NULL, NULL);
+
+    msrc = (messageSource*)g_source_new(&_sourceFuncs, sizeof(messageSource));
+    msrc->mh = mh;
+    msrc->scheduled = FALSE;
+    msrc->closed = FALSE;
+    msrc->budget = budget;
+    g_mutex_init(&msrc->lock);
+    g_queue_init(&msrc->queue);
+
+    g_source_set_name(&msrc->source, "MessageHandler");
+
+    g_mutex_lock(&mh->lock);
+    g_ptr_array_add(mh->sources, msrc);
+    g_mutex_unlock(&mh->lock);
+
+    return &msrc->source;
+}
+
+void mh_source_set_budget(GSource* source, unsigned int budget) {
+    g_return_if_fail(source != NULL);
+
+    g_atomic_int_set(&((messageSource*)source)->budget, budget);
+}
+
+void mh_set_word_source(MessageHandler* mh, const char* word, GSource* source) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    /* the messages already posted run where they have been queued */
+    g_atomic_pointer_set(&cont->source, (messageSource*)source);
+}
+
+void mh_set_word_coalescing(MessageHandler* mh, const char* word, int enabled, unsigned int interval) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    /* the pending message must be queued before the word changes */
+    mh_flush(mh);
+
+    g_mutex_lock(&mh->lock);
+
+    /* the trigger is only queued, it's never run or completed */
+    if (enabled && cont->trigger == NULL) {
+        cont->trigger = g_new0(messageJob, 1);
+        cont->trigger->mh = mh;
+        cont->trigger->cont = cont;
+        cont->trigger->trigger = TRUE;
+    } else if (!enabled) {
+        g_free(cont->trigger);
+        cont->trigger = NULL;
+    }
+
+    cont->interval = enabled ? interval : 0;
+    cont->nextRun = 0;
+    cont->scheduled = FALSE;
+
+    /* the timer queues the triggers of the words with an interval */
+    if (cont->interval > 0 && mh->timer == NULL)
+        mh->timer = g_thread_new("mh-timer", timer_thread, mh);
+
+    g_mutex_unlock(&mh->lock);
+}
+
+unsigned int mh_get_coalesced(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, 0);
+
+    return g_atomic_int_get(&mh->coalesced);
+}
+
+void mh_set_word_priority(MessageHandler* mh, const char* word, msgPriority priority, unsigned int deadline) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(priority >= MSG_PRIORITY_LOW && priority <= MSG_PRIORITY_CRITICAL);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    g_mutex_lock(&mh->lock);
+    cont->priority = priority;
+    cont->deadline = deadline;
+    g_mutex_unlock(&mh->lock);
+}
+
+void mh_set_word_deadline_policy(MessageHandler* mh, const char* word, msgDeadlinePolicy policy) {
+    callbackContainer* cont = NULL;
+    msgId id = MSG_ID_INVALID;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(policy == MSG_DEADLINE_RUN_LATE || policy == MSG_DEADLINE_DROP);
+
+    id = mh_resolve_word(mh, word);
+    g_return_if_fail(id != MSG_ID_INVALID);
+
+    cont = g_ptr_array_index(mh->words, id);
+
+    g_mutex_lock(&mh->lock);
+    cont->deadlinePolicy = policy;
+    g_mutex_unlock(&mh->lock);
+}
+
+MessageFuture* mh_post(MessageHandler* mh, const Package pkg) {
+    g_return_val_if_fail(mh != NULL, NULL);
+    g_return_val_if_fail(pkg.name != NULL, NULL);
+
+    return post_job(mh, &pkg, NULL, NULL, 2, mh->policy, MSG_PRIORITY_OF_WORD, 0, 0);
+}
+
+int mh_post_with_callback(MessageHandler* mh, const Package pkg, msgDoneFunc done, void* userData) {
+    g_return_val_if_fail(mh != NULL, FALSE);
+    g_return_val_if_fail(pkg.name != NULL, FALSE);
+    g_return_val_if_fail(done != NULL, FALSE);
+
+    return post_job(mh, &pkg, done, userData, 1, mh->policy, MSG_PRIORITY_OF_WORD, 0, 0) != NULL;
+}
+
+int mh_post_with_priority(MessageHandler* mh, const Package pkg, msgPriority priority, unsigned int deadline,
+                          msgDoneFunc done, void* userData) {
+    g_return_val_if_fail(mh != NULL, FALSE);
+    g_return_val_if_fail(pkg.name != NULL, FALSE);
+    g_return_val_if_fail(priority >= MSG_PRIORITY_LOW && priority <= MSG_PRIORITY_CRITICAL, FALSE);
+
+    return post_job(mh, &pkg, done, userData, 1, mh->policy, priority, deadline, 0) != NULL;
+}
+
+int mh_try_post(MessageHandler* mh, const Package pkg, msgDoneFunc done, void* userData) {
+    msgQueuePolicy policy = MSG_QUEUE_REJECT;
+
+    g_return_val_if_fail(mh != NULL, FALSE);
+    g_return_val_if_fail(pkg.name != NULL, FALSE);
+
+    /* it never blocks, but it can make room for the message */
+    if (mh->policy == MSG_QUEUE_DROP_OLDEST)
+        policy = MSG_QUEUE_DROP_OLDEST;
+
+    return post_job(mh, &pkg, done, userData, 1, policy, MSG_PRIORITY_OF_WORD, 0, 0) != NULL;
+}
+
+void mh_set_queue(MessageHandler* mh, unsigned int size, msgQueuePolicy policy) {
+    unsigned int i = 0;
+
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(size > 0);
+
+    /* the queues must be empty to be replaced */
+    stop_workers(mh);
+
+    for (i = 0; i < MSG_PRIORITY_LEVELS; i++) {
+        rb_free(mh->queues[i]);
+        mh->queues[i] = rb_new(size);
+    }
+
+    mh->policy = policy;
+}
+
+unsigned int mh_get_queue_size(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, 0);
+
+    return rb_get_capacity(mh->queues[MSG_PRIORITY_NORMAL]);
+}
+
+unsigned int mh_get_dropped(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, 0);
+
+    return g_atomic_int_get(&mh->dropped);
+}
+
+unsigned int mh_get_missed_deadlines(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, 0);
+
+    return g_atomic_int_get(&mh->missedDeadlines);
+}
+
+void mh_flush(MessageHandler* mh) {
+    int polling = FALSE;
+
+    g_return_if_fail(mh != NULL);
+
+    for (;;) {
+        /* the workers can queue more messages on the main loops of this thread meanwhile */
+        polling = run_own_sources(mh);
+
+        g_mutex_lock(&mh->lock);
+
+        if (g_atomic_int_get(&mh->pending) == 0) {
+            g_mutex_unlock(&mh->lock);
+            break;
+        }
+
+        if (polling)
+            g_cond_wait_until(&mh->idle, &mh->lock, g_get_monotonic_time() + MSG_FLUSH_POLL);
+        else
+            g_cond_wait(&mh->idle, &mh->lock);
+
+        g_mutex_unlock(&mh->lock);
+    }
+}
+
+int mh_future_is_done(MessageFuture* future) {
+    int completed = FALSE;
+
+    g_return_val_if_fail(future != NULL, FALSE);
+
+    g_mutex_lock(&future->lock);
+    completed = future->completed;
+    g_mutex_unlock(&future->lock);
+
+    return completed;
+}
+
+int mh_future_wait(MessageFuture* future, Package* output, unsigned int* sizeOutput) {
+    g_return_val_if_fail(future != NULL, FALSE);
+    g_return_val_if_fail(output != NULL, FALSE);
+    g_return_val_if_fail(sizeOutput != NULL, FALSE);
+
+    g_mutex_lock(&future->lock);
+
+    while (!future->completed) {
+        g_cond_wait(&future->cond, &future->lock);
+    }
+
+    g_mutex_unlock(&future->lock);
+
+    if (!future->processed)
+        return FALSE;
+
+    *output = future->output;
+    *sizeOutput = future->sizeOutput;
+
+    return TRUE;
+}
+
+void mh_future_free(MessageFuture* future) {
+    g_return_if_fail(future != NULL);
+
+    unref_job(future);
+}
+
+unsigned int mh_subscribe(MessageHandler* mh, const char* pattern, msgSubscriberFunc func, void* userData) {
+    msgSubscriber* subscriber = NULL;
+
+    g_return_val_if_fail(mh != NULL, 0);
+    g_return_val_if_fail(pattern != NULL, 0);
+    g_return_val_if_fail(func != NULL, 0);
+
+    if (!tt_pattern_is_valid(pattern))
+        return 0;
+
+    g_mutex_lock(&mh->topicsLock);
+
+    subscriber = new_subscriber(++mh->lastSubscription, pattern, func, userData);
+
+    tt_insert(mh->topics, pattern, subscriber);
+    g_hash_table_insert(mh->subscribers, GUINT_TO_POINTER(subscriber->subscription), subscriber);
+    g_hash_table_remove_all(mh->topicsCache);
+
+    g_mutex_unlock(&mh->topicsLock);
+
+    return subscriber->subscription;
+}
+
+int mh_unsubscribe(MessageHandler* mh, unsigned int subscription) {
+    msgSubscriber* subscriber = NULL;
+
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    g_mutex_lock(&mh->topicsLock);
+
+    subscriber = g_hash_table_lookup(mh->subscribers, GUINT_TO_POINTER(subscription));
+
+    if (subscriber != NULL) {
+        tt_remove(mh->topics, subscriber->pattern, subscriber);
+        g_hash_table_remove_all(mh->topicsCache);
+        g_hash_table_remove(mh->subscribers, GUINT_TO_POINTER(subscription));
+    }
+
+    g_mutex_unlock(&mh->topicsLock);
+
+    return subscriber != NULL;
+}
+
+unsigned int mh_publish(MessageHandler* mh, const Package pkg) {
+    GPtrArray* subscribers = NULL;
+    msgSubscriber* subscriber = NULL;
+    unsigned int count = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, 0);
+    g_return_val_if_fail(pkg.name != NULL, 0);
+
+    subscribers = get_subscribers(mh, pkg.name);
+
+    for (i = 0; i < subscribers->len; i++) {
+        subscriber = g_ptr_array_index(subscribers, i);
+        subscriber->func(pkg.name, pkg.data, subscriber->userData);
+    }
+
+    count = subscribers->len;
+    g_ptr_array_unref(subscribers);
+
+    return count;
+}
+
+unsigned int mh_send_gather(MessageHandler* mh, const char* const* words, unsigned int count, PackageData* data,
+                            Package* outputs, unsigned int* sizeOutputs, unsigned int timeout) {
+    MessageFuture** futures = NULL;
+    MessageFuture* future = NULL;
+    Package pkg;
+    gint64 end = 0;
+    unsigned int answered = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, 0);
+    g_return_val_if_fail(words != NULL || count == 0, 0);
+    g_return_val_if_fail(outputs != NULL || count == 0, 0);
+    g_return_val_if_fail(sizeOutputs != NULL || count == 0, 0);
+
+    futures = g_new(MessageFuture*, count);
+
+    if (timeout > 0)
+        end = g_get_monotonic_time() + (gint64)timeout * 1000;
+
+    pkg.size = 0;
+    pkg.data = data;
+
+    /* the messages still queued after the timeout are dropped, without missing a deadline */
+    for (i = 0; i < count; i++) {
+        pkg.name = (char*)words[i];
+        futures[i] = post_job(mh, &pkg, NULL, NULL, 2, mh->policy, MSG_PRIORITY_OF_WORD, 0, MIN(timeout, G_MAXUINT / 1000) * 1000);
+    }
+
+    /* all the futures share the same end time */
+    for (i = 0; i < count; i++) {
+        future = futures[i];
+        outputs[i].data = NULL;
+        sizeOutputs[i] = 0;
+
+        if (future == NULL)
+            continue;
+
+        g_mutex_lock(&future->lock);
+
+        while (!future->completed) {
+            if (end == 0)
+                g_cond_wait(&future->cond, &future->lock);
+            else if (!g_cond_wait_until(&future->cond, &future->lock, end))
+                break;
+        }
+
+        /* the output is handed over to the caller */
+        if (future->completed && future->processed) {
+            outputs[i] = future->output;
+            sizeOutputs[i] = future->sizeOutput;
+            future->output.data = NULL;
+            answered++;
+        }
+
+        g_mutex_unlock(&future->lock);
+
+        mh_future_free(future);
+    }
+
+    g_free(futures);
+
+    return answered;
+}
+
+unsigned int mh_publish_parallel(MessageHandler* mh, const Package pkg) {
+    GPtrArray* subscribers = NULL;
+    msgSubscriber* subscriber = NULL;
+    messageJob* job = NULL;
+    publishGroup* group = NULL;
+    unsigned int count = 0;
+    unsigned int called = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(mh != NULL, 0);
+    g_return_val_if_fail(pkg.name != NULL, 0);
+
+    subscribers = get_subscribers(mh, pkg.name);
+    count = subscribers->len;
+
+    group = g_new0(publishGroup, 1);
+    g_mutex_init(&group->lock);
+    g_cond_init(&group->cond);
+    group->remaining = count > 0 ? count - 1 : 0;
+    group->refs = group->remaining + 1;
+
+    /* the workers call all the subscribers but the last one, which runs on this thread */
+    for (i = 0; i + 1 < count; i++) {
+        job = new_job(mh, NULL, &pkg, publish_done, group, 1);
+        job->subscriber = ref_subscriber(g_ptr_array_index(subscribers, i));
+
+        queue_job(mh, job, MSG_QUEUE_BLOCK);
+    }
+
+    if (count > 0) {
+        subscriber = g_ptr_array_index(subscribers, count - 1);
+        subscriber->func(pkg.name, pkg.data, subscriber->userData);
+    }
+
+    g_mutex_lock(&group->lock);
+
+    while (group->remaining > 0) {
+        g_cond_wait(&group->cond, &group->lock);
+    }
+
+    called = group->called + (count > 0 ? 1 : 0);
+
+    g_mutex_unlock(&group->lock);
+
+    unref_publish_group(group);
+    g_ptr_array_unref(subscribers);
+
+    return called;
+}
+
+PackageData* mh_alloc_output(unsigned int count) {
+    dispatchContext* ctx = NULL;
+    outputBlock* block = NULL;
+
+    g_return_val_if_fail(count > 0, NULL);
+
+    ctx = g_private_get(&_dispatchContext);
+    g_return_val_if_fail(ctx != NULL && ctx->mh != NULL, NULL);
+
+    block = alloc_block(ctx->mh, count);
+    g_ptr_array_add(ctx->blocks, block);
+
+    return block->data;
+}
+
+void mh_release_output(MessageHandler* mh, Package* output) {
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(output != NULL);
+
+    release_data(mh, output->data);
+
+    output->data = NULL;
+}
+
+void mh_set_trace(MessageHandler* mh, msgTraceFunc func, void* userData) {
+    g_return_if_fail(mh != NULL);
+
+    mh->traceData = userData;
+    mh->trace = func;
+}
+
+void mh_set_stats_enabled(MessageHandler* mh, int enabled) {
+    g_return_if_fail(mh != NULL);
+
+    g_atomic_int_set(&mh->statsEnabled, enabled ? TRUE : FALSE);
+}
+
+int mh_get_stats_enabled(MessageHandler* mh) {
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    return g_atomic_int_get(&mh->statsEnabled);
+}
+
+MessageStats* mh_get_stats(MessageHandler* mh, unsigned int* size) {
+    MessageStats* stats = NULL;
+    callbackContainer* cont = NULL;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    g_return_val_if_fail(mh != NULL, NULL);
+    g_return_val_if_fail(size != NULL, NULL);
+
+    stats = g_new0(MessageStats, mh->words->len);
+
+    for (i = 0; i < mh->words->len; i++) {
+        cont = g_ptr_array_index(mh->words, i);
+
+        stats[i].word = cont->word;
+        stats[i].calls = STATS_GET(cont->stats.calls);
+        stats[i].totalTime = STATS_GET(cont->stats.totalTime);
+        stats[i].maxTime = STATS_GET(cont->stats.maxTime);
+        stats[i].missedDeadlines = STATS_GET(cont->stats.missedDeadlines);
+
+        for (j = 0; j < MSG_STATS_BUCKETS; j++) {
+            stats[i].histogram[j] = STATS_GET(cont->stats.histogram[j]);
+        }
+    }
+
+    *size = mh->words->len;
+
+    return stats;
+}
+
+void mh_reset_stats(MessageHandler* mh) {
+    callbackContainer* cont = NULL;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    g_return_if_fail(mh != NULL);
+
+    for (i = 0; i < mh->words->len; i++) {
+        cont = g_ptr_array_index(mh->words, i);
+
+        STATS_SET(cont->stats.calls, 0);
+        STATS_SET(cont->stats.totalTime, 0);
+        STATS_SET(cont->stats.maxTime, 0);
+        STATS_SET(cont->stats.missedDeadlines, 0);
+
+        for (j = 0; j < MSG_STATS_BUCKETS; j++) {
+            STATS_SET(cont->stats.histogram[j], 0);
+        }
+    }
+}
+
+static void append_json_string(GString* json, const char* str) {
+    g_string_append_c(json, '"');
+
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            g_string_append_printf(json, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            g_string_append_printf(json, "\\u%04x", *str);
+        else
+            g_string_append_c(json, *str);
+    }
+
+    g_string_append_c(json, '"');
+}
+
+char* mh_get_stats_json(MessageHandler* mh) {
+    MessageStats* stats = NULL;
+    GString* json = NULL;
+    unsigned int size = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+
+    g_return_val_if_fail(mh != NULL, NULL);
+
+    stats = mh_get_stats(mh, &size);
+    json = g_string_new("{\"enabled\":");
+
+    g_string_append(json, mh_get_stats_enabled(mh) ? "true" : "false");
+    g_string_append(json, ",\"words\":[");
+
+    for (i = 0; i < size; i++) {
+        if (i > 0)
+            g_string_append_c(json, ',');
+
+        g_string_append(json, "{\"word\":");
+        append_json_string(json, stats[i].word);
+
+        g_string_append_printf(json, ",\"calls\":%u,\"total_ns\":%llu,\"max_ns\":%llu,\"missed_deadlines\":%u,\"histogram\":[",
+            stats[i].calls, stats[i].totalTime, stats[i].maxTime, stats[i].missedDeadlines);
+
+        for (j = 0; j < MSG_STATS_BUCKETS; j++) {
+            g_string_append_printf(json, j > 0 ? ",%u" : "%u", stats[i].histogram[j]);
+        }
+
+        g_string_append(json, "]}");
+    }
+
+    g_string_append(json, "]}");
+
+    g_free(stats);
+
+    return g_string_free(json, FALSE);
 }
@@ -20,10 +20,20 @@
 #ifndef MESSAGES_H
 #define MESSAGES_H
 
+#include <glib.h>
+
 /* Abstract data type that rapresents the message handler */
 struct MessageHandler_type;
 typedef struct MessageHandler_type MessageHandler;
 
+/* Abstract data type that rapresents the result of a posted message */
+struct MessageFuture_type;
+typedef struct MessageFuture_type MessageFuture;
+
+/* Abstract data type that rapresents a mailbox, which runs the posted messages of its words one at a time */
+struct MessageMailbox_type;
+typedef struct MessageMailbox_type MessageMailbox;
+
 typedef struct {
 	void* field; 	/* data field */
 } PackageData;
@@ -34,9 +44,74 @@ typedef struct {
 	PackageData *data;  /* data */
 } Package;				/* general package for the message handler */
 
-/* The callback related to a message. */
+/* The callback related to a message. The output data should be allocated with mh_alloc_output(). */
 typedef void (*msgCallback)(const PackageData *data, Package *output, unsigned int *sizeOutput);
 
+/* The callback related to a message, with the user data given to mh_add_word_full(). */
+typedef void (*msgCallbackFull)(const PackageData *data, Package *output, unsigned int *sizeOutput, void* userData);
+
+/* The callback related to a message, when packages are sent in batch. The packages are
+ * all sent to the same word, and the outputs are in the same order. */
+typedef void (*msgBatchCallback)(const Package *pkgs, unsigned int count, Package *outputs, unsigned int *sizeOutputs);
+
+/* The identifier of a dictionary word, resolved once by mh_resolve_word(). */
+typedef int msgId;
+
+#define MSG_ID_INVALID (-1)
+
+/* How the messages of a word run on the worker pool. */
+typedef enum {
+    MSG_WORD_REENTRANT,     /* messages run in parallel on any worker */
+    MSG_WORD_SERIAL         /* messages run one at a time, in post order */
+} msgWordMode;
+
+/* The priority of the posted messages. Workers run the queued messages of higher priority first. */
+typedef enum {
+    MSG_PRIORITY_LOW,
+    MSG_PRIORITY_NORMAL,
+    MSG_PRIORITY_HIGH,
+    MSG_PRIORITY_CRITICAL
+} msgPriority;
+
+#define MSG_PRIORITY_LEVELS 4
+
+/* What happens to a posted message still queued when its deadline expires. */
+typedef enum {
+    MSG_DEADLINE_RUN_LATE,  /* the message runs anyway */
+    MSG_DEADLINE_DROP       /* the message is dropped */
+} msgDeadlinePolicy;
+
+/* The callback of a topic subscriber. */
+typedef void (*msgSubscriberFunc)(const char* topic, const PackageData *data, void* userData);
+
+/* The callback called with every package dispatched to a word, before the word callback. */
+typedef void (*msgTraceFunc)(const char* word, const PackageData *data, void* userData);
+
+/* The number of buckets of the latency histogram */
+#define MSG_STATS_BUCKETS 32
+
+/* The statistics of a word. */
+typedef struct {
+    const char* word;
+    unsigned int calls;                 /* packages handled by the callbacks */
+    unsigned long long totalTime;       /* time spent in the callbacks, in ns */
+    unsigned long long maxTime;         /* longest callback, in ns */
+    unsigned int histogram[MSG_STATS_BUCKETS];  /* callbacks lasting [2^i, 2^(i+1)) ns, the last one is unbounded */
+    unsigned int missedDeadlines;       /* posted messages completed late or expired, counted even if statistics are disabled */
+} MessageStats;
+
+/* What happens when a message is posted to a full queue. */
+typedef enum {
+    MSG_QUEUE_BLOCK,        /* the sender waits for a free slot */
+    MSG_QUEUE_DROP_OLDEST,  /* the oldest queued message is dropped */
+    MSG_QUEUE_REJECT        /* the posted message is rejected */
+} msgQueuePolicy;
+
+/* The callback called on a worker thread when a posted message has been processed.
+ * If the message has been dropped, the output is NULL and it's called by the sender
+ * of the message that took its place. */
+typedef void (*msgDoneFunc)(const Package *output, unsigned int sizeOutput, void* userData);
+
 /* Creates a new module. */
 MessageHandler* mh_new(void);
 
@@ -46,10 +121,211 @@ void mh_free(MessageHandler* mh);
 /* Return dictionary routines. */
 const char* const* mh_get_dictionary(MessageHandler* mh, unsigned int* size);
 
-/* Add dictionary word routines related to the callback. */
+/* Add dictionary word routines related to the callback. The dictionary isn't locked, so words must be
+ * added before other threads send or post messages, not while they do. */
 void mh_add_word(MessageHandler* mh, const char* word, msgCallback callback);
 
+/* It adds a word, whose callback is called with the user data. */
+void mh_add_word_full(MessageHandler* mh, const char* word, msgCallbackFull callback, void* userData);
+
 /* It sends the data and it initializes the output array with output data. */
 void mh_send_data(MessageHandler* mh, const Package pkg, Package *output, unsigned int *sizeOutput);
 
+/* Returns the identifier of a dictionary word, MSG_ID_INVALID if the word is unknown. */
+msgId mh_resolve_word(MessageHandler* mh, const char* word);
+
+/* It freezes the dictionary: words are looked up in a minimal perfect hash, which costs a single
+ * string compare, instead of the hash table. Words added later build it again, so they should be
+ * added before. Like adding words, it must not run while other threads send or post messages.
+ * Returns FALSE if it can't be built, and the hash table is used. */
+int mh_freeze(MessageHandler* mh);
+
+/* Returns TRUE if the dictionary is frozen. */
+int mh_is_frozen(MessageHandler* mh);
+
+/* It sends the data to a resolved word, without looking up its name. */
+void mh_send_id(MessageHandler* mh, msgId id, const Package pkg, Package *output, unsigned int *sizeOutput);
+
+/* It sets the callback that receives the packages of a word sent by mh_send_batch(),
+ * instead of calling the word callback once per package. */
+void mh_set_batch_callback(MessageHandler* mh, const char* word, msgBatchCallback callback);
+
+/* It sends an array of packages. The packages of each word with a batch callback are passed
+ * to it in a single call, while the others are sent one by one. The outputs and their sizes are
+ * stored in the caller arrays at the same position of their packages, and the size is 0 for
+ * unknown words. Returns the number of packages sent to a known word. */
+unsigned int mh_send_batch(MessageHandler* mh, const Package* pkgs, unsigned int count, Package *outputs, unsigned int *sizeOutputs);
+
+/* It sets the number of worker threads that run posted messages. Default is the number of processors.
+ * It waits for the posted messages first, like mh_flush(). */
+void mh_set_workers(MessageHandler* mh, unsigned int workers);
+
+/* Returns the number of worker threads. */
+unsigned int mh_get_workers(MessageHandler* mh);
+
+/* It sets how the messages of a word run on the worker pool. Default is MSG_WORD_REENTRANT.
+ * A serial word gets a mailbox of its own, see mh_set_word_mailbox(). It waits for the posted messages
+ * first, like mh_flush(). */
+void mh_set_word_mode(MessageHandler* mh, const char* word, msgWordMode mode);
+
+/* Creates a mailbox, usually one per module. The posted messages of its words run one at a time,
+ * in post order, on any worker, while different mailboxes run in parallel. So the callbacks of a
+ * module don't need locks to use its state. A mailbox holds as many messages as a queue, and the
+ * queue policy applies when it's full, see mh_set_queue(). The mailbox is freed with the message handler. */
+MessageMailbox* mh_mailbox_new(MessageHandler* mh, const char* name);
+
+/* Returns the name of the mailbox. */
+const char* mh_mailbox_get_name(MessageMailbox* mailbox);
+
+/* It moves a word to a mailbox, or out of it if the mailbox is NULL. It waits for the posted messages
+ * to be processed, like mh_flush(), so it must not be called by a callback. Messages sent with mh_send_data() run on
+ * the calling thread, outside of the mailbox. */
+void mh_set_word_mailbox(MessageHandler* mh, const char* word, MessageMailbox* mailbox);
+
+/* Creates a main loop source, which runs the posted messages of its words on the thread of the GMainContext
+ * it's attached to with g_source_attach(), ie. the GTK main loop. Queued messages run in batches, one per main
+ * loop iteration, which lasts at most the budget in microseconds (0 for no limit), so the loop keeps drawing
+ * frames. Posting wakes the main loop up only when the source has nothing queued. The source is destroyed with
+ * the message handler, and futures of its words must not be waited on the main loop thread. */
+GSource* mh_source_new(MessageHandler* mh, unsigned int budget);
+
+/* It sets the time budget of a main loop iteration, in microseconds. 0 for no limit. */
+void mh_source_set_budget(GSource* source, unsigned int budget);
+
+/* It makes the posted messages of a word run on the main loop of the source, or on the worker pool
+ * if the source is NULL. Messages already posted run where they have been queued. */
+void mh_set_word_source(MessageHandler* mh, const char* word, GSource* source);
+
+/* It sets the priority and the deadline of the messages of a word posted to the worker pool. The deadline
+ * is in microseconds from the post, 0 for no deadline. Within a priority, messages with a deadline run
+ * first, the earliest deadline first, then the others in post order. Messages still queued when their
+ * deadline expires run late, see mh_set_word_deadline_policy(). Messages of a serial word keep
+ * the post order. Default is MSG_PRIORITY_NORMAL without deadline. */
+void mh_set_word_priority(MessageHandler* mh, const char* word, msgPriority priority, unsigned int deadline);
+
+/* It sets what happens to the messages of a word still queued when their deadline expires. Either way,
+ * they count in mh_get_missed_deadlines(). Default is MSG_DEADLINE_RUN_LATE. */
+void mh_set_word_deadline_policy(MessageHandler* mh, const char* word, msgDeadlinePolicy policy);
+
+/* It makes the posted messages of a word coalescing, when only the latest value matters: while a message
+ * is pending, a newer one takes its place, and the callback runs at most once per interval, in microseconds
+ * (0 for no limit). The callback runs one message at a time, so the values are handled in post order.
+ * The replaced messages are completed as dropped, and a message rejected by a full queue is dropped too.
+ * It waits for the posted messages first, like mh_flush(). */
+void mh_set_word_coalescing(MessageHandler* mh, const char* word, int enabled, unsigned int interval);
+
+/* It posts the data to the worker pool. The package data must be valid until the message has been
+ * processed. Returns NULL if the word is unknown or the message has been rejected, otherwise
+ * the future must be freed with mh_future_free(). */
+MessageFuture* mh_post(MessageHandler* mh, const Package pkg);
+
+/* It posts the data to the worker pool and calls done when it has been processed.
+ * Returns FALSE if the word is unknown or the message has been rejected. */
+int mh_post_with_callback(MessageHandler* mh, const Package pkg, msgDoneFunc done, void* userData);
+
+/* It posts the data to the worker pool without blocking, even with the MSG_QUEUE_BLOCK policy.
+ * It's safe to call it from any thread, once the words have been added. The done callback can be NULL.
+ * Returns FALSE if the word is unknown or the queue is full. */
+int mh_try_post(MessageHandler* mh, const Package pkg, msgDoneFunc done, void* userData);
+
+/* Like mh_post_with_callback(), but with the given priority and deadline instead of the word ones.
+ * The done callback can be NULL. */
+int mh_post_with_priority(MessageHandler* mh, const Package pkg, msgPriority priority, unsigned int deadline,
+                          msgDoneFunc done, void* userData);
+
+/* It sets the size of the posted messages queue and what happens when it's full. Every priority
+ * has its own queue of the given size, and as many messages with a deadline, whose dropped one is the
+ * one with the latest deadline. Default is 4096 messages with MSG_QUEUE_BLOCK. It waits for
+ * the posted messages first, like mh_flush(). */
+void mh_set_queue(MessageHandler* mh, unsigned int size, msgQueuePolicy policy);
+
+/* Returns the size of the posted messages queue of every priority. */
+unsigned int mh_get_queue_size(MessageHandler* mh);
+
+/* Returns the number of messages dropped or rejected because the queue was full. */
+unsigned int mh_get_dropped(MessageHandler* mh);
+
+/* Returns the number of posted messages started or completed after their deadline, run or dropped. */
+unsigned int mh_get_missed_deadlines(MessageHandler* mh);
+
+/* Returns the number of messages of coalescing words replaced by newer ones. */
+unsigned int mh_get_coalesced(MessageHandler* mh);
+
+/* It waits until all the posted messages have been processed. Meanwhile, the messages queued on the main
+ * loop sources of the calling thread run on it, so it can be called by the main loop thread without
+ * deadlocking. It must not be called by a callback, which would wait for itself. */
+void mh_flush(MessageHandler* mh);
+
+/* Returns TRUE if the posted message has been processed. */
+int mh_future_is_done(MessageFuture* future);
+
+/* It waits until the posted message has been processed and it initializes the output.
+ * Returns FALSE if the message has been dropped. */
+int mh_future_wait(MessageFuture* future, Package *output, unsigned int *sizeOutput);
+
+/* It frees the future. The message is processed anyway. */
+void mh_future_free(MessageFuture* future);
+
+/* It subscribes to the topics matching the pattern. Topics are words made of segments separated
+ * by dots, ie. "axis.1.position". In a pattern "*" matches exactly one segment and a final "#"
+ * matches any number of trailing segments, ie. "axis.*.position" or "axis.#".
+ * A topic can have many subscribers, which are called in subscription order.
+ * Returns the subscription identifier, 0 if the pattern is not valid. */
+unsigned int mh_subscribe(MessageHandler* mh, const char* pattern, msgSubscriberFunc func, void* userData);
+
+/* It removes a subscription. Returns FALSE if it's not found. */
+int mh_unsubscribe(MessageHandler* mh, unsigned int subscription);
+
+/* It calls all the subscribers of the package topic, which is its name, on the calling thread.
+ * Returns the number of subscribers. */
+unsigned int mh_publish(MessageHandler* mh, const Package pkg);
+
+/* Like mh_publish(), but the subscribers run in parallel on the worker pool. It returns when
+ * all of them have been called or dropped, ie. by a full queue with MSG_QUEUE_DROP_OLDEST.
+ * It must not be called by a worker thread. Returns the number of subscribers called. */
+unsigned int mh_publish_parallel(MessageHandler* mh, const Package pkg);
+
+/* It sends the same data to all the words, whose callbacks run in parallel on the worker pool, and it waits
+ * for their outputs up to timeout ms, or forever if it's 0. The outputs and their sizes are stored in the caller
+ * arrays in the words order, and they must be released with mh_release_output(). The size is 0 for unknown words
+ * and for words that didn't answer in time: their messages are dropped if they didn't start, otherwise they
+ * complete later, so the data must be valid until then. The timeout is not a deadline, so these messages
+ * don't count in mh_get_missed_deadlines(). It must not be called by a worker thread.
+ * Returns the number of words that answered. */
+unsigned int mh_send_gather(MessageHandler* mh, const char* const* words, unsigned int count, PackageData* data,
+                            Package *outputs, unsigned int *sizeOutputs, unsigned int timeout);
+
+/* It allocates the output data of the running callback, from a pool of the message handler.
+ * It can only be called by a callback. The data is valid until it's released:
+ * - by mh_release_output(), for outputs of mh_send_data(), mh_send_id() and mh_send_batch()
+ * - by mh_future_free(), for outputs of mh_post()
+ * - when the done callback returns, for outputs of mh_post_with_callback() and mh_try_post()
+ * Data allocated by the callback, but not used by its output, is released when it returns.
+ * Every thread keeps its own free data, so allocating and releasing don't lock the handler. */
+PackageData* mh_alloc_output(unsigned int count);
+
+/* It releases the output data, if it has been allocated by mh_alloc_output(). Other data is left untouched.
+ * The output data is set to NULL. */
+void mh_release_output(MessageHandler* mh, Package *output);
+
+/* It sets the callback that traces the dispatched packages, or it removes it if func is NULL. It's
+ * called on the dispatching thread, so it must be thread safe. It should be set while no messages
+ * are dispatched. */
+void mh_set_trace(MessageHandler* mh, msgTraceFunc func, void* userData);
+
+/* It enables the statistics of the words. They are disabled by default. */
+void mh_set_stats_enabled(MessageHandler* mh, int enabled);
+
+/* Returns TRUE if the statistics are enabled. */
+int mh_get_stats_enabled(MessageHandler* mh);
+
+/* Returns the statistics of all the words, in identifier order. The array must be freed with g_free(). */
+MessageStats* mh_get_stats(MessageHandler* mh, unsigned int* size);
+
+/* It clears the statistics of all the words. */
+void mh_reset_stats(MessageHandler* mh);
+
+/* Returns the statistics of all the words as a JSON object. The string must be freed with g_free(). */
+char* mh_get_stats_json(MessageHandler* mh);
+
 #endif
@@ -0,0 +1,296 @@
+/*
+ * perfect_hash.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "perfect_hash.h"
+#include "definitions.h"
+
+/* average number of keys per bucket */
+#define PH_BUCKET_SIZE 4
+
+/* displacements tried for a bucket before trying another seed */
+#define PH_MAX_DISPLACEMENTS (1u << 20)
+
+#define PH_MAX_SEEDS 8
+
+/* a slot of the table */
+typedef struct {
+    const char* key;
+    unsigned int length;        /* length of the key, checked before comparing it */
+    unsigned int index;         /* position of the key in the ph_new() array */
+} phSlot;
+
+struct PerfectHash_type {
+    guint64 seed;
+    unsigned int size;
+    unsigned int numBuckets;
+    guint32* displacements;     /* per bucket */
+    phSlot* slots;
+};
+
+/* A bucket being built */
+typedef struct {
+    unsigned int bucket;
+    unsigned int first;         /* first key of the bucket, in the sorted keys */
+    unsigned int count;
+} phBucket;
+
+typedef struct {
+    guint64 hash;
+    size_t length;
+    unsigned int bucket;
+    unsigned int index;
+} phKey;
+
+/* it maps a 32 bits value to [0, size) with a multiplication instead of a division */
+static unsigned int ph_reduce(guint32 value, unsigned int size) {
+    return (unsigned int)(((guint64)value * size) >> 32);
+}
+
+static guint64 ph_mix(guint64 hash, guint64 word) {
+    hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+
+    return hash ^ (hash >> 29);
+}
+
+/* The key is hashed 8 bytes at a time. The last word overlaps the previous one
+ * instead of being read byte by byte, and shorter keys are read in two halves */
+static guint64 ph_hash(const char* key, guint64 seed, size_t* length) {
+    guint64 hash = 0x9E3779B97F4A7C15ULL ^ seed;
+    guint64 word = 0;
+    guint32 half = 0;
+    size_t size = strlen(key);
+    size_t i = 0;
+
+    if (size >= 8) {
+        for (i = 0; i + 8 < size; i += 8) {
+            memcpy(&word, key + i, 8);
+            hash = ph_mix(hash, word);
+        }
+
+        memcpy(&word, key + size - 8, 8);
+    } else if (size >= 4) {
+        memcpy(&half, key, 4);
+        word = (guint64)half << 32;
+        memcpy(&half, key + size - 4, 4);
+        word |= half;
+    } else if (size > 0) {
+        word = ((guint64)(unsigned char)key[0] << 16) | ((guint64)(unsigned char)key[size / 2] << 8) | (unsigned char)key[size - 1];
+    }
+
+    *length = size;
+
+    hash = ph_mix(hash, word ^ ((guint64)size << 56));
+    hash *= 0x94D049BB133111EBULL;
+
+    return hash ^ (hash >> 31);
+}
+
+/* the slot of a hash with the bucket displacement. The displacements are
+ * consecutive numbers, so they're spread by a multiplication and a shift */
+static unsigned int ph_slot(guint64 hash, guint32 displacement, unsigned int size) {
+    guint32 value = (guint32)hash ^ (guint32)((displacement * 0x9E3779B97F4A7C15ULL) >> 32);
+
+    value ^= value >> 16;
+    value *= 0x85EBCA6BU;
+    value ^= value >> 13;
+
+    return ph_reduce(value, size);
+}
+
+static unsigned int ph_bucket(guint64 hash, unsigned int numBuckets) {
+    return ph_reduce((guint32)(hash >> 32), numBuckets);
+}
+
+static int compare_keys(const void* a, const void* b) {
+    const phKey* first = (const phKey*)a;
+    const phKey* second = (const phKey*)b;
+
+    return (first->bucket > second->bucket) - (first->bucket < second->bucket);
+}
+
+static int compare_buckets(const void* a, const void* b) {
+    const phBucket* first = (const phBucket*)a;
+    const phBucket* second = (const phBucket*)b;
+
+    /* the biggest buckets are placed first, while there are many free slots */
+    if (first->count != second->count)
+        return (first->count < second->count) - (first->count > second->count);
+
+    return (first->bucket > second->bucket) - (first->bucket < second->bucket);
+}
+
+/* it tries to place all the keys with the hash seed. Returns FALSE if a bucket can't be placed */
+static int ph_build(PerfectHash* hash, const char* const* keys, phKey* sorted, phBucket* buckets, unsigned int* slots) {
+    phBucket* bucket = NULL;
+    unsigned int numBuckets = 0;
+    unsigned int displacement = 0;
+    unsigned int slot = 0;
+    unsigned int i = 0;
+    unsigned int j = 0;
+    unsigned int k = 0;
+    int placed = FALSE;
+
+    for (i = 0; i < hash->size; i++) {
+        sorted[i].hash = ph_hash(keys[i], hash->seed, &sorted[i].length);
+        sorted[i].bucket = ph_bucket(sorted[i].hash, hash->numBuckets);
+        sorted[i].index = i;
+    }
+
+    qsort(sorted, hash->size, sizeof(phKey), compare_keys);
+
+    for (i = 0; i < hash->size; i = j) {
+        for (j = i + 1; j < hash->size && sorted[j].bucket == sorted[i].bucket; j++);
+
+        buckets[numBuckets].bucket = sorted[i].bucket;
+        buckets[numBuckets].first = i;
+        buckets[numBuckets].count = j - i;
+        numBuckets++;
+    }
+
+    qsort(buckets, numBuckets, sizeof(phBucket), compare_buckets);
+
+    memset(hash->displacements, 0, hash->numBuckets * sizeof(guint32));
+
+    for (i = 0; i < hash->size; i++) {
+        hash->slots[i].key = NULL;
+    }
+
+    for (i = 0; i < numBuckets; i++) {
+        bucket = &buckets[i];
+        placed = FALSE;
+
+        for (displacement = 0; displacement < PH_MAX_DISPLACEMENTS && !placed; displacement++) {
+            placed = TRUE;
+
+            /* the slots must be free and different from each other */
+            for (j = 0; j < bucket->count && placed; j++) {
+                slot = ph_slot(sorted[bucket->first + j].hash, displacement, hash->size);
+                slots[j] = slot;
+
+                placed = hash->slots[slot].key == NULL;
+
+                for (k = 0; k < j && placed; k++) {
+                    placed = slots[k] != slot;
+                }
+            }
+        }
+
+        if (!placed)
+            return FALSE;
+
+        hash->displacements[bucket->bucket] = displacement - 1;
+
+        for (j = 0; j < bucket->count; j++) {
+            hash->slots[slots[j]].key = keys[sorted[bucket->first + j].index];
+            hash->slots[slots[j]].length = sorted[bucket->first + j].length;
+            hash->slots[slots[j]].index = sorted[bucket->first + j].index;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Implementations */
+PerfectHash* ph_new(const char* const* keys, unsigned int count) {
+    PerfectHash* hash = NULL;
+    GHashTable* unique = NULL;
+    phKey* sorted = NULL;
+    phBucket* buckets = NULL;
+    unsigned int* slots = NULL;
+    unsigned int i = 0;
+    int built = FALSE;
+
+    g_return_val_if_fail(keys != NULL || count == 0, NULL);
+
+    /* keys with the same hash for every seed can't be told apart */
+    unique = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (i = 0; i < count; i++) {
+        if (!g_hash_table_add(unique, (char*)keys[i])) {
+            g_hash_table_destroy(unique);
+            return NULL;
+        }
+    }
+
+    g_hash_table_destroy(unique);
+
+    hash = g_new(PerfectHash, 1);
+    hash->size = count;
+    hash->numBuckets = count / PH_BUCKET_SIZE + 1;
+    hash->displacements = g_new0(guint32, hash->numBuckets);
+    hash->slots = g_new(phSlot, MAX(count, 1));
+
+    /* an empty hash has one empty slot, so lookups don't need to check the size */
+    hash->slots[0].key = NULL;
+
+    sorted = g_new(phKey, count);
+    buckets = g_new(phBucket, count);
+    slots = g_new(unsigned int, count);
+
+    for (hash->seed = 0; hash->seed < PH_MAX_SEEDS && !built; hash->seed++) {
+        built = count == 0 || ph_build(hash, keys, sorted, buckets, slots);
+    }
+
+    hash->seed--;
+
+    g_free(slots);
+    g_free(buckets);
+    g_free(sorted);
+
+    if (!built) {
+        ph_free(hash);
+        return NULL;
+    }
+
+    return hash;
+}
+
+void ph_free(PerfectHash* hash) {
+    g_return_if_fail(hash != NULL);
+
+    g_free(hash->displacements);
+    g_free(hash->slots);
+    g_free(hash);
+}
+
+unsigned int ph_get_size(PerfectHash* hash) {
+    g_return_val_if_fail(hash != NULL, 0);
+
+    return hash->size;
+}
+
+int ph_lookup(PerfectHash* hash, const char* key) {
+    const phSlot* slot = NULL;
+    guint64 value = 0;
+    size_t length = 0;
+
+    g_return_val_if_fail(hash != NULL, -1);
+    g_return_val_if_fail(key != NULL, -1);
+
+    value = ph_hash(key, hash->seed, &length);
+    slot = &hash->slots[ph_slot(value, hash->displacements[ph_bucket(value, hash->numBuckets)], MAX(hash->size, 1))];
+
+    if (slot->key == NULL || slot->length != length || memcmp(slot->key, key, length) != 0)
+        return -1;
+
+    return (int)slot->index;
+}
@@ -0,0 +1,43 @@
+/*
+ * perfect_hash.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+/* Abstract data type that rapresents a minimal perfect hash of a fixed set of strings:
+ * every string has its own slot, so a lookup hashes the key once and compares it with
+ * a single string. It's built by hash and displace: the strings are split in small
+ * buckets, and every bucket gets the displacement that moves its strings to free slots */
+struct PerfectHash_type;
+typedef struct PerfectHash_type PerfectHash;
+
+/* Builds the hash of the keys, which are not copied and must be valid while it's used.
+ * Returns NULL if the keys are not unique. */
+PerfectHash* ph_new(const char* const* keys, unsigned int count);
+
+/* Free up the hash resources. */
+void ph_free(PerfectHash* hash);
+
+/* Returns the number of keys. */
+unsigned int ph_get_size(PerfectHash* hash);
+
+/* Returns the position of the key in the array given to ph_new(), -1 if it's not found. */
+int ph_lookup(PerfectHash* hash, const char* key);
+
+#endif
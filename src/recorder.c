@@ -0,0 +1,336 @@
+/*
+ * recorder.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+#include "recorder.h"
+#include "definitions.h"
+
+/* The log starts with a header, followed by the records: a timestamp in us and
+ * a package in the wire format. Records are aligned to 8 bytes, like packages */
+#define REC_MAGIC "MHREC\0\0\0"
+#define REC_MAGIC_SIZE 8
+#define REC_VERSION 1
+#define REC_HEADER_SIZE 16
+#define REC_TIMESTAMP_SIZE 8
+
+/* buffer of the log file */
+#define REC_FILE_BUFFER (1024 * 1024)
+
+/* Error messages */
+static const char* _recOpenMsg = "Can't open the record file %s: %s";
+static const char* _recWriteMsg = "Can't write the record file %s: %s";
+static const char* _recCorruptedMsg = "The record file %s is corrupted at offset %lu";
+
+struct Recorder_type {
+    FILE* file;
+    char* path;
+    GMutex lock;                /* it protects the file, the buffer and the descriptors */
+    GHashTable* descriptors;    /* word -> WireDescriptor */
+    GByteArray* buffer;         /* the record being written */
+    gint64 start;               /* monotonic time of rec_start() */
+    gint recorded;
+    gint skipped;
+    gint failed;                /* packages the file didn't take */
+};
+
+static gint64 rec_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The trace callback of the message handler */
+static void record_package(const char* word, const PackageData* data, void* userData) {
+    Recorder* rec = (Recorder*)userData;
+    const WireDescriptor* desc = NULL;
+    guint64 timestamp = 0;
+    Package pkg;
+    size_t size = 0;
+    int written = FALSE;
+
+    g_mutex_lock(&rec->lock);
+
+    desc = g_hash_table_lookup(rec->descriptors, word);
+
+    pkg.name = (char*)word;
+    pkg.size = desc != NULL ? desc->count : 0;
+    pkg.data = (PackageData*)data;
+
+    if (desc == NULL || (size = wire_get_size(&pkg, desc)) == 0) {
+        g_mutex_unlock(&rec->lock);
+
+        g_atomic_int_inc(&rec->skipped);
+        return;
+    }
+
+    /* the timestamp is taken under the lock, so the log is sorted */
+    timestamp = (g_get_monotonic_time() - rec->start);
+
+    g_byte_array_set_size(rec->buffer, REC_TIMESTAMP_SIZE + size);
+    memcpy(rec->buffer->data, &timestamp, REC_TIMESTAMP_SIZE);
+    wire_encode(&pkg, desc, rec->buffer->data + REC_TIMESTAMP_SIZE, size);
+
+    written = fwrite(rec->buffer->data, 1, rec->buffer->len, rec->file) == rec->buffer->len;
+
+    g_mutex_unlock(&rec->lock);
+
+    if (written)
+        g_atomic_int_inc(&rec->recorded);
+    else
+        g_atomic_int_inc(&rec->failed);
+}
+
+static int compare_latencies(const void* a, const void* b) {
+    guint64 first = *(const guint64*)a;
+    guint64 second = *(const guint64*)b;
+
+    return (first > second) - (first < second);
+}
+
+/* Implementations */
+Recorder* rec_new(const char* path) {
+    Recorder* rec = NULL;
+    FILE* file = NULL;
+    guint8 header[REC_HEADER_SIZE];
+    guint32 version = REC_VERSION;
+
+    g_return_val_if_fail(STRING_IS_VALID(path), NULL);
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        g_warning(_recOpenMsg, path, g_strerror(errno));
+        return NULL;
+    }
+
+    rec = g_new(Recorder, 1);
+    rec->file = file;
+    rec->path = g_strdup(path);
+    rec->descriptors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    rec->buffer = g_byte_array_new();
+    rec->start = g_get_monotonic_time();
+    rec->recorded = 0;
+    rec->skipped = 0;
+    rec->failed = 0;
+    g_mutex_init(&rec->lock);
+
+    setvbuf(rec->file, NULL, _IOFBF, REC_FILE_BUFFER);
+
+    memset(header, 0, REC_HEADER_SIZE);
+    memcpy(header, REC_MAGIC, REC_MAGIC_SIZE);
+    memcpy(header + REC_MAGIC_SIZE, &version, sizeof(version));
+
+    if (fwrite(header, 1, REC_HEADER_SIZE, rec->file) != REC_HEADER_SIZE) {
+        g_warning(_recWriteMsg, path, g_strerror(errno));
+        rec_free(rec);
+        return NULL;
+    }
+
+    return rec;
+}
+
+void rec_free(Recorder* rec) {
+    g_return_if_fail(rec != NULL);
+
+    fclose(rec->file);
+
+    g_mutex_clear(&rec->lock);
+    g_hash_table_destroy(rec->descriptors);
+    g_byte_array_free(rec->buffer, TRUE);
+    g_free(rec->path);
+    g_free(rec);
+}
+
+void rec_add_word(Recorder* rec, const char* word, const WireDescriptor* desc) {
+    g_return_if_fail(rec != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(desc != NULL);
+
+    g_mutex_lock(&rec->lock);
+    g_hash_table_insert(rec->descriptors, g_strdup(word), (void*)desc);
+    g_mutex_unlock(&rec->lock);
+}
+
+void rec_start(Recorder* rec, MessageHandler* mh) {
+    g_return_if_fail(rec != NULL);
+    g_return_if_fail(mh != NULL);
+
+    rec->start = g_get_monotonic_time();
+
+    mh_set_trace(mh, record_package, rec);
+}
+
+int rec_stop(Recorder* rec, MessageHandler* mh) {
+    int flushed = FALSE;
+
+    g_return_val_if_fail(rec != NULL, FALSE);
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    mh_set_trace(mh, NULL, NULL);
+
+    g_mutex_lock(&rec->lock);
+    flushed = fflush(rec->file) == 0;
+    g_mutex_unlock(&rec->lock);
+
+    return flushed && g_atomic_int_get(&rec->failed) == 0;
+}
+
+unsigned int rec_get_recorded(Recorder* rec) {
+    g_return_val_if_fail(rec != NULL, 0);
+
+    return g_atomic_int_get(&rec->recorded);
+}
+
+unsigned int rec_get_skipped(Recorder* rec) {
+    g_return_val_if_fail(rec != NULL, 0);
+
+    return g_atomic_int_get(&rec->skipped);
+}
+
+unsigned int rec_get_failed(Recorder* rec) {
+    g_return_val_if_fail(rec != NULL, 0);
+
+    return g_atomic_int_get(&rec->failed);
+}
+
+int rec_replay(const char* path, MessageHandler* mh, int realTime, ReplayStats* stats) {
+    GMappedFile* file = NULL;
+    GError* error = NULL;
+    GArray* latencies = NULL;
+    GArray* data = NULL;
+    const guint8* contents = NULL;
+    guint64 timestamp = 0;
+    guint64 latency = 0;
+    guint64* sorted = NULL;
+    guint32 version = 0;
+    gint64 start = 0;
+    gint64 wait = 0;
+    gint64 begin = 0;
+    Package pkg;
+    Package output;
+    ReplayStats result;
+    unsigned int sizeOutput = 0;
+    size_t size = 0;
+    size_t offset = 0;
+    size_t length = 0;
+    int fields = 0;
+    int valid = TRUE;
+
+    g_return_val_if_fail(STRING_IS_VALID(path), FALSE);
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    file = g_mapped_file_new(path, FALSE, &error);
+    if (file == NULL) {
+        print_error(error);
+        return FALSE;
+    }
+
+    contents = (const guint8*)g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+
+    if (size >= REC_HEADER_SIZE)
+        memcpy(&version, contents + REC_MAGIC_SIZE, sizeof(version));
+
+    if (size < REC_HEADER_SIZE || memcmp(contents, REC_MAGIC, REC_MAGIC_SIZE) != 0 || version != REC_VERSION) {
+        g_warning(_recCorruptedMsg, path, 0UL);
+        g_mapped_file_unref(file);
+        return FALSE;
+    }
+
+    memset(&result, 0, sizeof(ReplayStats));
+    latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+    data = g_array_new(FALSE, FALSE, sizeof(PackageData));
+
+    start = g_get_monotonic_time();
+
+    for (offset = REC_HEADER_SIZE; offset < size; offset += REC_TIMESTAMP_SIZE + length) {
+        fields = -1;
+
+        if (size - offset > REC_TIMESTAMP_SIZE)
+            fields = wire_peek(contents + offset + REC_TIMESTAMP_SIZE, size - offset - REC_TIMESTAMP_SIZE, &length);
+
+        if (fields >= 0) {
+            g_array_set_size(data, fields);
+
+            /* the packages point inside the mapped file */
+            if (wire_decode(contents + offset + REC_TIMESTAMP_SIZE, size - offset - REC_TIMESTAMP_SIZE,
+                            &pkg, (PackageData*)data->data, fields, NULL) == 0)
+                fields = -1;
+        }
+
+        if (fields < 0) {
+            g_warning(_recCorruptedMsg, path, (unsigned long)offset);
+            valid = FALSE;
+            break;
+        }
+
+        if (mh_resolve_word(mh, pkg.name) == MSG_ID_INVALID) {
+            result.skipped++;
+            continue;
+        }
+
+        if (realTime) {
+            memcpy(&timestamp, contents + offset, REC_TIMESTAMP_SIZE);
+            wait = start + (gint64)timestamp - g_get_monotonic_time();
+
+            if (wait > 0)
+                g_usleep(wait);
+        }
+
+        begin = rec_now();
+        mh_send_data(mh, pkg, &output, &sizeOutput);
+        latency = rec_now() - begin;
+
+        mh_release_output(mh, &output);
+
+        g_array_append_val(latencies, latency);
+        result.packages++;
+    }
+
+    result.duration = (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    if (result.duration > 0)
+        result.throughput = result.packages / result.duration;
+
+    if (latencies->len > 0) {
+        sorted = (guint64*)latencies->data;
+        qsort(sorted, latencies->len, sizeof(guint64), compare_latencies);
+
+        result.medianLatency = sorted[latencies->len / 2];
+        result.p99Latency = sorted[(latencies->len * 99ULL) / 100];
+        result.maxLatency = sorted[latencies->len - 1];
+    }
+
+    if (stats != NULL)
+        *stats = result;
+
+    g_array_free(data, TRUE);
+    g_array_free(latencies, TRUE);
+    g_mapped_file_unref(file);
+
+    return valid;
+}
@@ -0,0 +1,73 @@
+/*
+ * recorder.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "messages.h"
+#include "wire.h"
+
+/* Abstract data type that rapresents a traffic recorder. It writes the packages dispatched
+ * by a message handler to a log file, which can be replayed later by rec_replay() */
+struct Recorder_type;
+typedef struct Recorder_type Recorder;
+
+/* The result of a replay */
+typedef struct {
+    unsigned int packages;              /* packages sent to the message handler */
+    unsigned int skipped;               /* packages of words unknown to the message handler */
+    double duration;                    /* in s */
+    double throughput;                  /* packages per second */
+    unsigned long long medianLatency;   /* time spent in mh_send_data(), in ns */
+    unsigned long long p99Latency;
+    unsigned long long maxLatency;
+} ReplayStats;
+
+/* Creates a recorder writing to the file, which is truncated. Returns NULL if it can't be opened. */
+Recorder* rec_new(const char* path);
+
+/* Free up the recorder resources and close the file. It must be stopped. */
+void rec_free(Recorder* rec);
+
+/* It sets the descriptor used to encode the packages of a word. The packages of words without
+ * a descriptor can't be encoded, so they are not recorded. The descriptor must be valid while recording. */
+void rec_add_word(Recorder* rec, const char* word, const WireDescriptor* desc);
+
+/* It starts recording the packages dispatched by the message handler. Timestamps start from 0. */
+void rec_start(Recorder* rec, MessageHandler* mh);
+
+/* It stops recording and it flushes the file. Returns FALSE if some packages couldn't be written. */
+int rec_stop(Recorder* rec, MessageHandler* mh);
+
+/* Returns the number of recorded packages. */
+unsigned int rec_get_recorded(Recorder* rec);
+
+/* Returns the number of packages not recorded, because their word has no descriptor or they don't match it. */
+unsigned int rec_get_skipped(Recorder* rec);
+
+/* Returns the number of packages the file didn't take, because of a write error. Packages still
+ * buffered are written by rec_stop(), which reports their errors. */
+unsigned int rec_get_failed(Recorder* rec);
+
+/* It sends the packages of a log file to the message handler with mh_send_data(), with the original timing
+ * if realTime is TRUE, otherwise as fast as possible. The stats can be NULL.
+ * Returns FALSE if the file can't be read or it's corrupted. */
+int rec_replay(const char* path, MessageHandler* mh, int realTime, ReplayStats* stats);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * ring_buffer.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "ring_buffer.h"
+
+#define RING_CACHE_LINE 64
+
+/* Every cell has a sequence number, which tells producers and consumers
+ * whose turn it is: a cell at position p is free when its sequence is p,
+ * and it's filled when its sequence is p + 1 (D. Vyukov's bounded queue) */
+typedef struct {
+    guint sequence;
+    void* item;
+} ringCell;
+
+/* The positions are on different cache lines, so producers and consumers
+ * don't invalidate each other's line on every operation */
+struct RingBuffer_type {
+    ringCell* cells;
+    guint mask;
+    char padding0[RING_CACHE_LINE];
+    guint enqueuePos;
+    char padding1[RING_CACHE_LINE];
+    guint dequeuePos;
+    char padding2[RING_CACHE_LINE];
+};
+
+/* Implementations */
+RingBuffer* rb_new(unsigned int capacity) {
+    RingBuffer* rb = NULL;
+    guint size = 2;
+    guint i = 0;
+
+    g_return_val_if_fail(capacity > 0 && capacity <= G_MAXINT / 2, NULL);
+
+    while (size < capacity)
+        size <<= 1;
+
+    rb = g_new0(RingBuffer, 1);
+    rb->cells = g_new(ringCell, size);
+    rb->mask = size - 1;
+
+    for (i = 0; i < size; i++) {
+        rb->cells[i].sequence = i;
+        rb->cells[i].item = NULL;
+    }
+
+    return rb;
+}
+
+void rb_free(RingBuffer* rb) {
+    g_return_if_fail(rb != NULL);
+
+    g_free(rb->cells);
+    g_free(rb);
+}
+
+unsigned int rb_get_capacity(RingBuffer* rb) {
+    g_return_val_if_fail(rb != NULL, 0);
+
+    return rb->mask + 1;
+}
+
+unsigned int rb_get_size(RingBuffer* rb) {
+    guint enqueuePos = 0;
+    guint dequeuePos = 0;
+
+    g_return_val_if_fail(rb != NULL, 0);
+
+    dequeuePos = g_atomic_int_get(&rb->dequeuePos);
+    enqueuePos = g_atomic_int_get(&rb->enqueuePos);
+
+    return MIN(enqueuePos - dequeuePos, rb->mask + 1);
+}
+
+int rb_try_push(RingBuffer* rb, void* item) {
+    ringCell* cell = NULL;
+    guint pos = 0;
+    gint diff = 0;
+
+    g_return_val_if_fail(rb != NULL, FALSE);
+
+    pos = g_atomic_int_get(&rb->enqueuePos);
+
+    for (;;) {
+        cell = &rb->cells[pos & rb->mask];
+        diff = (gint)(g_atomic_int_get(&cell->sequence) - pos);
+
+        if (diff == 0) {
+            /* the cell is free: reserve it */
+            if (g_atomic_int_compare_and_exchange(&rb->enqueuePos, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* the cell still holds the item of the previous lap */
+            return FALSE;
+        }
+
+        pos = g_atomic_int_get(&rb->enqueuePos);
+    }
+
+    cell->item = item;
+    g_atomic_int_set(&cell->sequence, pos + 1);
+
+    return TRUE;
+}
+
+int rb_try_pop(RingBuffer* rb, void** item) {
+    ringCell* cell = NULL;
+    guint pos = 0;
+    gint diff = 0;
+
+    g_return_val_if_fail(rb != NULL, FALSE);
+    g_return_val_if_fail(item != NULL, FALSE);
+
+    pos = g_atomic_int_get(&rb->dequeuePos);
+
+    for (;;) {
+        cell = &rb->cells[pos & rb->mask];
+        diff = (gint)(g_atomic_int_get(&cell->sequence) - (pos + 1));
+
+        if (diff == 0) {
+            /* the cell is filled: take it */
+            if (g_atomic_int_compare_and_exchange(&rb->dequeuePos, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* the producer didn't fill the cell yet */
+            return FALSE;
+        }
+
+        pos = g_atomic_int_get(&rb->dequeuePos);
+    }
+
+    *item = cell->item;
+    g_atomic_int_set(&cell->sequence, pos + rb->mask + 1);
+
+    return TRUE;
+}
@@ -0,0 +1,46 @@
+/*
+ * ring_buffer.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+/* Abstract data type that rapresents a bounded lock-free queue of pointers,
+ * with multiple producers and multiple consumers */
+struct RingBuffer_type;
+typedef struct RingBuffer_type RingBuffer;
+
+/* Creates a new ring buffer. The capacity is rounded up to a power of two. */
+RingBuffer* rb_new(unsigned int capacity);
+
+/* Free up the ring buffer resources. The queued items are not freed. */
+void rb_free(RingBuffer* rb);
+
+/* Returns the number of items the ring buffer can contain. */
+unsigned int rb_get_capacity(RingBuffer* rb);
+
+/* Returns the number of queued items. It's only a hint while other threads use the ring buffer. */
+unsigned int rb_get_size(RingBuffer* rb);
+
+/* It queues an item without blocking. Returns FALSE if the ring buffer is full. */
+int rb_try_push(RingBuffer* rb, void* item);
+
+/* It dequeues the oldest item without blocking. Returns FALSE if the ring buffer is empty. */
+int rb_try_pop(RingBuffer* rb, void** item);
+
+#endif
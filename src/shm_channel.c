@@ -0,0 +1,534 @@
+/*
+ * shm_channel.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <glib.h>
+#include "shm_channel.h"
+#include "definitions.h"
+
+#define SHM_CACHE_LINE 64
+#define SHM_HEADER_SIZE 4096
+#define SHM_DEFAULT_TIMEOUT 5000
+
+/* times a reader polls an empty ring before sleeping on the eventfd */
+#define SHM_SPINS 256
+
+/* the child checks if the parent is still alive at this interval, in ms */
+#define SHM_PARENT_CHECK 1000
+
+/* Error messages */
+static const char* _shmCreateMsg = "Can't create the shared memory channel: %s";
+static const char* _shmReplyMsg = "Can't send the output of %s, the parent didn't read the channel in time.";
+
+/* the rings */
+enum {
+    SHM_REQUESTS,       /* parent -> child */
+    SHM_REPLIES,        /* child -> parent */
+    SHM_RINGS
+};
+
+/* the kinds of records */
+enum {
+    SHM_RECORD_WRAP,    /* the ring continues from the beginning */
+    SHM_RECORD_CALL,    /* a package, whose output is sent back */
+    SHM_RECORD_REPLY,   /* the output of a call */
+    SHM_RECORD_QUIT     /* the parent closed the channel */
+};
+
+/* The positions of a single producer, single consumer ring. They are
+ * free running counters, on separate cache lines */
+typedef struct {
+    guint head;                 /* written by the producer */
+    char padding0[SHM_CACHE_LINE - sizeof(guint)];
+    guint tail;                 /* written by the consumer */
+    char padding1[SHM_CACHE_LINE - sizeof(guint)];
+    guint waiting;              /* the consumer sleeps on the eventfd */
+    char padding2[SHM_CACHE_LINE - sizeof(guint)];
+} shmRing;
+
+/* A record of a ring. The payload is a package in the wire format, aligned to 8 bytes */
+typedef struct {
+    guint32 length;             /* the length of the payload */
+    guint32 kind;
+} shmRecord;
+
+/* the header of the shared memory, followed by the rings data */
+typedef struct {
+    shmRing rings[SHM_RINGS];
+} shmHeader;
+
+/* A word of the parent handled by the child */
+typedef struct {
+    ShmChannel* channel;
+    char* word;
+    const WireDescriptor* desc;
+} remoteWord;
+
+struct ShmChannel_type {
+    int memfd;
+    int events[SHM_RINGS];      /* eventfd of every ring, written when the ring gets data */
+    guint8* memory;
+    size_t memorySize;
+    shmHeader* header;
+    guint8* data[SHM_RINGS];
+    guint ringSize;
+
+    pid_t parent;
+    GMutex lock;                /* one call at a time */
+    unsigned int timeout;
+    int broken;
+
+    GHashTable* outputs;        /* word -> WireDescriptor */
+    GPtrArray* remoteWords;
+    GArray* inputData;          /* PackageData of the received package */
+};
+
+#define shm_align(x) (((x) + 7) & ~(guint)7)
+
+static guint record_size(guint length) {
+    return sizeof(shmRecord) + shm_align(length);
+}
+
+/* A record up to half of the ring always fits once the consumer has read the others, wherever the
+ * ring head is, while a bigger one could need the room taken by the wrap record and wait forever */
+static int record_fits(ShmChannel* channel, guint length) {
+    return record_size(length) <= channel->ringSize / 2;
+}
+
+/* it returns the payload of a free record, or NULL if there's no room */
+static guint8* ring_reserve(ShmChannel* channel, int ring, guint length) {
+    shmRing* control = &channel->header->rings[ring];
+    shmRecord* record = NULL;
+    guint head = control->head;
+    guint tail = g_atomic_int_get(&control->tail);
+    guint position = head & (channel->ringSize - 1);
+    guint contiguous = channel->ringSize - position;
+    guint needed = record_size(length);
+
+    /* the record doesn't fit before the end: it starts again from the beginning */
+    if (needed > contiguous)
+        needed += contiguous;
+
+    if (needed > channel->ringSize - (head - tail))
+        return NULL;
+
+    if (needed > record_size(length)) {
+        record = (shmRecord*)(channel->data[ring] + position);
+        record->kind = SHM_RECORD_WRAP;
+        record->length = contiguous - sizeof(shmRecord);
+        position = 0;
+    }
+
+    return channel->data[ring] + position + sizeof(shmRecord);
+}
+
+/* it publishes the reserved record and wakes the consumer up */
+static void ring_commit(ShmChannel* channel, int ring, guint8* payload, guint length, guint kind) {
+    shmRing* control = &channel->header->rings[ring];
+    shmRecord* record = (shmRecord*)(payload - sizeof(shmRecord));
+    guint64 value = 1;
+    guint head = control->head;
+
+    /* a wrap record has been written */
+    if (payload - channel->data[ring] < (gssize)((head & (channel->ringSize - 1)) + sizeof(shmRecord)))
+        head += channel->ringSize - (head & (channel->ringSize - 1));
+
+    record->length = length;
+    record->kind = kind;
+
+    g_atomic_int_set(&control->head, head + record_size(length));
+
+    if (g_atomic_int_get(&control->waiting) && write(channel->events[ring], &value, sizeof(value)) < 0)
+        g_warn_if_reached();
+}
+
+/* it returns the oldest record, or NULL if the ring is empty */
+static shmRecord* ring_peek(ShmChannel* channel, int ring) {
+    shmRing* control = &channel->header->rings[ring];
+    shmRecord* record = NULL;
+
+    while (control->tail != g_atomic_int_get(&control->head)) {
+        record = (shmRecord*)(channel->data[ring] + (control->tail & (channel->ringSize - 1)));
+
+        if (record->kind != SHM_RECORD_WRAP)
+            return record;
+
+        g_atomic_int_set(&control->tail, control->tail + record_size(record->length));
+    }
+
+    return NULL;
+}
+
+static void ring_release(ShmChannel* channel, int ring, shmRecord* record) {
+    shmRing* control = &channel->header->rings[ring];
+
+    g_atomic_int_set(&control->tail, control->tail + record_size(record->length));
+}
+
+/* It waits for a record up to timeout ms, or forever if it's negative. The consumer publishes that
+ * it's going to sleep before checking the ring again, so the producer can't miss it. A wakeup can be
+ * left over from a record already read, then it sleeps again until the deadline. Returns NULL on timeout */
+static shmRecord* ring_wait(ShmChannel* channel, int ring, int timeout) {
+    shmRing* control = &channel->header->rings[ring];
+    shmRecord* record = NULL;
+    struct pollfd fd;
+    guint64 value = 0;
+    gint64 end = g_get_monotonic_time() + (gint64)timeout * 1000;
+    int remaining = timeout;
+    unsigned int spins = 0;
+
+    for (spins = 0; spins < SHM_SPINS; spins++) {
+        if ((record = ring_peek(channel, ring)) != NULL)
+            return record;
+
+        g_thread_yield();
+    }
+
+    fd.fd = channel->events[ring];
+    fd.events = POLLIN;
+
+    g_atomic_int_set(&control->waiting, TRUE);
+
+    while ((record = ring_peek(channel, ring)) == NULL) {
+        if (timeout >= 0) {
+            remaining = (int)((end - g_get_monotonic_time() + 999) / 1000);
+            if (remaining <= 0)
+                break;
+        }
+
+        if (poll(&fd, 1, remaining) > 0 && read(channel->events[ring], &value, sizeof(value)) < 0)
+            g_warn_if_reached();
+    }
+
+    g_atomic_int_set(&control->waiting, FALSE);
+
+    return record;
+}
+
+/* it reserves a record, waiting for the consumer to make room. Returns NULL on timeout */
+static guint8* ring_reserve_wait(ShmChannel* channel, int ring, guint length) {
+    guint8* payload = NULL;
+    gint64 end = g_get_monotonic_time() + (gint64)channel->timeout * 1000;
+
+    while ((payload = ring_reserve(channel, ring, length)) == NULL) {
+        if (g_get_monotonic_time() > end)
+            return NULL;
+
+        g_thread_yield();
+    }
+
+    return payload;
+}
+
+/* The callback of the remote words, on the parent side */
+static void remote_word_callback(const PackageData* data, Package* output, unsigned int* sizeOutput, void* userData) {
+    remoteWord* remote = (remoteWord*)userData;
+    ShmChannel* channel = remote->channel;
+    shmRecord* record = NULL;
+    PackageData* outputData = NULL;
+    guint8* payload = NULL;
+    Package pkg;
+    size_t length = 0;
+    int fields = 0;
+    unsigned int copySize = 0;
+
+    *sizeOutput = 0;
+
+    pkg.name = remote->word;
+    pkg.size = remote->desc->count;
+    pkg.data = (PackageData*)data;
+
+    g_mutex_lock(&channel->lock);
+
+    if (channel->broken)
+        goto unlock;
+
+    /* the package doesn't match the descriptor, or it's too big for the ring */
+    length = wire_get_size(&pkg, remote->desc);
+    if (length == 0 || !record_fits(channel, length))
+        goto unlock;
+
+    /* the package is encoded straight into the shared memory */
+    payload = ring_reserve_wait(channel, SHM_REQUESTS, length);
+    if (payload == NULL) {
+        channel->broken = TRUE;
+        goto unlock;
+    }
+
+    wire_encode(&pkg, remote->desc, payload, length);
+    ring_commit(channel, SHM_REQUESTS, payload, length, SHM_RECORD_CALL);
+
+    record = ring_wait(channel, SHM_REPLIES, channel->timeout);
+    if (record == NULL) {
+        channel->broken = TRUE;
+        goto unlock;
+    }
+
+    /* the reply is copied after the output data, so the ring is free for the next call
+     * and the decoded fields live until the output is released */
+    payload = (guint8*)(record + 1);
+    fields = wire_peek(payload, record->length, NULL);
+
+    if (fields > 0) {
+        copySize = (record->length + sizeof(PackageData) - 1) / sizeof(PackageData);
+        outputData = mh_alloc_output(fields + copySize);
+        memcpy(outputData + fields, payload, record->length);
+
+        if (wire_decode(outputData + fields, record->length, output, outputData, fields, NULL) > 0)
+            *sizeOutput = fields;
+    }
+
+    ring_release(channel, SHM_REPLIES, record);
+
+unlock:
+    g_mutex_unlock(&channel->lock);
+}
+
+static void free_remote_word(void* data) {
+    remoteWord* remote = (remoteWord*)data;
+
+    g_free(remote->word);
+    g_free(remote);
+}
+
+/* it sends back the output of a call */
+static void send_reply(ShmChannel* channel, const char* word, Package* output, unsigned int sizeOutput) {
+    const WireDescriptor* desc = NULL;
+    guint8* payload = NULL;
+    size_t length = 0;
+
+    if (word != NULL)
+        desc = g_hash_table_lookup(channel->outputs, word);
+
+    if (desc != NULL && sizeOutput == desc->count) {
+        if (output->name == NULL)
+            output->name = (char*)word;
+
+        output->size = sizeOutput;
+        length = wire_get_size(output, desc);
+    }
+
+    /* an output too big for the ring is sent back empty */
+    if (!record_fits(channel, length))
+        length = 0;
+
+    payload = ring_reserve_wait(channel, SHM_REPLIES, length);
+    if (payload == NULL) {
+        g_warning(_shmReplyMsg, word != NULL ? word : "an unknown word");
+        return;
+    }
+
+    if (length > 0)
+        wire_encode(output, desc, payload, length);
+
+    ring_commit(channel, SHM_REPLIES, payload, length, SHM_RECORD_REPLY);
+}
+
+/* Implementations */
+ShmChannel* shm_channel_new(size_t size) {
+    ShmChannel* channel = NULL;
+    guint ringSize = 4096;
+    int i = 0;
+
+    g_return_val_if_fail(size > 0 && size <= G_MAXINT / 2, NULL);
+
+    while (ringSize < size)
+        ringSize <<= 1;
+
+    channel = g_new0(ShmChannel, 1);
+    channel->ringSize = ringSize;
+    channel->memorySize = SHM_HEADER_SIZE + (size_t)ringSize * SHM_RINGS;
+    channel->memfd = memfd_create("mh-channel", MFD_CLOEXEC);
+
+    for (i = 0; i < SHM_RINGS; i++) {
+        channel->events[i] = eventfd(0, EFD_CLOEXEC);
+    }
+
+    if (channel->memfd < 0 || channel->events[SHM_REQUESTS] < 0 || channel->events[SHM_REPLIES] < 0 ||
+        ftruncate(channel->memfd, channel->memorySize) < 0) {
+        g_warning(_shmCreateMsg, g_strerror(errno));
+        shm_channel_free(channel);
+        return NULL;
+    }
+
+    channel->memory = mmap(NULL, channel->memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, channel->memfd, 0);
+
+    if (channel->memory == MAP_FAILED) {
+        g_warning(_shmCreateMsg, g_strerror(errno));
+        channel->memory = NULL;
+        shm_channel_free(channel);
+        return NULL;
+    }
+
+    channel->header = (shmHeader*)channel->memory;
+
+    for (i = 0; i < SHM_RINGS; i++) {
+        channel->data[i] = channel->memory + SHM_HEADER_SIZE + (size_t)ringSize * i;
+    }
+
+    channel->parent = getpid();
+    channel->timeout = SHM_DEFAULT_TIMEOUT;
+    g_mutex_init(&channel->lock);
+
+    channel->outputs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    channel->remoteWords = g_ptr_array_new_with_free_func(free_remote_word);
+    channel->inputData = g_array_new(FALSE, FALSE, sizeof(PackageData));
+
+    return channel;
+}
+
+void shm_channel_free(ShmChannel* channel) {
+    int i = 0;
+
+    g_return_if_fail(channel != NULL);
+
+    if (channel->memory != NULL)
+        munmap(channel->memory, channel->memorySize);
+
+    if (channel->memfd >= 0)
+        close(channel->memfd);
+
+    for (i = 0; i < SHM_RINGS; i++) {
+        if (channel->events[i] >= 0)
+            close(channel->events[i]);
+    }
+
+    if (channel->outputs != NULL) {
+        g_mutex_clear(&channel->lock);
+        g_hash_table_destroy(channel->outputs);
+        g_ptr_array_free(channel->remoteWords, TRUE);
+        g_array_free(channel->inputData, TRUE);
+    }
+
+    g_free(channel);
+}
+
+void shm_channel_set_timeout(ShmChannel* channel, unsigned int timeout) {
+    g_return_if_fail(channel != NULL);
+
+    channel->timeout = timeout;
+}
+
+int shm_channel_is_broken(ShmChannel* channel) {
+    int broken = FALSE;
+
+    g_return_val_if_fail(channel != NULL, TRUE);
+
+    g_mutex_lock(&channel->lock);
+    broken = channel->broken;
+    g_mutex_unlock(&channel->lock);
+
+    return broken;
+}
+
+void shm_channel_add_remote_word(ShmChannel* channel, MessageHandler* mh, const char* word, const WireDescriptor* desc) {
+    remoteWord* remote = NULL;
+
+    g_return_if_fail(channel != NULL);
+    g_return_if_fail(mh != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(desc != NULL);
+
+    remote = g_new(remoteWord, 1);
+    remote->channel = channel;
+    remote->word = g_strdup(word);
+    remote->desc = desc;
+
+    g_ptr_array_add(channel->remoteWords, remote);
+
+    mh_add_word_full(mh, word, remote_word_callback, remote);
+}
+
+void shm_channel_close(ShmChannel* channel) {
+    guint8* payload = NULL;
+
+    g_return_if_fail(channel != NULL);
+
+    g_mutex_lock(&channel->lock);
+
+    payload = ring_reserve_wait(channel, SHM_REQUESTS, 0);
+    if (payload != NULL)
+        ring_commit(channel, SHM_REQUESTS, payload, 0, SHM_RECORD_QUIT);
+
+    channel->broken = TRUE;
+
+    g_mutex_unlock(&channel->lock);
+}
+
+void shm_channel_add_output(ShmChannel* channel, const char* word, const WireDescriptor* desc) {
+    g_return_if_fail(channel != NULL);
+    g_return_if_fail(word != NULL);
+    g_return_if_fail(desc != NULL);
+
+    g_hash_table_insert(channel->outputs, g_strdup(word), (void*)desc);
+}
+
+int shm_channel_serve(ShmChannel* channel, MessageHandler* mh) {
+    shmRecord* record = NULL;
+    guint8* payload = NULL;
+    Package pkg;
+    Package output;
+    unsigned int sizeOutput = 0;
+    int fields = 0;
+
+    g_return_val_if_fail(channel != NULL, FALSE);
+    g_return_val_if_fail(mh != NULL, FALSE);
+
+    for (;;) {
+        record = ring_wait(channel, SHM_REQUESTS, SHM_PARENT_CHECK);
+
+        if (record == NULL) {
+            if (getppid() != channel->parent)
+                return FALSE;
+
+            continue;
+        }
+
+        if (record->kind == SHM_RECORD_QUIT) {
+            ring_release(channel, SHM_REQUESTS, record);
+            return TRUE;
+        }
+
+        /* the package is decoded where it is */
+        payload = (guint8*)(record + 1);
+        fields = wire_peek(payload, record->length, NULL);
+        sizeOutput = 0;
+        pkg.name = NULL;
+        memset(&output, 0, sizeof(Package));
+
+        if (fields >= 0) {
+            g_array_set_size(channel->inputData, fields);
+
+            if (wire_decode(payload, record->length, &pkg, (PackageData*)channel->inputData->data, fields, NULL) > 0)
+                mh_send_data(mh, pkg, &output, &sizeOutput);
+        }
+
+        send_reply(channel, pkg.name, &output, sizeOutput);
+        mh_release_output(mh, &output);
+
+        ring_release(channel, SHM_REQUESTS, record);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * shm_channel.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <stddef.h>
+#include "messages.h"
+#include "wire.h"
+
+/* Abstract data type that rapresents a channel between two processes, made of two rings
+ * in a shared memory (memfd) with eventfd wakeups. The channel is created before forking:
+ * the parent sends packages to words handled by the child, which serves them. */
+struct ShmChannel_type;
+typedef struct ShmChannel_type ShmChannel;
+
+/* Creates a new channel, with rings of the given size in bytes. An encoded package or output must fit in
+ * half of a ring, otherwise the call returns an empty output. Returns NULL on error. */
+ShmChannel* shm_channel_new(size_t size);
+
+/* Free up the channel resources. */
+void shm_channel_free(ShmChannel* channel);
+
+/* It sets how long the parent waits for the child, in ms. Default is 5000 ms. */
+void shm_channel_set_timeout(ShmChannel* channel, unsigned int timeout);
+
+/* Returns TRUE if the child didn't answer in time. Then, the remote words don't send data anymore. */
+int shm_channel_is_broken(ShmChannel* channel);
+
+/* Parent side. It adds a word to the message handler, whose packages are encoded with the
+ * descriptor and handled by the child. The output is copied out of the shared memory, and its
+ * strings and blobs are valid until it's released like any other output. The descriptor must be
+ * valid while the word is used. */
+void shm_channel_add_remote_word(ShmChannel* channel, MessageHandler* mh, const char* word, const WireDescriptor* desc);
+
+/* Parent side. It stops the child, which returns from shm_channel_serve(). */
+void shm_channel_close(ShmChannel* channel);
+
+/* Child side. It sets the descriptor used to send back the output of a word. Outputs of words
+ * without descriptor are sent back empty. The descriptor must be valid while serving. */
+void shm_channel_add_output(ShmChannel* channel, const char* word, const WireDescriptor* desc);
+
+/* Child side. It sends the packages received on the channel to the message handler, without
+ * copying them, until the parent closes the channel or it exits. Returns FALSE if the parent exited. */
+int shm_channel_serve(ShmChannel* channel, MessageHandler* mh);
+
+#endif
@@ -17,12 +17,23 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "data.h"
 #include "messages.h"
 #include "localization.h"
+#include "localization_ids.h"
 #include "engine.h"
 #include "config.h"
+#include "ini.h"
+#include "ring_buffer.h"
+#include "perfect_hash.h"
+#include "wire.h"
+#include "shm_channel.h"
+#include "recorder.h"
 #include "definitions.h"
 #include "ui/test_window.h"
 
@@ -30,7 +41,7 @@
  * Messages test functions
  ****************************/
 void callback0(const PackageData *data, Package *output, unsigned int *sizeOutput) {
-	PackageData outdata[2];
+	PackageData* outdata = mh_alloc_output(2);
 	outdata[0].field = GINT_TO_POINTER(1);
 	outdata[1].field = GINT_TO_POINTER(2);
 	
@@ -44,7 +55,7 @@ void callback0(const PackageData *data, Package *output, unsigned int *sizeOutpu
 }
 
 void callback1(const PackageData *data, Package *output, unsigned int *sizeOutput) {
-	PackageData outdata[2];
+	PackageData* outdata = mh_alloc_output(2);
 	outdata[0].field = GINT_TO_POINTER(1);
 	outdata[1].field = GINT_TO_POINTER(2);
 	
@@ -102,18 +113,1881 @@ void test_messages(void) {
 	for (i = 0; i < 2; i++) {
 		mh_send_data(mh, pkg[i], &output, &outSize);
 
+		g_assert(outSize == 2);
+
 		g_print("Output data: name = %s, size = %i" 
 		         ", output size = %i", 
 		         output.name, output.size, outSize); 
 
-		for (j = 0; j < outSize; j++) {
-			g_print(", output[%zu] = %i", j, GPOINTER_TO_INT(output.data[j].field));
+		for (j = 0; j < outSize; j++) {
+			g_print(", output[%zu] = %i", j, GPOINTER_TO_INT(output.data[j].field));
+		}
+
+		g_print("\n\n\r");
+
+		mh_release_output(mh, &output);
+		g_assert(output.data == NULL);
+	}
+
+	/* resolve the words once and send them by identifier */
+	g_print("Send packets by identifier..\n\n\r");
+
+	g_assert(mh_resolve_word(mh, "MOVE0") == 0);
+	g_assert(mh_resolve_word(mh, "MOVE1") == 1);
+	g_assert(mh_resolve_word(mh, "MOVE2") == MSG_ID_INVALID);
+
+	for (i = 0; i < 2; i++) {
+		outSize = 0;
+		mh_send_id(mh, mh_resolve_word(mh, pkg[i].name), pkg[i], &output, &outSize);
+
+		g_assert(outSize == 2);
+		g_assert(g_strcmp0(output.name, i == 0 ? "OUTPUT0" : "OUTPUT1") == 0);
+		g_assert(GPOINTER_TO_INT(output.data[1].field) == 2);
+
+		mh_release_output(mh, &output);
+	}
+
+	/* a word added twice keeps its identifier */
+	mh_add_word(mh, "MOVE0", callback1);
+	g_assert(mh_resolve_word(mh, "MOVE0") == 0);
+
+	mh_send_id(mh, 0, pkg[0], &output, &outSize);
+	g_assert(g_strcmp0(output.name, "OUTPUT1") == 0);
+
+	mh_release_output(mh, &output);
+
+	outSize = 0;
+	mh_send_id(mh, MSG_ID_INVALID, pkg[0], &output, &outSize);
+	g_assert(outSize == 0);
+
+    mh_free(mh);
+}
+
+static gint _postRunning = 0;
+static gint _postMaxRunning = 0;
+static gint _postCalls = 0;
+
+/* it records how many callbacks run at the same time */
+void post_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	gint running = 0;
+	gint max = 0;
+	gint64 end = g_get_monotonic_time() + G_USEC_PER_SEC;
+
+	running = g_atomic_int_add(&_postRunning, 1) + 1;
+
+	do {
+		max = g_atomic_int_get(&_postMaxRunning);
+	} while (running > max && !g_atomic_int_compare_and_exchange(&_postMaxRunning, max, running));
+
+	/* give the other workers the chance to run the same word */
+	while (GPOINTER_TO_INT(data->field) > 1 && g_atomic_int_get(&_postMaxRunning) < GPOINTER_TO_INT(data->field)
+		&& g_get_monotonic_time() < end) {
+		g_thread_yield();
+	}
+
+	g_atomic_int_add(&_postRunning, -1);
+	g_atomic_int_inc(&_postCalls);
+
+	output->name = "POSTED";
+	output->size = 0;
+	output->data = NULL;
+
+	*sizeOutput = 1;
+}
+
+void post_done_callback(const Package *output, unsigned int sizeOutput, void* userData) {
+	g_assert(sizeOutput == 1);
+	g_assert(g_strcmp0(output->name, "POSTED") == 0);
+
+	g_atomic_int_inc((gint*)userData);
+}
+
+#define SEQUENCE_MESSAGES 20000
+
+static PackageData _sequenceData[SEQUENCE_MESSAGES];
+static gint _sequenceNext = 0;
+static gint _sequenceErrors = 0;
+
+/* the messages of a serial word carry their post order */
+void sequence_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	gint sequence = GPOINTER_TO_INT(data->field);
+
+	if (sequence != g_atomic_int_get(&_sequenceNext))
+		g_atomic_int_inc(&_sequenceErrors);
+
+	g_atomic_int_set(&_sequenceNext, sequence + 1);
+
+	*sizeOutput = 0;
+}
+
+void test_messages_post(void) {
+	const unsigned int NUM_OF_MESSAGES = 100;
+	const unsigned int NUM_OF_WORKERS = 4;
+	MessageFuture* futures[4];
+	PackageData data;
+	Package pkg;
+	Package output;
+	unsigned int outSize = 0;
+	gint done = 0;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_set_workers(mh, NUM_OF_WORKERS);
+	g_assert(mh_get_workers(mh) == NUM_OF_WORKERS);
+
+	mh_add_word(mh, "REENTRANT", post_callback);
+	mh_add_word(mh, "SERIAL", post_callback);
+	mh_set_word_mode(mh, "SERIAL", MSG_WORD_SERIAL);
+
+	/* unknown words are not posted */
+	pkg.name = "UNKNOWN";
+	pkg.size = 1;
+	pkg.data = &data;
+
+	g_assert(mh_post(mh, pkg) == NULL);
+
+	/* reentrant messages run in parallel on the workers */
+	g_print("Post reentrant messages..\n\r");
+
+	data.field = GINT_TO_POINTER(NUM_OF_WORKERS);
+	pkg.name = "REENTRANT";
+
+	for (i = 0; i < NUM_OF_WORKERS; i++) {
+		futures[i] = mh_post(mh, pkg);
+		g_assert(futures[i] != NULL);
+	}
+
+	for (i = 0; i < NUM_OF_WORKERS; i++) {
+		outSize = 0;
+		mh_future_wait(futures[i], &output, &outSize);
+
+		g_assert(mh_future_is_done(futures[i]));
+		g_assert(outSize == 1);
+		g_assert(g_strcmp0(output.name, "POSTED") == 0);
+
+		mh_future_free(futures[i]);
+	}
+
+	g_assert(g_atomic_int_get(&_postMaxRunning) == NUM_OF_WORKERS);
+
+	/* serial messages never run at the same time */
+	g_print("Post serial messages..\n\r");
+
+	g_atomic_int_set(&_postMaxRunning, 0);
+	g_atomic_int_set(&_postCalls, 0);
+
+	data.field = GINT_TO_POINTER(1);
+	pkg.name = "SERIAL";
+
+	for (i = 0; i < NUM_OF_MESSAGES; i++) {
+		g_assert(mh_post_with_callback(mh, pkg, post_done_callback, &done));
+	}
+
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_postCalls) == NUM_OF_MESSAGES);
+	g_assert(g_atomic_int_get(&done) == NUM_OF_MESSAGES);
+	g_assert(g_atomic_int_get(&_postMaxRunning) == 1);
+
+	/* serial messages run in post order, whatever worker takes them */
+	g_print("Post serial messages in order..\n\r");
+
+	mh_set_workers(mh, 8);
+	mh_add_word(mh, "SEQUENCE", sequence_callback);
+	mh_set_word_mode(mh, "SEQUENCE", MSG_WORD_SERIAL);
+
+	pkg.name = "SEQUENCE";
+
+	for (i = 0; i < SEQUENCE_MESSAGES; i++) {
+		_sequenceData[i].field = GINT_TO_POINTER(i);
+		pkg.data = &_sequenceData[i];
+
+		g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 0, NULL, NULL));
+	}
+
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_sequenceNext) == SEQUENCE_MESSAGES);
+	g_assert(g_atomic_int_get(&_sequenceErrors) == 0);
+
+	pkg.name = "SERIAL";
+	pkg.data = &data;
+
+	/* the pool is resized and restarted on the next post */
+	mh_set_workers(mh, 1);
+	g_assert(mh_post_with_callback(mh, pkg, post_done_callback, &done));
+
+	mh_free(mh);
+
+	g_assert(g_atomic_int_get(&done) == NUM_OF_MESSAGES + 1);
+}
+
+static gint _queueGate = 0;
+static gint _queueRunning = 0;
+
+/* it keeps the worker busy until the gate is opened */
+void queue_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	g_atomic_int_set(&_queueRunning, 1);
+
+	while (!g_atomic_int_get(&_queueGate)) {
+		g_thread_yield();
+	}
+
+	*sizeOutput = 0;
+}
+
+/* it posts a message that keeps the only worker busy */
+static void queue_block_worker(MessageHandler* mh, Package pkg) {
+	g_atomic_int_set(&_queueGate, 0);
+	g_atomic_int_set(&_queueRunning, 0);
+
+	g_assert(mh_try_post(mh, pkg, NULL, NULL));
+
+	while (!g_atomic_int_get(&_queueRunning)) {
+		g_thread_yield();
+	}
+}
+
+void test_messages_queue(void) {
+	MessageFuture* futures[3];
+	Package pkg;
+	Package output;
+	unsigned int outSize = 0;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "WAIT", queue_callback);
+	mh_set_workers(mh, 1);
+
+	pkg.name = "WAIT";
+	pkg.size = 0;
+	pkg.data = NULL;
+
+	/* a full queue blocks mh_post(), but not mh_try_post() */
+	g_print("\n\rFill the queue..\n\r");
+
+	mh_set_queue(mh, 2, MSG_QUEUE_BLOCK);
+	g_assert(mh_get_queue_size(mh) == 2);
+
+	queue_block_worker(mh, pkg);
+
+	g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	g_assert(!mh_try_post(mh, pkg, NULL, NULL));
+	g_assert(mh_get_dropped(mh) == 1);
+
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	/* the rejected message is not posted */
+	g_print("Reject messages..\n\r");
+
+	mh_set_queue(mh, 2, MSG_QUEUE_REJECT);
+	queue_block_worker(mh, pkg);
+
+	for (i = 0; i < 3; i++) {
+		futures[i] = mh_post(mh, pkg);
+	}
+
+	g_assert(futures[0] != NULL && futures[1] != NULL);
+	g_assert(futures[2] == NULL);
+	g_assert(mh_get_dropped(mh) == 2);
+
+	g_atomic_int_set(&_queueGate, 1);
+
+	for (i = 0; i < 2; i++) {
+		g_assert(mh_future_wait(futures[i], &output, &outSize));
+		mh_future_free(futures[i]);
+	}
+
+	/* the oldest message makes room for the new one */
+	g_print("Drop the oldest messages..\n\r");
+
+	mh_set_queue(mh, 2, MSG_QUEUE_DROP_OLDEST);
+	queue_block_worker(mh, pkg);
+
+	for (i = 0; i < 3; i++) {
+		futures[i] = mh_post(mh, pkg);
+		g_assert(futures[i] != NULL);
+	}
+
+	g_assert(mh_future_is_done(futures[0]));
+	g_assert(mh_get_dropped(mh) == 3);
+
+	g_atomic_int_set(&_queueGate, 1);
+
+	g_assert(!mh_future_wait(futures[0], &output, &outSize));
+	g_assert(mh_future_wait(futures[1], &output, &outSize));
+	g_assert(mh_future_wait(futures[2], &output, &outSize));
+
+	for (i = 0; i < 3; i++) {
+		mh_future_free(futures[i]);
+	}
+
+	mh_free(mh);
+}
+
+#define PRIORITY_MESSAGES 30
+
+static gint _priorityOrder[PRIORITY_MESSAGES * 2];
+static gint _priorityCount = 0;
+
+/* it records the order of the messages, by their priority */
+void priority_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	_priorityOrder[g_atomic_int_add(&_priorityCount, 1)] = GPOINTER_TO_INT(data[0].field);
+
+	*sizeOutput = 0;
+}
+
+void slow_priority_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	g_usleep(50000);
+
+	*sizeOutput = 0;
+}
+
+/* it counts the dropped messages */
+void priority_done_callback(const Package *output, unsigned int sizeOutput, void* userData) {
+	if (output == NULL)
+		g_atomic_int_inc((gint*)userData);
+}
+
+void test_messages_priority(void) {
+	PackageData deadlines[4];
+	PackageData low;
+	PackageData high;
+	PackageData critical;
+	Package pkg;
+	gint dropped = 0;
+	unsigned int size = 0;
+	unsigned int i = 0;
+	int firstLow = -1;
+	MessageStats* stats = NULL;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "WAIT", queue_callback);
+	mh_add_word(mh, "TELEMETRY", priority_callback);
+	mh_add_word(mh, "STOP", priority_callback);
+	mh_add_word(mh, "SLOW", slow_priority_callback);
+	mh_set_workers(mh, 1);
+
+	mh_set_word_priority(mh, "TELEMETRY", MSG_PRIORITY_LOW, 0);
+	mh_set_word_priority(mh, "STOP", MSG_PRIORITY_CRITICAL, 0);
+
+	low.field = GINT_TO_POINTER(MSG_PRIORITY_LOW);
+	high.field = GINT_TO_POINTER(MSG_PRIORITY_HIGH);
+	critical.field = GINT_TO_POINTER(MSG_PRIORITY_CRITICAL);
+
+	pkg.name = "WAIT";
+	pkg.size = 1;
+
+	/* the critical message overtakes the queued ones */
+	g_print("\n\rPost a critical message after a flood..\n\r");
+
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "TELEMETRY";
+	pkg.data = &low;
+
+	for (i = 0; i < PRIORITY_MESSAGES; i++) {
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	pkg.name = "STOP";
+	pkg.data = &critical;
+	g_assert(mh_try_post(mh, pkg, NULL, NULL));
+
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_priorityCount) == PRIORITY_MESSAGES + 1);
+	g_assert(_priorityOrder[0] == MSG_PRIORITY_CRITICAL);
+
+	/* low priority messages are not starved by higher priority ones */
+	g_print("Post low priority messages during a flood..\n\r");
+
+	g_atomic_int_set(&_priorityCount, 0);
+
+	pkg.name = "WAIT";
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "TELEMETRY";
+
+	for (i = 0; i < PRIORITY_MESSAGES; i++) {
+		pkg.data = &low;
+		g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_LOW, 0, NULL, NULL));
+
+		pkg.data = &high;
+		g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_HIGH, 0, NULL, NULL));
+	}
+
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	for (i = 0; i < PRIORITY_MESSAGES * 2 && firstLow < 0; i++) {
+		if (_priorityOrder[i] == MSG_PRIORITY_LOW)
+			firstLow = i;
+	}
+
+	g_assert(firstLow >= 0 && firstLow < PRIORITY_MESSAGES);
+
+	/* within a priority, the earliest deadline runs first, then the messages without one */
+	g_print("Post messages with deadlines..\n\r");
+
+	g_atomic_int_set(&_priorityCount, 0);
+
+	pkg.name = "WAIT";
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "TELEMETRY";
+
+	for (i = 0; i < 4; i++) {
+		deadlines[i].field = GINT_TO_POINTER(i);
+	}
+
+	pkg.data = &deadlines[0];
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 0, NULL, NULL));
+	pkg.data = &deadlines[3];
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 4000000, NULL, NULL));
+	pkg.data = &deadlines[1];
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 2000000, NULL, NULL));
+	pkg.data = &deadlines[2];
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 3000000, NULL, NULL));
+
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_priorityCount) == 4);
+	g_assert(_priorityOrder[0] == 1 && _priorityOrder[1] == 2 && _priorityOrder[2] == 3 && _priorityOrder[3] == 0);
+	g_assert(mh_get_missed_deadlines(mh) == 0);
+
+	/* expired messages run late, and they are counted */
+	g_print("Miss deadlines..\n\r");
+
+	g_atomic_int_set(&_priorityCount, 0);
+
+	pkg.name = "WAIT";
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "TELEMETRY";
+	pkg.data = &low;
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 1000, priority_done_callback, &dropped));
+
+	g_usleep(10000);
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_priorityCount) == 1);
+	g_assert(g_atomic_int_get(&dropped) == 0);
+	g_assert(mh_get_missed_deadlines(mh) == 1);
+
+	/* the word can drop them instead */
+	mh_set_word_deadline_policy(mh, "TELEMETRY", MSG_DEADLINE_DROP);
+
+	g_atomic_int_set(&_priorityCount, 0);
+
+	pkg.name = "WAIT";
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "TELEMETRY";
+	g_assert(mh_post_with_priority(mh, pkg, MSG_PRIORITY_NORMAL, 1000, priority_done_callback, &dropped));
+
+	g_usleep(10000);
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_priorityCount) == 0);
+	g_assert(g_atomic_int_get(&dropped) == 1);
+	g_assert(mh_get_missed_deadlines(mh) == 2);
+
+	mh_set_word_priority(mh, "SLOW", MSG_PRIORITY_HIGH, 20000);
+
+	pkg.name = "SLOW";
+	g_assert(mh_post_with_callback(mh, pkg, priority_done_callback, &dropped));
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&dropped) == 1);
+	g_assert(mh_get_missed_deadlines(mh) == 3);
+
+	stats = mh_get_stats(mh, &size);
+	g_assert(stats[1].missedDeadlines == 2 && stats[3].missedDeadlines == 1);
+	g_free(stats);
+
+	mh_free(mh);
+}
+
+static gint _coalesceCalls = 0;
+static gint _coalesceValue = 0;
+
+void coalesce_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	g_atomic_int_inc(&_coalesceCalls);
+	g_atomic_int_set(&_coalesceValue, GPOINTER_TO_INT(data[0].field));
+
+	*sizeOutput = 0;
+}
+
+#define COALESCE_MESSAGES 2000
+
+static PackageData _coalesceData[COALESCE_MESSAGES];
+static gint _coalesceRunning = 0;
+static gint _coalesceMaxRunning = 0;
+static gint _coalesceErrors = 0;
+
+/* the values of a coalescing word only grow, one callback at a time */
+void coalesce_order_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	gint value = GPOINTER_TO_INT(data[0].field);
+	gint running = g_atomic_int_add(&_coalesceRunning, 1) + 1;
+
+	if (running > g_atomic_int_get(&_coalesceMaxRunning))
+		g_atomic_int_set(&_coalesceMaxRunning, running);
+
+	if (value <= g_atomic_int_get(&_coalesceValue))
+		g_atomic_int_inc(&_coalesceErrors);
+
+	g_usleep(50);
+	g_atomic_int_set(&_coalesceValue, value);
+
+	g_atomic_int_add(&_coalesceRunning, -1);
+	*sizeOutput = 0;
+}
+
+void test_messages_coalesce(void) {
+	PackageData values[100];
+	Package pkg;
+	gint dropped = 0;
+	gint64 end = 0;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "WAIT", queue_callback);
+	mh_add_word(mh, "POSITION", coalesce_callback);
+	mh_set_workers(mh, 1);
+
+	for (i = 0; i < 100; i++) {
+		values[i].field = GINT_TO_POINTER(i);
+	}
+
+	pkg.name = "WAIT";
+	pkg.size = 1;
+
+	/* only the latest value is handled */
+	g_print("\n\rCoalesce the pending messages..\n\r");
+
+	mh_set_word_coalescing(mh, "POSITION", TRUE, 0);
+	queue_block_worker(mh, pkg);
+
+	pkg.name = "POSITION";
+
+	for (i = 0; i < 100; i++) {
+		pkg.data = &values[i];
+		g_assert(mh_post_with_callback(mh, pkg, priority_done_callback, &dropped));
+	}
+
+	g_atomic_int_set(&_queueGate, 1);
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_coalesceCalls) == 1);
+	g_assert(g_atomic_int_get(&_coalesceValue) == 99);
+	g_assert(g_atomic_int_get(&dropped) == 99);
+	g_assert(mh_get_coalesced(mh) == 99);
+
+	/* the callback runs at most once per interval */
+	g_print("Limit the rate of the callback..\n\r");
+
+	g_atomic_int_set(&_coalesceCalls, 0);
+	mh_set_word_coalescing(mh, "POSITION", TRUE, 20000);
+
+	end = g_get_monotonic_time() + 100000;
+
+	for (i = 0; g_get_monotonic_time() < end; i = (i + 1) % 100) {
+		pkg.data = &values[i];
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+
+		g_usleep(500);
+	}
+
+	pkg.data = &values[42];
+	g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_coalesceCalls) >= 2 && g_atomic_int_get(&_coalesceCalls) <= 7);
+	g_assert(g_atomic_int_get(&_coalesceValue) == 42);
+
+	/* on several workers, the callback runs one message at a time and the latest value runs last */
+	g_print("Coalesce on several workers..\n\r");
+
+	mh_set_workers(mh, 4);
+	mh_add_word(mh, "VELOCITY", coalesce_order_callback);
+	mh_set_word_coalescing(mh, "VELOCITY", TRUE, 0);
+
+	g_atomic_int_set(&_coalesceValue, 0);
+	pkg.name = "VELOCITY";
+
+	for (i = 0; i < COALESCE_MESSAGES; i++) {
+		_coalesceData[i].field = GINT_TO_POINTER(i + 1);
+		pkg.data = &_coalesceData[i];
+
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+
+		/* the posts overlap the running callbacks */
+		if (i % 4 == 0)
+			g_usleep(20);
+	}
+
+	mh_flush(mh);
+
+	g_assert(g_atomic_int_get(&_coalesceMaxRunning) == 1);
+	g_assert(g_atomic_int_get(&_coalesceErrors) == 0);
+	g_assert(g_atomic_int_get(&_coalesceValue) == COALESCE_MESSAGES);
+
+	pkg.name = "POSITION";
+
+	/* without coalescing, every message is handled */
+	mh_set_word_coalescing(mh, "POSITION", FALSE, 0);
+	g_atomic_int_set(&_coalesceCalls, 0);
+
+	for (i = 0; i < 100; i++) {
+		pkg.data = &values[i];
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	mh_flush(mh);
+	g_assert(g_atomic_int_get(&_coalesceCalls) == 100);
+
+	mh_free(mh);
+}
+
+#define MAILBOX_MESSAGES 50
+
+/* The private state of a module, used without locks by its callbacks */
+typedef struct {
+	gint running;
+	gint maxRunning;
+	unsigned int calls;
+	unsigned int outOfOrder;
+} mailboxModule;
+
+/* the module and the post order of every message */
+static PackageData _mailboxData[MAILBOX_MESSAGES * 4][2];
+
+static mailboxModule _mailboxModules[2];
+static gint _mailboxRunning = 0;
+static gint _mailboxMaxRunning = 0;
+
+static void mailbox_update_max(gint* max, gint value) {
+	gint old = 0;
+
+	while ((old = g_atomic_int_get(max)) < value && !g_atomic_int_compare_and_exchange(max, old, value));
+}
+
+static void mailbox_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	mailboxModule* module = &_mailboxModules[GPOINTER_TO_INT(data[0].field)];
+	unsigned int calls = module->calls;
+
+	mailbox_update_max(&module->maxRunning, g_atomic_int_add(&module->running, 1) + 1);
+	mailbox_update_max(&_mailboxMaxRunning, g_atomic_int_add(&_mailboxRunning, 1) + 1);
+
+	/* the messages of a module run in the order they have been posted */
+	if (GPOINTER_TO_UINT(data[1].field) != calls)
+		module->outOfOrder++;
+
+	/* a lost update would show up if the callbacks of a module overlapped */
+	g_usleep(200);
+	module->calls = calls + 1;
+
+	g_atomic_int_add(&_mailboxRunning, -1);
+	g_atomic_int_add(&module->running, -1);
+
+	*sizeOutput = 0;
+}
+
+void test_messages_mailbox(void) {
+	const char* words[] = { "AXIS.MOVE", "AXIS.STOP", "IO.READ", "IO.WRITE" };
+	MessageMailbox* mailboxes[2];
+	PackageData* data = NULL;
+	Package pkg;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_set_workers(mh, 4);
+
+	mailboxes[0] = mh_mailbox_new(mh, "axis");
+	mailboxes[1] = mh_mailbox_new(mh, "io");
+	g_assert(g_str_equal(mh_mailbox_get_name(mailboxes[1]), "io"));
+
+	/* two words per module */
+	for (i = 0; i < 4; i++) {
+		mh_add_word(mh, words[i], mailbox_callback);
+		mh_set_word_mailbox(mh, words[i], mailboxes[i / 2]);
+	}
+
+	memset(_mailboxModules, 0, sizeof(_mailboxModules));
+
+	pkg.size = 2;
+
+	/* the callbacks of a module never overlap, different modules run in parallel */
+	g_print("\n\rPost messages to the mailboxes..\n\r");
+
+	for (i = 0; i < MAILBOX_MESSAGES; i++) {
+		for (j = 0; j < 4; j++) {
+			data = _mailboxData[i * 4 + j];
+			data[0].field = GINT_TO_POINTER(j / 2);
+			data[1].field = GUINT_TO_POINTER(i * 2 + j % 2);
+
+			pkg.name = (char*)words[j];
+			pkg.data = data;
+
+			g_assert(mh_try_post(mh, pkg, NULL, NULL));
+		}
+	}
+
+	mh_flush(mh);
+
+	for (i = 0; i < 2; i++) {
+		g_assert(_mailboxModules[i].calls == MAILBOX_MESSAGES * 2);
+		g_assert(_mailboxModules[i].outOfOrder == 0);
+		g_assert(g_atomic_int_get(&_mailboxModules[i].maxRunning) == 1);
+	}
+
+	g_assert(g_atomic_int_get(&_mailboxMaxRunning) == 2);
+
+	/* out of the mailbox, the messages of a word run in parallel */
+	mh_set_word_mailbox(mh, "AXIS.MOVE", NULL);
+
+	mh_free(mh);
+}
+
+static GThread* _sourceThread = NULL;
+static gint _sourceCalls = 0;
+static gint _sourceDropped = 0;
+
+static void source_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	/* the callbacks run on the main loop thread */
+	g_assert(g_thread_self() == _sourceThread);
+
+	if (data != NULL && data[0].field != NULL)
+		g_usleep(GPOINTER_TO_INT(data[0].field));
+
+	g_atomic_int_inc(&_sourceCalls);
+	*sizeOutput = 0;
+}
+
+static void source_done(const Package* output, unsigned int sizeOutput, void* userData) {
+	if (output == NULL)
+		g_atomic_int_inc(&_sourceDropped);
+}
+
+static void* source_producer(void* data) {
+	/* the data must be valid until the messages have been processed */
+	static PackageData pkgData[1] = { { NULL } };
+	MessageHandler* mh = (MessageHandler*)data;
+	Package pkg;
+	int i = 0;
+
+	pkg.name = "UI.UPDATE";
+	pkg.size = 1;
+	pkg.data = pkgData;
+
+	for (i = 0; i < 100; i++) {
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	return NULL;
+}
+
+void test_messages_source(void) {
+	MessageHandler* mh = NULL;
+	GMainContext* context = NULL;
+	GSource* source = NULL;
+	GThread* producer = NULL;
+	PackageData data[1];
+	Package pkg;
+	int i = 0;
+
+	_sourceThread = g_thread_self();
+
+	mh = mh_new();
+	mh_add_word(mh, "UI.UPDATE", source_callback);
+
+	context = g_main_context_new();
+	source = mh_source_new(mh, 0);
+	g_source_attach(source, context);
+
+	mh_set_word_source(mh, "UI.UPDATE", source);
+
+	data[0].field = NULL;
+
+	pkg.name = "UI.UPDATE";
+	pkg.size = 1;
+	pkg.data = data;
+
+	/* the queued messages run in a single iteration */
+	g_print("\n\rRun the messages on the main loop..\n\r");
+
+	for (i = 0; i < 100; i++) {
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	g_assert(g_atomic_int_get(&_sourceCalls) == 0);
+	g_assert(g_main_context_iteration(context, FALSE));
+	g_assert(g_atomic_int_get(&_sourceCalls) == 100);
+	g_assert(!g_main_context_iteration(context, FALSE));
+
+	/* a producer thread wakes the main loop up */
+	g_print("Post from another thread..\n\r");
+
+	producer = g_thread_new("producer", source_producer, mh);
+
+	while (g_atomic_int_get(&_sourceCalls) < 200) {
+		g_main_context_iteration(context, TRUE);
+	}
+
+	g_thread_join(producer);
+	mh_flush(mh);
+
+	/* an iteration lasts about the budget */
+	g_print("Spend the budget..\n\r");
+
+	mh_source_set_budget(source, 1000);
+	data[0].field = GINT_TO_POINTER(2000);
+
+	for (i = 0; i < 3; i++) {
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	for (i = 1; i <= 3; i++) {
+		g_assert(g_main_context_iteration(context, FALSE));
+		g_assert(g_atomic_int_get(&_sourceCalls) == 200 + i);
+	}
+
+	/* a flush on the main loop thread runs the queued messages itself */
+	g_print("Flush on the main loop thread..\n\r");
+
+	data[0].field = NULL;
+
+	for (i = 0; i < 5; i++) {
+		g_assert(mh_try_post(mh, pkg, NULL, NULL));
+	}
+
+	mh_flush(mh);
+	g_assert(g_atomic_int_get(&_sourceCalls) == 208);
+
+	/* the messages left are dropped with the handler */
+
+	for (i = 0; i < 10; i++) {
+		g_assert(mh_post_with_callback(mh, pkg, source_done, NULL));
+	}
+
+	mh_free(mh);
+
+	g_assert(g_atomic_int_get(&_sourceDropped) == 10);
+	g_assert(g_atomic_int_get(&_sourceCalls) == 208);
+
+	g_main_context_unref(context);
+}
+
+static gint _gatherCalls = 0;
+
+/* it answers with its delay, in ms */
+void gather_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	PackageData* outputData = mh_alloc_output(1);
+
+	g_atomic_int_inc(&_gatherCalls);
+
+	g_usleep(GPOINTER_TO_INT(data[0].field) * 1000);
+
+	outputData[0].field = data[0].field;
+
+	output->name = "STATUS";
+	output->size = 1;
+	output->data = outputData;
+	*sizeOutput = 1;
+}
+
+void slow_gather_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	g_usleep(300000);
+
+	gather_callback(data, output, sizeOutput);
+}
+
+void test_messages_gather(void) {
+	const char* words[] = { "AXIS.STATUS", "UNKNOWN", "IO.STATUS", "PLC.STATUS" };
+	const char* slowWords[] = { "AXIS.STATUS", "SLOW.STATUS" };
+	const char* busyWords[] = { "SLOW.STATUS", "AXIS.STATUS" };
+	PackageData data;
+	Package outputs[4];
+	unsigned int sizeOutputs[4];
+	gint64 start = 0;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_set_workers(mh, 4);
+	mh_add_word(mh, "AXIS.STATUS", gather_callback);
+	mh_add_word(mh, "IO.STATUS", gather_callback);
+	mh_add_word(mh, "PLC.STATUS", gather_callback);
+	mh_add_word(mh, "SLOW.STATUS", slow_gather_callback);
+
+	data.field = GINT_TO_POINTER(50);
+
+	/* the handlers run in parallel */
+	g_print("\n\rGather the status of the modules..\n\r");
+
+	start = g_get_monotonic_time();
+	g_assert(mh_send_gather(mh, words, 4, &data, outputs, sizeOutputs, 0) == 3);
+	g_assert(g_get_monotonic_time() - start < 140000);
+
+	for (i = 0; i < 4; i++) {
+		g_assert(sizeOutputs[i] == (i == 1 ? 0 : 1));
+		g_assert(i == 1 || GPOINTER_TO_INT(outputs[i].data[0].field) == 50);
+
+		mh_release_output(mh, &outputs[i]);
+	}
+
+	/* the slow handler doesn't answer in time */
+	g_print("Gather with a timeout..\n\r");
+
+	start = g_get_monotonic_time();
+	g_assert(mh_send_gather(mh, slowWords, 2, &data, outputs, sizeOutputs, 100) == 1);
+	g_assert(g_get_monotonic_time() - start < 250000);
+
+	g_assert(sizeOutputs[0] == 1 && sizeOutputs[1] == 0);
+	mh_release_output(mh, &outputs[0]);
+
+	/* the data is used until the slow handler completes */
+	mh_flush(mh);
+
+	/* the message queued behind the slow one is dropped, without missing a deadline */
+	g_print("Gather with a busy worker..\n\r");
+
+	mh_set_workers(mh, 1);
+	_gatherCalls = 0;
+	g_assert(mh_send_gather(mh, busyWords, 2, &data, outputs, sizeOutputs, 100) == 0);
+	mh_flush(mh);
+
+	/* only the slow word ran */
+	g_assert(_gatherCalls == 1);
+	/* giving up on a word is not a missed deadline */
+	g_assert(mh_get_missed_deadlines(mh) == 0);
+
+	mh_free(mh);
+}
+
+/* it counts the calls in the user data */
+void subscriber_callback(const char* topic, const PackageData *data, void* userData) {
+	g_assert(g_str_has_prefix(topic, "axis") || g_str_equal(topic, "other"));
+
+	g_atomic_int_inc((gint*)userData);
+}
+
+static MessageHandler* _publishHandler = NULL;
+
+static void* publish_parallel_thread(void* data) {
+	return GUINT_TO_POINTER(mh_publish_parallel(_publishHandler, *(Package*)data));
+}
+
+void test_messages_publish(void) {
+	gint calls[5] = { 0, 0, 0, 0, 0 };
+	unsigned int subscriptions[5];
+	MessageFuture* futures[2];
+	GThread* thread = NULL;
+	Package pkg;
+	Package waitPkg;
+	Package output;
+	unsigned int outSize = 0;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+
+	/* patterns must have valid segments */
+	g_print("\n\rSubscribe to topics..\n\r");
+
+	g_assert(mh_subscribe(mh, "", subscriber_callback, NULL) == 0);
+	g_assert(mh_subscribe(mh, "axis..position", subscriber_callback, NULL) == 0);
+	g_assert(mh_subscribe(mh, "axis.#.position", subscriber_callback, NULL) == 0);
+
+	subscriptions[0] = mh_subscribe(mh, "axis.*.position", subscriber_callback, &calls[0]);
+	subscriptions[1] = mh_subscribe(mh, "axis.*.position", subscriber_callback, &calls[1]);
+	subscriptions[2] = mh_subscribe(mh, "axis.#", subscriber_callback, &calls[2]);
+	subscriptions[3] = mh_subscribe(mh, "axis.1.speed", subscriber_callback, &calls[3]);
+	subscriptions[4] = mh_subscribe(mh, "#", subscriber_callback, &calls[4]);
+
+	for (i = 0; i < 5; i++) {
+		g_assert(subscriptions[i] > 0);
+	}
+
+	/* every matching subscriber is called */
+	pkg.size = 0;
+	pkg.data = NULL;
+
+	pkg.name = "axis.1.position";
+	g_assert(mh_publish(mh, pkg) == 4);
+
+	pkg.name = "axis.1.speed";
+	g_assert(mh_publish(mh, pkg) == 3);
+
+	pkg.name = "axis";
+	g_assert(mh_publish(mh, pkg) == 2);
+
+	pkg.name = "other";
+	g_assert(mh_publish(mh, pkg) == 1);
+
+	g_assert(calls[0] == 1 && calls[1] == 1 && calls[2] == 3 && calls[3] == 1 && calls[4] == 4);
+
+	/* the removed subscribers are not called anymore */
+	g_print("Unsubscribe..\n\r");
+
+	g_assert(mh_unsubscribe(mh, subscriptions[0]));
+	g_assert(!mh_unsubscribe(mh, subscriptions[0]));
+	g_assert(mh_unsubscribe(mh, subscriptions[4]));
+
+	pkg.name = "axis.1.position";
+	g_assert(mh_publish(mh, pkg) == 2);
+	g_assert(calls[0] == 1 && calls[1] == 2 && calls[2] == 4);
+
+	/* the fan-out runs on the workers */
+	g_print("Publish in parallel..\n\r");
+
+	mh_set_workers(mh, 2);
+
+	for (i = 0; i < 100; i++) {
+		g_assert(mh_publish_parallel(mh, pkg) == 2);
+	}
+
+	g_assert(calls[1] == 102 && calls[2] == 104);
+
+	pkg.name = "nobody";
+	g_assert(mh_publish_parallel(mh, pkg) == 0);
+
+	/* a subscriber dropped from a full queue isn't counted */
+	g_print("Drop a subscriber..\n\r");
+
+	mh_add_word(mh, "WAIT", queue_callback);
+	mh_set_workers(mh, 1);
+	mh_set_queue(mh, 2, MSG_QUEUE_DROP_OLDEST);
+
+	waitPkg.name = "WAIT";
+	waitPkg.size = 0;
+	waitPkg.data = NULL;
+	queue_block_worker(mh, waitPkg);
+
+	/* one subscriber is queued, the other one runs on the publishing thread */
+	pkg.name = "axis.1.position";
+	_publishHandler = mh;
+	thread = g_thread_new("publish", publish_parallel_thread, &pkg);
+
+	while (g_atomic_int_get(&calls[1]) + g_atomic_int_get(&calls[2]) < 207) {
+		g_thread_yield();
+	}
+
+	for (i = 0; i < 2; i++) {
+		futures[i] = mh_post(mh, waitPkg);
+	}
+
+	g_atomic_int_set(&_queueGate, 1);
+
+	g_assert(GPOINTER_TO_UINT(g_thread_join(thread)) == 1);
+	g_assert(g_atomic_int_get(&calls[1]) + g_atomic_int_get(&calls[2]) == 207);
+
+	for (i = 0; i < 2; i++) {
+		g_assert(mh_future_wait(futures[i], &output, &outSize));
+		mh_future_free(futures[i]);
+	}
+
+	mh_free(mh);
+}
+
+static unsigned int _batchCalls = 0;
+
+/* every output is named after its package data */
+void batch_callback(const Package *pkgs, unsigned int count, Package *outputs, unsigned int *sizeOutputs) {
+	unsigned int i = 0;
+
+	_batchCalls++;
+
+	for (i = 0; i < count; i++) {
+		g_assert(g_str_equal(pkgs[i].name, "BATCH"));
+
+		outputs[i].name = pkgs[i].data->field;
+		outputs[i].size = count;
+		outputs[i].data = NULL;
+
+		sizeOutputs[i] = 1;
+	}
+}
+
+void test_messages_batch(void) {
+	const char* names[] = { "BATCH", "MOVE0", "BATCH", "UNKNOWN", "BATCH" };
+	const char* fields[] = { "b0", "m0", "b1", "u0", "b2" };
+	PackageData data[5];
+	Package pkgs[5];
+	Package outputs[5];
+	unsigned int sizeOutputs[5];
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "MOVE0", callback0);
+	mh_add_word(mh, "BATCH", callback0);
+	mh_set_batch_callback(mh, "BATCH", batch_callback);
+
+	for (i = 0; i < 5; i++) {
+		data[i].field = (void*)fields[i];
+
+		pkgs[i].name = (char*)names[i];
+		pkgs[i].size = 1;
+		pkgs[i].data = &data[i];
+	}
+
+	/* the batch word is called once, the others once per package */
+	g_print("\n\rSend a batch..\n\r");
+
+	g_assert(mh_send_batch(mh, pkgs, 5, outputs, sizeOutputs) == 4);
+	g_assert(_batchCalls == 1);
+
+	/* outputs are in the order of the packages */
+	g_assert(sizeOutputs[0] == 1 && g_str_equal(outputs[0].name, "b0") && outputs[0].size == 3);
+	g_assert(sizeOutputs[1] == 2 && g_str_equal(outputs[1].name, "OUTPUT0"));
+	g_assert(sizeOutputs[2] == 1 && g_str_equal(outputs[2].name, "b1"));
+	g_assert(sizeOutputs[3] == 0);
+	g_assert(sizeOutputs[4] == 1 && g_str_equal(outputs[4].name, "b2"));
+
+	for (i = 0; i < 5; i++) {
+		mh_release_output(mh, &outputs[i]);
+	}
+
+	g_assert(mh_send_batch(mh, pkgs, 0, NULL, NULL) == 0);
+
+	mh_free(mh);
+}
+
+static PackageData* _lastOutput = NULL;
+
+/* it allocates a buffer it doesn't use, then the output one */
+void output_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	unsigned int count = GPOINTER_TO_UINT(data->field);
+	unsigned int i = 0;
+
+	g_assert(mh_alloc_output(1) != NULL);
+
+	output->name = "OUTPUT";
+	output->size = count;
+	output->data = mh_alloc_output(count);
+
+	for (i = 0; i < count; i++) {
+		output->data[i].field = GUINT_TO_POINTER(i);
+	}
+
+	_lastOutput = output->data;
+	*sizeOutput = count;
+}
+
+void output_done_callback(const Package *output, unsigned int sizeOutput, void* userData) {
+	g_assert(GPOINTER_TO_UINT(output->data[sizeOutput - 1].field) == sizeOutput - 1);
+}
+
+#define OUTPUT_KEPT 600
+
+void test_messages_output(void) {
+	MessageFuture* future = NULL;
+	PackageData* first = NULL;
+	PackageData data;
+	Package pkg;
+	Package output;
+	Package kept[OUTPUT_KEPT];
+	unsigned int i = 0;
+	unsigned int outSize = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "OUTPUT", output_callback);
+
+	pkg.name = "OUTPUT";
+	pkg.size = 1;
+	pkg.data = &data;
+
+	/* released outputs are reused */
+	g_print("\n\rReuse the outputs..\n\r");
+
+	data.field = GUINT_TO_POINTER(3);
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	g_assert(outSize == 3 && output.data == _lastOutput);
+	g_assert(GPOINTER_TO_UINT(output.data[2].field) == 2);
+
+	first = output.data;
+	mh_release_output(mh, &output);
+	g_assert(output.data == NULL);
+
+	/* the output of the same size gets the same buffer */
+	data.field = GUINT_TO_POINTER(4);
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	g_assert(output.data == first);
+	mh_release_output(mh, &output);
+
+	/* big outputs are not pooled */
+	data.field = GUINT_TO_POINTER(5000);
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	g_assert(GPOINTER_TO_UINT(output.data[4999].field) == 4999);
+	mh_release_output(mh, &output);
+
+	/* data not allocated by the handler is left untouched */
+	output.data = &data;
+	mh_release_output(mh, &output);
+	g_assert(output.data == NULL);
+
+	/* outputs spanning many chunks are recognized and reused */
+	data.field = GUINT_TO_POINTER(1000);
+
+	for (i = 0; i < OUTPUT_KEPT; i++) {
+		mh_send_data(mh, pkg, &kept[i], &outSize);
+		g_assert(GPOINTER_TO_UINT(kept[i].data[999].field) == 999);
+	}
+
+	first = kept[OUTPUT_KEPT - 1].data;
+
+	for (i = 0; i < OUTPUT_KEPT; i++) {
+		mh_release_output(mh, &kept[i]);
+		g_assert(kept[i].data == NULL);
+	}
+
+	mh_send_data(mh, pkg, &output, &outSize);
+	g_assert(output.data == first);
+	mh_release_output(mh, &output);
+
+	/* posted outputs live until the future is freed */
+	g_print("Post messages..\n\r");
+
+	mh_set_workers(mh, 1);
+
+	data.field = GUINT_TO_POINTER(2);
+	future = mh_post(mh, pkg);
+
+	g_assert(mh_future_wait(future, &output, &outSize));
+	g_assert(GPOINTER_TO_UINT(output.data[1].field) == 1);
+
+	mh_future_free(future);
+
+	g_assert(mh_post_with_callback(mh, pkg, output_done_callback, NULL));
+	mh_flush(mh);
+
+	mh_free(mh);
+}
+
+void stats_callback(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	g_usleep(GPOINTER_TO_UINT(data->field));
+
+	*sizeOutput = 0;
+}
+
+void test_messages_stats(void) {
+	MessageStats* stats = NULL;
+	PackageData data;
+	Package pkg;
+	Package output;
+	unsigned int outSize = 0;
+	unsigned int size = 0;
+	unsigned int calls = 0;
+	char* json = NULL;
+	unsigned int i = 0;
+	MessageHandler* mh = NULL;
+
+	mh = mh_new();
+	mh_add_word(mh, "FAST", stats_callback);
+	mh_add_word(mh, "SLOW \"1\"", stats_callback);
+
+	pkg.size = 1;
+	pkg.data = &data;
+
+	/* nothing is recorded until statistics are enabled */
+	g_assert(!mh_get_stats_enabled(mh));
+
+	pkg.name = "FAST";
+	data.field = GUINT_TO_POINTER(0);
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	stats = mh_get_stats(mh, &size);
+	g_assert(size == 2 && stats[0].calls == 0);
+	g_free(stats);
+
+	/* calls and times are recorded per word */
+	g_print("\n\rRecord statistics..\n\r");
+
+	mh_set_stats_enabled(mh, TRUE);
+
+	for (i = 0; i < 10; i++) {
+		mh_send_data(mh, pkg, &output, &outSize);
+	}
+
+	pkg.name = "SLOW \"1\"";
+	data.field = GUINT_TO_POINTER(2000);
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	stats = mh_get_stats(mh, &size);
+
+	g_assert(g_str_equal(stats[0].word, "FAST"));
+	g_assert(stats[0].calls == 10);
+	g_assert(stats[1].calls == 1);
+	g_assert(stats[1].maxTime >= 2000000);
+	g_assert(stats[1].totalTime == stats[1].maxTime);
+
+	/* the slow call is in the [2^20, 2^21) ns bucket or later */
+	for (i = 0; i < MSG_STATS_BUCKETS; i++) {
+		calls += stats[0].histogram[i];
+
+		g_assert(i >= 20 || stats[1].histogram[i] == 0);
+	}
+
+	g_assert(calls == 10);
+	g_free(stats);
+
+	json = mh_get_stats_json(mh);
+	g_print("%s\n\r", json);
+
+	g_assert(g_str_has_prefix(json, "{\"enabled\":true,\"words\":[{\"word\":\"FAST\",\"calls\":10,"));
+	g_assert(strstr(json, "\"word\":\"SLOW \\\"1\\\"\",\"calls\":1,") != NULL);
+	g_free(json);
+
+	/* statistics can be cleared */
+	mh_reset_stats(mh);
+
+	stats = mh_get_stats(mh, &size);
+	g_assert(stats[0].calls == 0 && stats[1].maxTime == 0);
+	g_free(stats);
+
+	mh_free(mh);
+}
+
+/*******************************
+ * Wire format test functions
+ *******************************/
+void test_wire(void) {
+	const WireField fields[] = {
+		{ WIRE_FIELD_INT, 0 },
+		{ WIRE_FIELD_DOUBLE, 0 },
+		{ WIRE_FIELD_STRING, 0 },
+		{ WIRE_FIELD_STRING, 0 },
+		{ WIRE_FIELD_BLOB, 5 }
+	};
+	const WireDescriptor desc = { G_N_ELEMENTS(fields), fields };
+	gdouble position = 12.5;
+	PackageData data[5];
+	PackageData decodedData[5];
+	WireField decodedFields[5];
+	Package pkg;
+	Package decoded;
+	guint64 buffer[32];
+	size_t size = 0;
+	size_t length = 0;
+
+	data[0].field = GINT_TO_POINTER(-42);
+	data[1].field = &position;
+	data[2].field = "position";
+	data[3].field = NULL;
+	data[4].field = "\001\002\000\003\004";
+
+	pkg.name = "axis.1.position";
+	pkg.size = 5;
+	pkg.data = data;
+
+	/* the encoded size is aligned */
+	g_print("\n\rEncode a package..\n\r");
+
+	size = wire_get_size(&pkg, &desc);
+	g_assert(size > 0 && size % 8 == 0);
+
+	g_assert(wire_encode(&pkg, &desc, buffer, size - 1) == 0);
+	g_assert(wire_encode(&pkg, &desc, buffer, sizeof(buffer)) == size);
+
+	g_assert(wire_peek(buffer, size, &length) == 5);
+	g_assert(length == size);
+
+	/* the decoded package points inside the buffer */
+	g_print("Decode a package..\n\r");
+
+	g_assert(wire_decode(buffer, size, &decoded, decodedData, 4, NULL) == 0);
+	g_assert(wire_decode(buffer, size - 8, &decoded, decodedData, 5, NULL) == 0);
+	g_assert(wire_decode(buffer, size, &decoded, decodedData, 5, decodedFields) == size);
+
+	g_assert(g_str_equal(decoded.name, "axis.1.position"));
+	g_assert((char*)decoded.name > (char*)buffer && (char*)decoded.name < (char*)buffer + size);
+	g_assert(decoded.size == 5 && decoded.data == decodedData);
+
+	g_assert(GPOINTER_TO_INT(decodedData[0].field) == -42);
+	g_assert(*(gdouble*)decodedData[1].field == 12.5);
+	g_assert(g_str_equal(decodedData[2].field, "position"));
+	g_assert(decodedData[3].field == NULL);
+	g_assert(memcmp(decodedData[4].field, "\001\002\000\003\004", 5) == 0);
+
+	g_assert(decodedFields[1].type == WIRE_FIELD_DOUBLE);
+	g_assert(decodedFields[4].type == WIRE_FIELD_BLOB && decodedFields[4].length == 5);
+
+	/* packages must match the descriptor */
+	pkg.size = 4;
+	g_assert(wire_get_size(&pkg, &desc) == 0);
+
+	/* corrupted data is rejected */
+	((guint8*)buffer)[2] = WIRE_VERSION + 1;
+	g_assert(wire_peek(buffer, size, NULL) == -1);
+	g_assert(wire_decode(buffer, size, &decoded, decodedData, 5, NULL) == 0);
+}
+
+/*******************************
+ * Perfect hash test functions
+ *******************************/
+void test_perfect_hash(void) {
+	const char* duplicated[] = { "axis", "speed", "axis" };
+	GPtrArray* keys = NULL;
+	PerfectHash* hash = NULL;
+	MessageHandler* mh = NULL;
+	unsigned int i = 0;
+
+	keys = g_ptr_array_new_with_free_func(g_free);
+
+	for (i = 0; i < 10000; i++) {
+		g_ptr_array_add(keys, g_strdup_printf("axis.%u.position", i));
+	}
+
+	/* every key is found at its position */
+	g_print("\n\rBuild a perfect hash..\n\r");
+
+	hash = ph_new((const char* const*)keys->pdata, keys->len);
+	g_assert(hash != NULL);
+	g_assert(ph_get_size(hash) == 10000);
+
+	for (i = 0; i < keys->len; i++) {
+		g_assert(ph_lookup(hash, g_ptr_array_index(keys, i)) == (int)i);
+	}
+
+	g_assert(ph_lookup(hash, "axis.10000.position") == -1);
+	g_assert(ph_lookup(hash, "") == -1);
+	ph_free(hash);
+
+	/* keys must be unique */
+	g_assert(ph_new(duplicated, 3) == NULL);
+
+	hash = ph_new(NULL, 0);
+	g_assert(ph_lookup(hash, "axis") == -1);
+	ph_free(hash);
+
+	/* the frozen dictionary of the message handler is built again by new words */
+	g_print("Freeze the dictionary..\n\r");
+
+	mh = mh_new();
+	mh_add_word(mh, "FIRST", callback0);
+	mh_add_word(mh, "SECOND", callback1);
+
+	g_assert(mh_freeze(mh));
+	g_assert(mh_is_frozen(mh));
+	g_assert(mh_resolve_word(mh, "SECOND") == 1);
+	g_assert(mh_resolve_word(mh, "THIRD") == MSG_ID_INVALID);
+
+	mh_add_word(mh, "THIRD", callback0);
+	g_assert(mh_is_frozen(mh));
+	g_assert(mh_resolve_word(mh, "THIRD") == 2);
+	g_assert(mh_resolve_word(mh, "FIRST") == 0);
+
+	mh_free(mh);
+	g_ptr_array_free(keys, TRUE);
+}
+
+/*******************************
+ * Ring buffer test functions
+ *******************************/
+#define RING_TEST_ITEMS 100000
+
+typedef struct {
+	RingBuffer* rb;
+	gint64 sum;
+} ringTestContext;
+
+static void* ring_test_producer(void* data) {
+	ringTestContext* ctx = (ringTestContext*)data;
+	gsize i = 0;
+
+	for (i = 1; i <= RING_TEST_ITEMS; i++) {
+		while (!rb_try_push(ctx->rb, GSIZE_TO_POINTER(i))) {
+			g_thread_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void* ring_test_consumer(void* data) {
+	ringTestContext* ctx = (ringTestContext*)data;
+	void* item = NULL;
+	gsize i = 0;
+
+	for (i = 0; i < RING_TEST_ITEMS; i++) {
+		while (!rb_try_pop(ctx->rb, &item)) {
+			g_thread_yield();
+		}
+
+		ctx->sum += GPOINTER_TO_SIZE(item);
+	}
+
+	return NULL;
+}
+
+void test_ring_buffer(void) {
+	ringTestContext producers[2];
+	ringTestContext consumers[2];
+	GThread* threads[4];
+	RingBuffer* rb = NULL;
+	void* item = NULL;
+	gsize i = 0;
+
+	/* the capacity is a power of two */
+	rb = rb_new(3);
+	g_assert(rb_get_capacity(rb) == 4);
+
+	g_assert(!rb_try_pop(rb, &item));
+
+	for (i = 1; i <= 4; i++) {
+		g_assert(rb_try_push(rb, GSIZE_TO_POINTER(i)));
+	}
+
+	g_assert(!rb_try_push(rb, GSIZE_TO_POINTER(5)));
+	g_assert(rb_get_size(rb) == 4);
+
+	/* items are dequeued in order */
+	for (i = 1; i <= 4; i++) {
+		g_assert(rb_try_pop(rb, &item));
+		g_assert(GPOINTER_TO_SIZE(item) == i);
+	}
+
+	g_assert(rb_get_size(rb) == 0);
+	rb_free(rb);
+
+	/* every item is dequeued exactly once by concurrent consumers */
+	g_print("\n\rRun 2 producers and 2 consumers..\n\r");
+
+	rb = rb_new(64);
+
+	for (i = 0; i < 2; i++) {
+		producers[i].rb = rb;
+		consumers[i].rb = rb;
+		consumers[i].sum = 0;
+
+		threads[i] = g_thread_new("ring-producer", ring_test_producer, &producers[i]);
+		threads[i + 2] = g_thread_new("ring-consumer", ring_test_consumer, &consumers[i]);
+	}
+
+	for (i = 0; i < 4; i++) {
+		g_thread_join(threads[i]);
+	}
+
+	g_assert(consumers[0].sum + consumers[1].sum == (gint64)RING_TEST_ITEMS * (RING_TEST_ITEMS + 1));
+	g_assert(!rb_try_pop(rb, &item));
+
+	rb_free(rb);
+}
+
+/*******************************
+ * Shared memory channel test functions
+ *******************************/
+static const WireField _remoteFields[] = { { WIRE_FIELD_INT, 0 } };
+static const WireDescriptor _remoteDesc = { 1, _remoteFields };
+static const WireField _remoteTextFields[] = { { WIRE_FIELD_STRING, 0 } };
+static const WireDescriptor _remoteTextDesc = { 1, _remoteTextFields };
+
+static void remote_double(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	PackageData* outputData = mh_alloc_output(1);
+
+	outputData[0].field = GINT_TO_POINTER(GPOINTER_TO_INT(data[0].field) * 2);
+
+	output->name = "DOUBLED";
+	output->size = 1;
+	output->data = outputData;
+	*sizeOutput = 1;
+}
+
+static void remote_echo(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	PackageData* outputData = mh_alloc_output(1);
+
+	outputData[0].field = data[0].field;
+
+	output->name = "ECHOED";
+	output->size = 1;
+	output->data = outputData;
+	*sizeOutput = 1;
+}
+
+static void remote_crash(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	_exit(0);
+}
+
+void test_messages_remote(void) {
+	MessageHandler* mh = NULL;
+	ShmChannel* channel = NULL;
+	PackageData data[1];
+	Package pkg;
+	Package output;
+	Package first;
+	unsigned int outSize = 0;
+	char* text = NULL;
+	int status = 0;
+	pid_t child = 0;
+	int i = 0;
+
+	channel = shm_channel_new(4096);
+	g_assert(channel != NULL);
+
+	child = fork();
+	g_assert(child >= 0);
+
+	/* the child serves the words */
+	if (child == 0) {
+		mh = mh_new();
+		mh_add_word(mh, "DOUBLE", remote_double);
+		mh_add_word(mh, "CRASH", remote_crash);
+		mh_add_word(mh, "TEXT", remote_double);
+		mh_add_word(mh, "ECHO", remote_echo);
+		shm_channel_add_output(channel, "DOUBLE", &_remoteDesc);
+		shm_channel_add_output(channel, "ECHO", &_remoteTextDesc);
+
+		status = shm_channel_serve(channel, mh);
+
+		mh_free(mh);
+		_exit(status ? 0 : 1);
+	}
+
+	mh = mh_new();
+	shm_channel_add_remote_word(channel, mh, "DOUBLE", &_remoteDesc);
+	shm_channel_add_remote_word(channel, mh, "CRASH", &_remoteDesc);
+	shm_channel_add_remote_word(channel, mh, "TEXT", &_remoteTextDesc);
+	shm_channel_add_remote_word(channel, mh, "ECHO", &_remoteTextDesc);
+
+	pkg.name = "DOUBLE";
+	pkg.size = 1;
+	pkg.data = data;
+
+	/* enough calls to wrap the rings around */
+	g_print("\n\rSend packages to the child..\n\r");
+
+	for (i = 0; i < 1000; i++) {
+		data[0].field = GINT_TO_POINTER(i);
+
+		mh_send_data(mh, pkg, &output, &outSize);
+
+		g_assert(outSize == 1);
+		g_assert(g_str_equal(output.name, "DOUBLED"));
+		g_assert(GPOINTER_TO_INT(output.data[0].field) == i * 2);
+
+		mh_release_output(mh, &output);
+	}
+
+	g_assert(!shm_channel_is_broken(channel));
+
+	/* an output is still valid while the other calls wrap the rings around */
+	g_print("Keep an output of the child..\n\r");
+
+	pkg.name = "ECHO";
+	data[0].field = "first";
+
+	mh_send_data(mh, pkg, &first, &outSize);
+	g_assert(outSize == 1);
+
+	for (i = 0; i < 200; i++) {
+		text = g_strdup_printf("echo %d", i);
+		data[0].field = text;
+
+		mh_send_data(mh, pkg, &output, &outSize);
+		g_assert(outSize == 1 && g_str_equal(output.data[0].field, text));
+
+		mh_release_output(mh, &output);
+		g_free(text);
+	}
+
+	g_assert(g_str_equal(first.name, "ECHOED"));
+	g_assert(g_str_equal(first.data[0].field, "first"));
+	mh_release_output(mh, &first);
+
+	/* a package too big for the ring isn't sent, and the channel still works */
+	g_print("Send a package too big for the ring..\n\r");
+
+	text = g_strnfill(3000, 'x');
+	pkg.name = "TEXT";
+	data[0].field = text;
+
+	mh_send_data(mh, pkg, &output, &outSize);
+	g_assert(outSize == 0);
+	g_assert(!shm_channel_is_broken(channel));
+
+	g_free(text);
+
+	pkg.name = "DOUBLE";
+	data[0].field = GINT_TO_POINTER(21);
+
+	mh_send_data(mh, pkg, &output, &outSize);
+	g_assert(outSize == 1 && GPOINTER_TO_INT(output.data[0].field) == 42);
+	mh_release_output(mh, &output);
+
+	/* the channel is closed */
+	g_print("Close the channel..\n\r");
+
+	shm_channel_close(channel);
+	g_assert(waitpid(child, &status, 0) == child);
+	g_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	mh_send_data(mh, pkg, &output, &outSize);
+	g_assert(outSize == 0);
+
+	mh_free(mh);
+	shm_channel_free(channel);
+
+	/* a child that doesn't answer breaks the channel */
+	g_print("Crash the child..\n\r");
+
+	channel = shm_channel_new(4096);
+	shm_channel_set_timeout(channel, 200);
+
+	child = fork();
+	g_assert(child >= 0);
+
+	if (child == 0) {
+		mh = mh_new();
+		mh_add_word(mh, "CRASH", remote_crash);
+		shm_channel_serve(channel, mh);
+		_exit(1);
+	}
+
+	mh = mh_new();
+	shm_channel_add_remote_word(channel, mh, "CRASH", &_remoteDesc);
+
+	pkg.name = "CRASH";
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	g_assert(outSize == 0);
+	g_assert(shm_channel_is_broken(channel));
+	g_assert(waitpid(child, &status, 0) == child);
+
+	mh_free(mh);
+	shm_channel_free(channel);
+}
+
+/*******************************
+ * Recorder test functions
+ *******************************/
+static int _replaySum = 0;
+
+static void replay_sum(const PackageData *data, Package *output, unsigned int *sizeOutput) {
+	_replaySum += GPOINTER_TO_INT(data[0].field);
+	*sizeOutput = 0;
+}
+
+void test_recorder(void) {
+	MessageHandler* mh = NULL;
+	Recorder* rec = NULL;
+	ReplayStats stats;
+	PackageData data[1];
+	Package pkg;
+	Package output;
+	unsigned int outSize = 0;
+	char* path = NULL;
+	int i = 0;
+
+	path = g_build_filename(g_get_tmp_dir(), "tester_recorder.log", NULL);
+
+	rec = rec_new(path);
+	g_assert(rec != NULL);
+	rec_add_word(rec, "SUM", &_remoteDesc);
+
+	mh = mh_new();
+	mh_add_word(mh, "SUM", replay_sum);
+	mh_add_word(mh, "OTHER", replay_sum);
+
+	pkg.size = 1;
+	pkg.data = data;
+
+	/* packages of words without a descriptor are not recorded */
+	g_print("\n\rRecord packages..\n\r");
+
+	rec_start(rec, mh);
+
+	for (i = 1; i <= 100; i++) {
+		data[0].field = GINT_TO_POINTER(i);
+
+		pkg.name = (i % 10 == 0) ? "OTHER" : "SUM";
+		mh_send_data(mh, pkg, &output, &outSize);
+	}
+
+	g_assert(rec_stop(rec, mh));
+
+	/* not recorded anymore */
+	pkg.name = "SUM";
+	mh_send_data(mh, pkg, &output, &outSize);
+
+	g_assert(rec_get_recorded(rec) == 90);
+	g_assert(rec_get_skipped(rec) == 10);
+	g_assert(rec_get_failed(rec) == 0);
+
+	rec_free(rec);
+
+	/* write errors are reported */
+	if (g_file_test("/dev/full", G_FILE_TEST_EXISTS)) {
+		g_print("Record to a full device..\n\r");
+
+		rec = rec_new("/dev/full");
+		g_assert(rec != NULL);
+		rec_add_word(rec, "SUM", &_remoteDesc);
+
+		rec_start(rec, mh);
+
+		/* more than the file buffer */
+		for (i = 0; i < 100000 && rec_get_failed(rec) == 0; i++) {
+			mh_send_data(mh, pkg, &output, &outSize);
 		}
 
-		g_print("\n\n\r");
+		g_assert(rec_get_failed(rec) > 0);
+		g_assert(!rec_stop(rec, mh));
+
+		rec_free(rec);
 	}
 
-    mh_free(mh);
+	mh_free(mh);
+
+	/* the packages are replayed into another handler */
+	g_print("Replay packages..\n\r");
+
+	_replaySum = 0;
+
+	mh = mh_new();
+	mh_add_word(mh, "SUM", replay_sum);
+
+	g_assert(rec_replay(path, mh, FALSE, &stats));
+	g_assert(stats.packages == 90);
+	g_assert(stats.skipped == 0);
+	g_assert(stats.maxLatency >= stats.medianLatency);
+	g_assert(_replaySum == 5050 - 550);
+
+	/* with the original timing */
+	_replaySum = 0;
+
+	g_assert(rec_replay(path, mh, TRUE, NULL));
+	g_assert(_replaySum == 5050 - 550);
+
+	/* words unknown to the handler are skipped */
+	mh_free(mh);
+	mh = mh_new();
+
+	g_assert(rec_replay(path, mh, FALSE, &stats));
+	g_assert(stats.packages == 0);
+	g_assert(stats.skipped == 90);
+
+	mh_free(mh);
+
+	g_unlink(path);
+	g_free(path);
 }
 
 /*******************************
@@ -332,6 +2206,7 @@ void test_print_localization_strings(LocalizationHandler* lh, const char* langua
     }
 }
 void test_localization(void) {
+    char* path = NULL;
     const char* filePath = NULL;
     const char* language = NULL;
     const char* testLanguage = NULL;
@@ -346,7 +2221,9 @@ void test_localization(void) {
     g_print("\n\rInitialize localization with '%s' file and '%s' language...\n\r", filePath, language);
     lh = lh_new(filePath, language);
 
-    g_print("File path is '%s' ", lh_get_file_path(lh));
+    path = lh_get_file_path(lh);
+    g_print("File path is '%s' ", path);
+    g_free(path);
     g_print(", language is '%s'\n\r", lh_get_language(lh));
 
     languages = lh_get_supported_languages(lh);
@@ -379,6 +2256,284 @@ void test_localization(void) {
     lh_free(lh);
 }
 
+void test_localization_tables(void) {
+    LocalizationHandler* lh = NULL;
+    const char* string = NULL;
+
+    lh = lh_new("localization.txt", "it");
+    g_assert(g_str_equal(lh_get_language(lh), "it"));
+
+    /* the strings of the current language are borrowed from its table */
+    g_print("\n\rLook up the strings of the current language..\n\r");
+
+    string = lh_get_string(lh, "Save");
+    g_assert(g_strcmp0(string, "salva") == 0);
+    g_assert(lh_get_string(lh, "Save") == string);
+    g_assert(lh_get_string(lh, "Missing") == NULL);
+
+    /* other languages get a table of their own */
+    g_assert(g_strcmp0(lh_get_localized_string(lh, "Exit", "en"), "exit") == 0);
+    g_assert(g_strcmp0(lh_get_localized_string(lh, "Exit", NULL), "esci") == 0);
+
+    /* untranslated strings fall back to the default language */
+    g_assert(g_strcmp0(lh_get_localized_string(lh, "Close", "fr"), "close") == 0);
+
+    /* changing language switches the table */
+    lh_set_language(lh, "en");
+    g_assert(g_strcmp0(lh_get_string(lh, "Open"), "open") == 0);
+
+    /* reloading the file resolves the strings again */
+    lh_load_file(lh, "localization.txt");
+    g_assert(g_strcmp0(lh_get_string(lh, "Save"), "save") == 0);
+
+    lh_free(lh);
+}
+
+void test_localization_ids(void) {
+    static const char* const keys[] = LH_STRING_KEYS;
+    static const char* const staleKeys[] = { "Save", "Open", "Close", "Quit" };
+    LocalizationHandler* lh = NULL;
+
+    lh = lh_new("localization.txt", "it");
+
+    /* the generated identifiers match the catalog */
+    g_print("\n\rLook up the strings by identifier..\n\r");
+
+    g_assert(lh_set_string_ids(lh, keys, LH_STRING_COUNT));
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_SAVE), "salva") == 0);
+    g_assert(lh_get_string_id(lh, LH_STRING_EXIT) == lh_get_string(lh, "Exit"));
+
+    lh_set_language(lh, "en");
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_CLOSE), "close") == 0);
+
+    /* identifiers of another catalog don't */
+    g_assert(!lh_set_string_ids(lh, staleKeys, G_N_ELEMENTS(staleKeys)));
+    g_assert(lh_get_string_id(lh, 3) == NULL);
+    g_assert(!lh_set_string_ids(lh, keys, 2));
+
+    lh_free(lh);
+}
+
+void test_localization_catalog(void) {
+    static const char* const keys[] = LH_STRING_KEYS;
+    static const char* const words[] = { "Save", "Open", "Close", "Exit" };
+    const char* wrongKeys[LH_STRING_COUNT];
+    LocalizationHandler* source = NULL;
+    LocalizationHandler* lh = NULL;
+    char* path = NULL;
+    char* badPath = NULL;
+    char* contents = NULL;
+    gsize length = 0;
+    size_t i = 0;
+
+    path = g_build_filename(g_get_tmp_dir(), "tester_localization.cat", NULL);
+
+    g_print("\n\rCompile the catalog..\n\r");
+    g_assert(lh_compile_catalog("localization.txt", path));
+
+    /* the mapped catalog has the strings of the source file */
+    source = lh_new("localization.txt", "it");
+    lh = lh_new(path, "it");
+
+    for (i = 0; i < G_N_ELEMENTS(words); i++) {
+        g_assert(g_strcmp0(lh_get_string(lh, words[i]), lh_get_string(source, words[i])) == 0);
+        g_assert(g_strcmp0(lh_get_localized_string(lh, words[i], "en"), lh_get_localized_string(source, words[i], "en")) == 0);
+    }
+
+    g_assert(g_strcmp0(lh_get_string(lh, "Save"), "salva") == 0);
+    g_assert(lh_get_string(lh, "Missing") == NULL);
+
+    /* the identifiers are checked against the keys index of the catalog */
+    for (i = 0; i < LH_STRING_COUNT; i++) {
+        wrongKeys[i] = keys[i];
+    }
+
+    wrongKeys[LH_STRING_COUNT - 1] = "Missing";
+    g_assert(!lh_set_string_ids(lh, wrongKeys, LH_STRING_COUNT));
+    g_assert(!lh_set_string_ids(lh, keys, LH_STRING_COUNT - 1));
+
+    /* the strings point inside the catalog, and they match the identifiers */
+    g_assert(lh_set_string_ids(lh, keys, LH_STRING_COUNT));
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_EXIT), "esci") == 0);
+
+    /* a source file can take the place of the catalog */
+    lh_load_file(lh, "localization.txt");
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_OPEN), "apri") == 0);
+
+    /* a truncated catalog leaves the strings loaded before */
+    g_assert(g_file_get_contents(path, &contents, &length, NULL));
+    badPath = g_build_filename(g_get_tmp_dir(), "tester_truncated.cat", NULL);
+    g_assert(g_file_set_contents(badPath, contents, 12, NULL));
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*corrupted*");
+    lh_load_file(lh, badPath);
+    g_test_assert_expected_messages();
+
+    g_assert(g_strcmp0(lh_get_string(lh, "Save"), "salva") == 0);
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_OPEN), "apri") == 0);
+
+    lh_free(source);
+    lh_free(lh);
+
+    g_unlink(badPath);
+    g_free(badPath);
+    g_free(contents);
+    g_unlink(path);
+    g_free(path);
+}
+
+static gint _languageChanges = 0;
+static gint _languageReadersQuit = FALSE;
+
+static void language_changed(LocalizationHandler* lh, const char* language, void* userData) {
+    /* the new strings are in place when the handlers are called */
+    g_assert(g_strcmp0(language, lh_get_language(lh)) == 0);
+    g_assert(g_strcmp0(lh_get_string(lh, "Save"), g_str_equal(language, "it") ? "salva" : "save") == 0);
+
+    g_atomic_int_inc(&_languageChanges);
+}
+
+static void* language_prepare(void* data) {
+    lh_prepare_language((LocalizationHandler*)data, "en");
+
+    return NULL;
+}
+
+static void* language_reader(void* data) {
+    LocalizationHandler* lh = (LocalizationHandler*)data;
+    const char* string = NULL;
+
+    /* every lookup sees one language or the other */
+    while (!g_atomic_int_get(&_languageReadersQuit)) {
+        string = lh_get_string(lh, "Save");
+        g_assert(g_strcmp0(string, "save") == 0 || g_strcmp0(string, "salva") == 0);
+    }
+
+    return NULL;
+}
+
+static void* reload_reader(void* data) {
+    LocalizationHandler* lh = (LocalizationHandler*)data;
+    const char* strings[2];
+    const unsigned int ids[] = { LH_STRING_SAVE, LH_STRING_EXIT };
+
+    /* the lookups keep the tables they use, while the replaced ones are freed. The strings
+     * themselves are valid until the next reload, so they are not read here */
+    while (!g_atomic_int_get(&_languageReadersQuit)) {
+        g_assert(lh_get_strings_id(lh, ids, 2, strings) == 2);
+        g_assert(lh_get_string(lh, "Open") != NULL);
+    }
+
+    return NULL;
+}
+
+void test_localization_switch(void) {
+    static const char* const keys[] = LH_STRING_KEYS;
+    LocalizationHandler* lh = NULL;
+    GThread* readers[2];
+    GThread* thread = NULL;
+    int i = 0;
+
+    lh = lh_new("localization.txt", "it");
+    lh_add_change_event(lh, language_changed, NULL);
+
+    /* the table is built in background */
+    g_print("\n\rPrepare the language..\n\r");
+
+    thread = g_thread_new("prepare", language_prepare, lh);
+    g_thread_join(thread);
+
+    /* switching languages while other threads look up strings */
+    g_print("Switch languages..\n\r");
+
+    _languageReadersQuit = FALSE;
+
+    for (i = 0; i < 2; i++) {
+        readers[i] = g_thread_new("reader", language_reader, lh);
+    }
+
+    for (i = 0; i < 1000; i++) {
+        lh_set_language(lh, i % 2 == 0 ? "en" : "it");
+    }
+
+    g_atomic_int_set(&_languageReadersQuit, TRUE);
+
+    for (i = 0; i < 2; i++) {
+        g_thread_join(readers[i]);
+    }
+
+    g_assert(g_atomic_int_get(&_languageChanges) == 1000);
+    g_assert(g_strcmp0(lh_get_language(lh), "it") == 0);
+
+    /* setting the current language again doesn't notify */
+    lh_set_language(lh, "it");
+    g_assert(g_atomic_int_get(&_languageChanges) == 1000);
+
+    /* reloading the file and binding the identifiers while other threads look up strings */
+    g_print("Reload the strings..\n\r");
+
+    g_assert(lh_set_string_ids(lh, keys, LH_STRING_COUNT));
+    _languageReadersQuit = FALSE;
+
+    for (i = 0; i < 2; i++) {
+        readers[i] = g_thread_new("reader", reload_reader, lh);
+    }
+
+    for (i = 0; i < 50; i++) {
+        lh_load_file(lh, "localization.txt");
+        g_assert(lh_set_string_ids(lh, keys, LH_STRING_COUNT));
+    }
+
+    g_atomic_int_set(&_languageReadersQuit, TRUE);
+
+    for (i = 0; i < 2; i++) {
+        g_thread_join(readers[i]);
+    }
+
+    /* both of them notify the handlers */
+    g_assert(g_atomic_int_get(&_languageChanges) == 1000 + 1 + 100);
+
+    g_assert(g_strcmp0(lh_get_string_id(lh, LH_STRING_EXIT), "esci") == 0);
+    g_assert(g_strcmp0(lh_get_string(lh, "Open"), "apri") == 0);
+
+    lh_remove_change_event(lh, language_changed, NULL);
+    lh_set_language(lh, "en");
+    g_assert(g_atomic_int_get(&_languageChanges) == 1000 + 1 + 100);
+
+    lh_free(lh);
+}
+
+void test_localization_bulk(void) {
+    static const char* const keys[] = LH_STRING_KEYS;
+    static const char* const labels[] = { "Exit", "Missing", "Save", NULL };
+    static const unsigned int ids[] = { LH_STRING_OPEN, LH_STRING_CLOSE, LH_STRING_COUNT };
+    LocalizationHandler* lh = NULL;
+    const char* strings[4];
+
+    lh = lh_new("localization.txt", "it");
+    lh_set_string_ids(lh, keys, LH_STRING_COUNT);
+
+    /* the labels of a panel in one call */
+    g_print("\n\rLook up the labels..\n\r");
+
+    g_assert(lh_get_strings(lh, labels, G_N_ELEMENTS(labels), strings) == 2);
+    g_assert(g_strcmp0(strings[0], "esci") == 0);
+    g_assert(strings[1] == NULL);
+    g_assert(strings[2] == lh_get_string(lh, "Save"));
+    g_assert(strings[3] == NULL);
+
+    g_assert(lh_get_strings_id(lh, ids, G_N_ELEMENTS(ids), strings) == 2);
+    g_assert(g_strcmp0(strings[0], "apri") == 0);
+    g_assert(g_strcmp0(strings[1], "chiudi") == 0);
+    g_assert(strings[2] == NULL);
+
+    lh_set_language(lh, "en");
+    g_assert(lh_get_strings(lh, labels, 1, strings) == 1);
+    g_assert(g_strcmp0(strings[0], "exit") == 0);
+
+    lh_free(lh);
+}
+
 /*******************************
  * Engine test functions
  *******************************/ 
@@ -436,7 +2591,7 @@ void test_engine(void) {
  * Config test functions
  ***************************/
 void test_config_print_cfg(CfgFile* cfg) {
-    const char* const* keys = NULL;
+    char** keys = NULL;
     unsigned int keysNum = 0;
     size_t i = 0;
     const char* key = NULL;
@@ -446,11 +2601,18 @@ void test_config_print_cfg(CfgFile* cfg) {
 
     g_print("The configuration is the following one:\n\r");
 
+    keys = cfg_get_keys(cfg, &keysNum);
+
+    g_assert(keysNum == cfg_get_size(cfg));
+
     for (i = 0; i < keysNum; i++) {
         key = keys[i];
         value = cfg_get_item_value(cfg, key);
         g_print("- Key=%s,Value=%s\n\r", key, value);
     }
+
+    g_assert(keys[keysNum] == NULL);
+    g_strfreev(keys);
 }
 
 void test_config(void) {
@@ -487,16 +2649,289 @@ void test_config(void) {
     cfg_free(cfg);
 }
 
+void config_change_callback(CfgFile* cfg, const char* key, const char* oldValue, const char* newValue, void* userData) {
+    g_print("- Key=%s changed from '%s' to '%s'\n\r", key, oldValue, newValue);
+
+    g_atomic_int_inc((int*)userData);
+}
+
+static void* config_unwatch_thread(void* data) {
+    size_t i = 0;
+
+    for (i = 0; i < 100; i++) {
+        cfg_unwatch((CfgFile*)data);
+        g_thread_yield();
+    }
+
+    return NULL;
+}
+
+void test_config_reload(void) {
+    CfgFile* cfg = NULL;
+    GThread* thread = NULL;
+    const char* file = NULL;
+    const char* value = NULL;
+    int changes = 0;
+    size_t i = 0;
+
+    file = "watch.cfg";
+
+    g_file_set_contents(file, "[Watch]\nKeyW_1=Value1\nKeyW_2=Value2\n", -1, NULL);
+
+    g_print("\n\rLoading 'Watch' configuration...\n\r");
+    cfg = cfg_load(file, "Watch");
+    cfg_add_change_event(cfg, config_change_callback, &changes);
+
+    g_print("Modify and reload the configuration...\n\r");
+    g_file_set_contents(file, "[Watch]\nKeyW_1=Value1\nKeyW_2=Value3\nKeyW_3=Value4\n", -1, NULL);
+    cfg_reload(cfg);
+
+    g_assert(g_atomic_int_get(&changes) == 2);
+
+    value = cfg_get_item_value(cfg, "KeyW_2");
+    g_assert(g_strcmp0(value, "Value3") == 0);
+
+    g_print("Watch the configuration file...\n\r");
+    cfg_watch(cfg, 10);
+
+    g_file_set_contents(file, "[Watch]\nKeyW_1=Value1\nKeyW_2=Value3\n", -1, NULL);
+
+    for (i = 0; i < 200 && g_atomic_int_get(&changes) < 3; i++) {
+        g_usleep(10000);
+    }
+
+    g_assert(g_atomic_int_get(&changes) == 3);
+    g_assert(cfg_get_item_value(cfg, "KeyW_3") == NULL);
+
+    /* a change of the same size, usually within the same second */
+    g_file_set_contents(file, "[Watch]\nKeyW_1=Value1\nKeyW_2=Value5\n", -1, NULL);
+
+    for (i = 0; i < 200 && g_atomic_int_get(&changes) < 4; i++) {
+        g_usleep(10000);
+    }
+
+    g_assert(g_atomic_int_get(&changes) == 4);
+    g_assert(g_strcmp0(cfg_get_item_value(cfg, "KeyW_2"), "Value5") == 0);
+
+    /* the watcher is stopped from another thread while it's started again */
+    g_print("Stop watching from another thread...\n\r");
+    thread = g_thread_new("unwatch", config_unwatch_thread, cfg);
+
+    for (i = 0; i < 100; i++) {
+        cfg_watch(cfg, 10);
+        g_thread_yield();
+    }
+
+    g_thread_join(thread);
+
+    cfg_unwatch(cfg);
+    cfg_free(cfg);
+}
+
+void test_config_layers(void) {
+    CfgFile* defaults = NULL;
+    CfgFile* config = NULL;
+    CfgFile* setup = NULL;
+    CfgLayers* layers = NULL;
+    const char* file = NULL;
+
+    file = "layers.cfg";
+
+    g_file_set_contents(file, "[Setup]\nKeyL_3=Setup\n", -1, NULL);
+
+    g_print("\n\rCreating the configuration layers...\n\r");
+    defaults = cfg_new(file, "Defaults");
+    cfg_add_item(defaults, "KeyL_1", "Defaults");
+    cfg_add_item(defaults, "KeyL_2", "Defaults");
+
+    config = cfg_new(file, "Config");
+    cfg_add_item(config, "KeyL_2", "Config");
+    cfg_add_item(config, "KeyL_3", "Config");
+
+    setup = cfg_load(file, "Setup");
+
+    layers = cfg_layers_new();
+    cfg_layers_push(layers, defaults);
+    cfg_layers_push(layers, config);
+    cfg_layers_push(layers, setup);
+
+    g_assert(cfg_layers_get_size(layers) == 3);
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_1"), "Defaults") == 0);
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_2"), "Config") == 0);
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_3"), "Setup") == 0);
+    g_assert(cfg_layers_get_item_layer(layers, "KeyL_3") == setup);
+    g_assert(cfg_layers_get_item_value(layers, "KeyL_4") == NULL);
+
+    g_print("Change the lower layers...\n\r");
+    cfg_add_item(defaults, "KeyL_3", "Defaults");
+    cfg_add_item(defaults, "KeyL_1", "Changed");
+
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_3"), "Setup") == 0);
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_1"), "Changed") == 0);
+
+    g_print("Remove a setup item...\n\r");
+    g_file_set_contents(file, "[Setup]\nKeyL_1=Setup\n", -1, NULL);
+    cfg_reload(setup);
+
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_1"), "Setup") == 0);
+    g_assert(g_strcmp0(cfg_layers_get_item_value(layers, "KeyL_3"), "Config") == 0);
+    g_assert(cfg_layers_get_item_layer(layers, "KeyL_3") == config);
+
+    cfg_layers_free(layers);
+    cfg_free(setup);
+    cfg_free(config);
+    cfg_free(defaults);
+}
+
+void test_config_index(void) {
+    CfgFile* cfg = NULL;
+    CfgIter iter;
+    char** keys = NULL;
+    unsigned int keysNum = 0;
+    const char* key = NULL;
+    const char* value = NULL;
+    unsigned int count = 0;
+
+    g_print("\n\rCreating a namespaced configuration...\n\r");
+    cfg = cfg_new("test.cfg", "Index");
+
+    cfg_add_item(cfg, "board.id", "3");
+    cfg_add_item(cfg, "axis.1.gain", "0.5");
+    cfg_add_item(cfg, "axis.0.offset", "10");
+    cfg_add_item(cfg, "axis.0.gain", "1.5");
+    cfg_add_item(cfg, "axis.10.gain", "2.5");
+
+    keys = cfg_get_keys(cfg, &keysNum);
+    g_assert(keysNum == 5);
+    g_assert(g_strcmp0(keys[0], "axis.0.gain") == 0);
+    g_assert(g_strcmp0(keys[4], "board.id") == 0);
+    g_assert(keys[5] == NULL);
+    g_strfreev(keys);
+
+    keys = cfg_get_keys_with_prefix(cfg, "axis.0.", &keysNum);
+    g_assert(keysNum == 2);
+    g_assert(g_strcmp0(keys[0], "axis.0.gain") == 0);
+    g_assert(g_strcmp0(keys[1], "axis.0.offset") == 0);
+    g_strfreev(keys);
+
+    /* the size is optional, the list is NULL terminated */
+    keys = cfg_get_keys_with_prefix(cfg, "motor.", NULL);
+    g_assert(keys != NULL && keys[0] == NULL);
+    g_strfreev(keys);
+
+    g_print("Iterate the 'axis.1' subtree...\n\r");
+    cfg_iter_init_prefix(&iter, cfg, "axis.1");
+
+    /* the iterator must not see items added after its initialization */
+    cfg_add_item(cfg, "axis.1.offset", "20");
+
+    while (cfg_iter_next(&iter, &key, &value)) {
+        g_print("- Key=%s,Value=%s\n\r", key, value);
+        count++;
+    }
+
+    cfg_iter_clear(&iter);
+    g_assert(count == 2);
+
+    g_print("Iterate the [axis.1, board) range...\n\r");
+    count = 0;
+    cfg_iter_init(&iter, cfg, "axis.1", "board");
+
+    while (cfg_iter_next(&iter, &key, &value)) {
+        g_print("- Key=%s,Value=%s\n\r", key, value);
+        count++;
+    }
+
+    cfg_iter_clear(&iter);
+    g_assert(count == 3);
+
+    cfg_free(cfg);
+}
+
+/***************************
+ * Ini test functions
+ ***************************/
+void ini_entry_callback(const IniEntry* entry, void* userData) {
+    GStringChunk* arena = (GStringChunk*)userData;
+
+    g_print("- Group=%s,Key=%s,Locale=%s,Value=%s\n\r",
+        ini_string_insert(arena, &entry->group),
+        ini_string_insert(arena, &entry->key),
+        ini_string_insert(arena, &entry->locale),
+        ini_string_insert_unescaped(arena, &entry->value));
+}
+
+void test_ini(void) {
+    GStringChunk* arena = NULL;
+    IniString string;
+    const char* data = NULL;
+
+    data = "# comment\n"
+           "[Group 1]\n"
+           "  Key1 =  Value 1  \r\n"
+           "\n"
+           "Key2[it]=Valore\\s2\\n\n"
+           "[Group 2]\n"
+           "Key3=";
+
+    arena = g_string_chunk_new(64);
+
+    g_print("\n\rParsing ini data...\n\r");
+    ini_parse_data(data, strlen(data), ini_entry_callback, arena);
+
+    string.str = "Key1 = ";
+    string.len = 4;
+
+    g_assert(ini_string_equal(&string, "Key1") == TRUE);
+    g_assert(ini_string_equal(&string, "Key") == FALSE);
+    g_assert(ini_string_equal(&string, "Key12") == FALSE);
+
+    string.str = "a\\tb\\\\c";
+    string.len = strlen(string.str);
+
+    g_assert(g_strcmp0(ini_string_insert_unescaped(arena, &string), "a\tb\\c") == 0);
+
+    g_string_chunk_free(arena);
+}
+
 /* The main test function */
 int main(int argc, char** argv) {
 
+	/* the localization tests use the english and the italian strings, whatever the environment */
+	g_setenv("LANGUAGE", "en:it", TRUE);
+
 	g_test_init (&argc, &argv, NULL);
 
 	g_test_add_func ("/Messages", test_messages);
+	g_test_add_func ("/Messages/Post", test_messages_post);
+	g_test_add_func ("/Messages/Queue", test_messages_queue);
+	g_test_add_func ("/Messages/Priority", test_messages_priority);
+	g_test_add_func ("/Messages/Coalesce", test_messages_coalesce);
+	g_test_add_func ("/Messages/Mailbox", test_messages_mailbox);
+	g_test_add_func ("/Messages/Source", test_messages_source);
+	g_test_add_func ("/Messages/Gather", test_messages_gather);
+	g_test_add_func ("/Messages/Publish", test_messages_publish);
+	g_test_add_func ("/Messages/Batch", test_messages_batch);
+	g_test_add_func ("/Messages/Output", test_messages_output);
+	g_test_add_func ("/Messages/Stats", test_messages_stats);
+	g_test_add_func ("/Messages/Remote", test_messages_remote);
+	g_test_add_func ("/Recorder", test_recorder);
+	g_test_add_func ("/RingBuffer", test_ring_buffer);
+	g_test_add_func ("/PerfectHash", test_perfect_hash);
+	g_test_add_func ("/Wire", test_wire);
 	g_test_add_func ("/Data", test_data);
     g_test_add_func ("/Localization", test_localization);
+    g_test_add_func ("/Localization/Tables", test_localization_tables);
+    g_test_add_func ("/Localization/Ids", test_localization_ids);
+    g_test_add_func ("/Localization/Catalog", test_localization_catalog);
+    g_test_add_func ("/Localization/Switch", test_localization_switch);
+    g_test_add_func ("/Localization/Bulk", test_localization_bulk);
     g_test_add_func ("/Engine", test_engine);
     g_test_add_func ("/Config", test_config);
+    g_test_add_func ("/Config/Reload", test_config_reload);
+    g_test_add_func ("/Config/Layers", test_config_layers);
+    g_test_add_func ("/Config/Index", test_config_index);
+    g_test_add_func ("/Ini", test_ini);
 	
 	return g_test_run();
 }
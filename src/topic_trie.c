@@ -0,0 +1,217 @@
+/*
+ * topic_trie.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "topic_trie.h"
+#include "definitions.h"
+
+#define TOPIC_SEPARATOR "."
+#define TOPIC_ANY "*"
+#define TOPIC_REST "#"
+
+/* A node of the trie. The wildcards are kept out of the children table,
+ * so matching only looks them up when they are used */
+typedef struct topicNode {
+    GHashTable* children;       /* segment -> topicNode, created on the first child */
+    struct topicNode* any;      /* the "*" child */
+    struct topicNode* rest;     /* the "#" child */
+    GPtrArray* items;           /* items of the pattern ending here */
+} topicNode;
+
+struct TopicTrie_type {
+    topicNode* root;
+};
+
+static topicNode* new_node(void) {
+    topicNode* node = NULL;
+
+    node = g_new0(topicNode, 1);
+    node->items = g_ptr_array_new();
+
+    return node;
+}
+
+static void free_node(void* data) {
+    topicNode* node = (topicNode*)data;
+
+    if (node == NULL)
+        return;
+
+    if (node->children != NULL)
+        g_hash_table_destroy(node->children);
+
+    free_node(node->any);
+    free_node(node->rest);
+
+    g_ptr_array_free(node->items, TRUE);
+    g_free(node);
+}
+
+/* it returns the child for the segment, creating it if requested */
+static topicNode* get_child(topicNode* node, const char* segment, int create) {
+    topicNode** wildcard = NULL;
+    topicNode* child = NULL;
+
+    if (g_str_equal(segment, TOPIC_ANY))
+        wildcard = &node->any;
+    else if (g_str_equal(segment, TOPIC_REST))
+        wildcard = &node->rest;
+
+    if (wildcard != NULL) {
+        if (*wildcard == NULL && create)
+            *wildcard = new_node();
+
+        return *wildcard;
+    }
+
+    if (node->children != NULL)
+        child = g_hash_table_lookup(node->children, segment);
+
+    if (child == NULL && create) {
+        if (node->children == NULL)
+            node->children = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_node);
+
+        child = new_node();
+        g_hash_table_insert(node->children, g_strdup(segment), child);
+    }
+
+    return child;
+}
+
+static topicNode* find_node(TopicTrie* trie, const char* pattern, int create) {
+    topicNode* node = trie->root;
+    char** segments = NULL;
+    size_t i = 0;
+
+    segments = g_strsplit(pattern, TOPIC_SEPARATOR, -1);
+
+    for (i = 0; segments[i] != NULL && node != NULL; i++) {
+        node = get_child(node, segments[i], create);
+    }
+
+    g_strfreev(segments);
+
+    return node;
+}
+
+static void append_items(GPtrArray* items, topicNode* node) {
+    unsigned int i = 0;
+
+    for (i = 0; i < node->items->len; i++) {
+        g_ptr_array_add(items, g_ptr_array_index(node->items, i));
+    }
+}
+
+/* A node is reached at most once for a topic, since "*" and "#" can't
+ * match the same segments of a single pattern in two ways */
+static void match_node(topicNode* node, char** segments, GPtrArray* items) {
+    topicNode* child = NULL;
+
+    if (node->rest != NULL)
+        append_items(items, node->rest);
+
+    if (*segments == NULL) {
+        append_items(items, node);
+        return;
+    }
+
+    if (node->children != NULL) {
+        child = g_hash_table_lookup(node->children, *segments);
+
+        if (child != NULL)
+            match_node(child, segments + 1, items);
+    }
+
+    if (node->any != NULL)
+        match_node(node->any, segments + 1, items);
+}
+
+/* Implementations */
+TopicTrie* tt_new(void) {
+    TopicTrie* trie = NULL;
+
+    trie = g_new(TopicTrie, 1);
+    trie->root = new_node();
+
+    return trie;
+}
+
+void tt_free(TopicTrie* trie) {
+    g_return_if_fail(trie != NULL);
+
+    free_node(trie->root);
+    g_free(trie);
+}
+
+int tt_pattern_is_valid(const char* pattern) {
+    char** segments = NULL;
+    int valid = TRUE;
+    size_t i = 0;
+
+    g_return_val_if_fail(pattern != NULL, FALSE);
+
+    segments = g_strsplit(pattern, TOPIC_SEPARATOR, -1);
+
+    for (i = 0; segments[i] != NULL && valid; i++) {
+        if (!STRING_IS_VALID(segments[i]))
+            valid = FALSE;
+        else if (g_str_equal(segments[i], TOPIC_REST) && segments[i + 1] != NULL)
+            valid = FALSE;
+    }
+
+    /* an empty pattern has no segments */
+    if (i == 0)
+        valid = FALSE;
+
+    g_strfreev(segments);
+
+    return valid;
+}
+
+void tt_insert(TopicTrie* trie, const char* pattern, void* item) {
+    g_return_if_fail(trie != NULL);
+    g_return_if_fail(tt_pattern_is_valid(pattern));
+
+    g_ptr_array_add(find_node(trie, pattern, TRUE)->items, item);
+}
+
+int tt_remove(TopicTrie* trie, const char* pattern, void* item) {
+    topicNode* node = NULL;
+
+    g_return_val_if_fail(trie != NULL, FALSE);
+    g_return_val_if_fail(pattern != NULL, FALSE);
+
+    node = find_node(trie, pattern, FALSE);
+    if (node == NULL)
+        return FALSE;
+
+    return g_ptr_array_remove(node->items, item);
+}
+
+void tt_match(TopicTrie* trie, const char* topic, GPtrArray* items) {
+    char** segments = NULL;
+
+    g_return_if_fail(trie != NULL);
+    g_return_if_fail(topic != NULL);
+    g_return_if_fail(items != NULL);
+
+    segments = g_strsplit(topic, TOPIC_SEPARATOR, -1);
+    match_node(trie->root, segments, items);
+    g_strfreev(segments);
+}
@@ -0,0 +1,49 @@
+/*
+ * topic_trie.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <glib.h>
+
+/* Abstract data type that rapresents a trie of topic patterns. A topic is a list of
+ * segments separated by dots, ie. "axis.1.position". In a pattern "*" matches exactly
+ * one segment and a final "#" matches any number of trailing segments, even none */
+struct TopicTrie_type;
+typedef struct TopicTrie_type TopicTrie;
+
+/* Creates a new trie. */
+TopicTrie* tt_new(void);
+
+/* Free up the trie resources. The items are not freed. */
+void tt_free(TopicTrie* trie);
+
+/* Returns TRUE if the pattern is valid: no empty segments and "#" only as last segment. */
+int tt_pattern_is_valid(const char* pattern);
+
+/* It adds an item to a pattern. */
+void tt_insert(TopicTrie* trie, const char* pattern, void* item);
+
+/* It removes an item from a pattern. Returns FALSE if it's not found. */
+int tt_remove(TopicTrie* trie, const char* pattern, void* item);
+
+/* It appends the items of all the patterns matching the topic to the array. */
+void tt_match(TopicTrie* trie, const char* topic, GPtrArray* items);
+
+#endif
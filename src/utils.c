@@ -36,12 +36,13 @@ const char* const* g_hash_table_return_keys_to_array(GHashTable* table, unsigned
     /* convert list to array of strings */
     names = g_malloc(length * sizeof(char*));
 
-    for (i = 0; i < length; i++) {
-        item = g_list_nth(keys, i);
+    for (item = keys; item; item = g_list_next(item)) {
         name = (char*)(item->data);
-        names[i] = g_strdup(name);
+        names[i++] = g_strdup(name);
     }
 
+    g_list_free(keys);
+
     /* assign the array length */
     **size = length;
     
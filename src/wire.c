@@ -0,0 +1,275 @@
+/*
+ * wire.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "wire.h"
+
+/* Every package is encoded as:
+ *   header: magic (2), version (1), reserved (1), length (4), name length (2), fields (2), reserved (4)
+ *   name: NUL terminated, padded
+ *   fields: type (1), reserved (3), length (4), value, padded
+ * Integers are little-endian and every part is aligned to 8 bytes, so the
+ * doubles of a decoded package can be read where they are */
+#if G_BYTE_ORDER != G_LITTLE_ENDIAN
+#error "the wire format only supports little-endian hosts"
+#endif
+
+#define WIRE_MAGIC 0x574D
+#define WIRE_ALIGNMENT 8
+#define WIRE_HEADER_SIZE 16
+#define WIRE_FIELD_HEADER_SIZE 8
+#define WIRE_IS_ALIGNED(ptr) ((GPOINTER_TO_SIZE(ptr) & (WIRE_ALIGNMENT - 1)) == 0)
+
+#define wire_align(x) (((x) + WIRE_ALIGNMENT - 1) & ~(size_t)(WIRE_ALIGNMENT - 1))
+
+typedef struct {
+    guint16 magic;
+    guint8 version;
+    guint8 reserved0;
+    guint32 length;
+    guint16 nameLength;
+    guint16 fields;
+    guint32 reserved1;
+} wireHeader;
+
+typedef struct {
+    guint8 type;
+    guint8 reserved[3];
+    guint32 length;
+} wireFieldHeader;
+
+/* it returns the length of the field value, or -1 if it can't be encoded */
+static gint64 field_length(const PackageData* data, const WireField* field) {
+    switch (field->type) {
+        case WIRE_FIELD_INT:
+        case WIRE_FIELD_DOUBLE:
+            return sizeof(gint64);
+        case WIRE_FIELD_STRING:
+            return data->field != NULL ? strlen(data->field) + 1 : 0;
+        case WIRE_FIELD_BLOB:
+            return data->field != NULL || field->length == 0 ? field->length : -1;
+    }
+
+    return -1;
+}
+
+/* Implementations */
+size_t wire_get_size(const Package* pkg, const WireDescriptor* desc) {
+    size_t size = 0;
+    gint64 length = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(pkg != NULL, 0);
+    g_return_val_if_fail(desc != NULL, 0);
+
+    if (pkg->name == NULL || pkg->size != desc->count || desc->count > G_MAXUINT16)
+        return 0;
+
+    length = strlen(pkg->name);
+    if (length > G_MAXUINT16)
+        return 0;
+
+    size = WIRE_HEADER_SIZE + wire_align(length + 1);
+
+    for (i = 0; i < desc->count; i++) {
+        length = field_length(&pkg->data[i], &desc->fields[i]);
+        if (length < 0 || length > G_MAXUINT32)
+            return 0;
+
+        size += WIRE_FIELD_HEADER_SIZE + wire_align(length);
+    }
+
+    return size <= G_MAXUINT32 ? size : 0;
+}
+
+size_t wire_encode(const Package* pkg, const WireDescriptor* desc, void* buffer, size_t size) {
+    wireHeader header;
+    wireFieldHeader fieldHeader;
+    const PackageData* data = NULL;
+    guint8* out = buffer;
+    size_t length = 0;
+    size_t total = 0;
+    guint64 value = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(buffer != NULL, 0);
+    g_return_val_if_fail(WIRE_IS_ALIGNED(buffer), 0);
+
+    total = wire_get_size(pkg, desc);
+    if (total == 0 || total > size)
+        return 0;
+
+    length = strlen(pkg->name);
+
+    memset(&header, 0, sizeof(wireHeader));
+    header.magic = GUINT16_TO_LE(WIRE_MAGIC);
+    header.version = WIRE_VERSION;
+    header.length = GUINT32_TO_LE(total);
+    header.nameLength = GUINT16_TO_LE(length);
+    header.fields = GUINT16_TO_LE(desc->count);
+
+    memcpy(out, &header, WIRE_HEADER_SIZE);
+    out += WIRE_HEADER_SIZE;
+
+    /* the padding is zeroed, so encoded packages don't leak memory content */
+    memcpy(out, pkg->name, length + 1);
+    memset(out + length + 1, 0, wire_align(length + 1) - length - 1);
+    out += wire_align(length + 1);
+
+    for (i = 0; i < desc->count; i++) {
+        data = &pkg->data[i];
+        length = field_length(data, &desc->fields[i]);
+
+        memset(&fieldHeader, 0, sizeof(wireFieldHeader));
+        fieldHeader.type = desc->fields[i].type;
+        fieldHeader.length = GUINT32_TO_LE(length);
+
+        memcpy(out, &fieldHeader, WIRE_FIELD_HEADER_SIZE);
+        out += WIRE_FIELD_HEADER_SIZE;
+
+        switch (desc->fields[i].type) {
+            case WIRE_FIELD_INT:
+                value = GUINT64_TO_LE((guint64)(gint64)GPOINTER_TO_SIZE(data->field));
+                memcpy(out, &value, sizeof(guint64));
+                break;
+            case WIRE_FIELD_DOUBLE:
+                memcpy(out, data->field, sizeof(gdouble));
+                break;
+            case WIRE_FIELD_STRING:
+            case WIRE_FIELD_BLOB:
+                if (length > 0)
+                    memcpy(out, data->field, length);
+                break;
+        }
+
+        memset(out + length, 0, wire_align(length) - length);
+        out += wire_align(length);
+    }
+
+    return total;
+}
+
+int wire_peek(const void* buffer, size_t size, size_t* length) {
+    wireHeader header;
+
+    g_return_val_if_fail(buffer != NULL || size == 0, -1);
+
+    if (size < WIRE_HEADER_SIZE)
+        return -1;
+
+    memcpy(&header, buffer, WIRE_HEADER_SIZE);
+
+    if (GUINT16_FROM_LE(header.magic) != WIRE_MAGIC || header.version != WIRE_VERSION)
+        return -1;
+
+    if (length != NULL)
+        *length = GUINT32_FROM_LE(header.length);
+
+    return GUINT16_FROM_LE(header.fields);
+}
+
+size_t wire_decode(const void* buffer, size_t size, Package* pkg, PackageData* data, unsigned int dataSize, WireField* fields) {
+    wireHeader header;
+    wireFieldHeader fieldHeader;
+    const guint8* in = buffer;
+    const guint8* end = NULL;
+    size_t total = 0;
+    size_t length = 0;
+    guint64 value = 0;
+    unsigned int count = 0;
+    unsigned int i = 0;
+
+    g_return_val_if_fail(buffer != NULL, 0);
+    g_return_val_if_fail(WIRE_IS_ALIGNED(buffer), 0);
+    g_return_val_if_fail(pkg != NULL, 0);
+    g_return_val_if_fail(data != NULL || dataSize == 0, 0);
+
+    if (wire_peek(buffer, size, &total) < 0 || total > size || total < WIRE_HEADER_SIZE)
+        return 0;
+
+    memcpy(&header, in, WIRE_HEADER_SIZE);
+    count = GUINT16_FROM_LE(header.fields);
+    length = GUINT16_FROM_LE(header.nameLength);
+
+    if (count > dataSize)
+        return 0;
+
+    end = in + total;
+    in += WIRE_HEADER_SIZE;
+
+    /* the name must be NUL terminated where the header says */
+    if (length + 1 > (size_t)(end - in) || in[length] != '\0')
+        return 0;
+
+    pkg->name = (char*)in;
+    pkg->size = count;
+    pkg->data = data;
+
+    in += wire_align(length + 1);
+
+    for (i = 0; i < count; i++) {
+        if ((size_t)(end - in) < WIRE_FIELD_HEADER_SIZE)
+            return 0;
+
+        memcpy(&fieldHeader, in, WIRE_FIELD_HEADER_SIZE);
+        in += WIRE_FIELD_HEADER_SIZE;
+
+        length = GUINT32_FROM_LE(fieldHeader.length);
+
+        if (length > (size_t)(end - in))
+            return 0;
+
+        switch (fieldHeader.type) {
+            case WIRE_FIELD_INT:
+                if (length != sizeof(guint64))
+                    return 0;
+
+                memcpy(&value, in, sizeof(guint64));
+                data[i].field = GSIZE_TO_POINTER((gsize)(gint64)GUINT64_FROM_LE(value));
+                break;
+            case WIRE_FIELD_DOUBLE:
+                if (length != sizeof(gdouble))
+                    return 0;
+
+                data[i].field = (void*)in;
+                break;
+            case WIRE_FIELD_STRING:
+                if (length > 0 && in[length - 1] != '\0')
+                    return 0;
+
+                data[i].field = length > 0 ? (void*)in : NULL;
+                break;
+            case WIRE_FIELD_BLOB:
+                data[i].field = (void*)in;
+                break;
+            default:
+                return 0;
+        }
+
+        if (fields != NULL) {
+            fields[i].type = fieldHeader.type;
+            fields[i].length = length;
+        }
+
+        in += MIN(wire_align(length), (size_t)(end - in));
+    }
+
+    return total;
+}
@@ -0,0 +1,68 @@
+/*
+ * wire.h
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include "messages.h"
+
+/* The version of the binary format written by wire_encode() */
+#define WIRE_VERSION 1
+
+/* The type of a package field */
+typedef enum {
+    WIRE_FIELD_INT,     /* an integer stored in the field pointer, ie. GINT_TO_POINTER(10) */
+    WIRE_FIELD_DOUBLE,  /* the field points to a double */
+    WIRE_FIELD_STRING,  /* the field points to a NUL terminated string, or it's NULL */
+    WIRE_FIELD_BLOB     /* the field points to a buffer of the given length */
+} wireFieldType;
+
+typedef struct {
+    wireFieldType type;
+    unsigned int length;    /* the length of a blob, in bytes. Unused otherwise */
+} WireField;
+
+/* It describes the fields of the packages of a word. It's kept apart from the package,
+ * so a package doesn't pay for it when it's not serialized. */
+typedef struct {
+    unsigned int count;
+    const WireField* fields;
+} WireDescriptor;
+
+/* Returns the size of the encoded package, 0 if it doesn't match the descriptor. */
+size_t wire_get_size(const Package* pkg, const WireDescriptor* desc);
+
+/* It encodes the package into the buffer. Returns the number of bytes written, 0 if the buffer is
+ * too small or the package doesn't match the descriptor. The buffer must be aligned to 8 bytes,
+ * and so is the returned size, so encoded packages can be written one after the other. */
+size_t wire_encode(const Package* pkg, const WireDescriptor* desc, void* buffer, size_t size);
+
+/* It decodes a package without copying it: the name, the strings, the doubles and the blobs
+ * point inside the buffer, which must be aligned to 8 bytes and valid while the package is used.
+ * The package data is stored in the data array, with room for dataSize fields, and the types
+ * and lengths of the fields in the fields array, which can be NULL.
+ * Returns the number of bytes read, 0 if the buffer doesn't contain a valid package. */
+size_t wire_decode(const void* buffer, size_t size, Package* pkg, PackageData* data, unsigned int dataSize, WireField* fields);
+
+/* Returns the number of fields of the encoded package at the beginning of the buffer, and its
+ * encoded size if it's not NULL. Returns -1 if the buffer doesn't start with a valid header. */
+int wire_peek(const void* buffer, size_t size, size_t* length);
+
+#endif
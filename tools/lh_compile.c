@@ -0,0 +1,35 @@
+/*
+ * lh_compile.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* It compiles a localization source file into a binary catalog:
+ *
+ *     lh_compile localization.txt localization.cat */
+
+#include <stdio.h>
+#include <glib.h>
+#include "../src/localization.h"
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <source> <catalog>\n", argv[0]);
+        return 1;
+    }
+
+    return lh_compile_catalog(argv[1], argv[2]) ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * lh_gen_ids.c
+ *
+ * Copyright (C) 2014 - Andrea Cervesato <sawk.ita@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* It generates the header of the string identifiers of a localization catalog:
+ *
+ *     lh_gen_ids localization.txt localization_ids.h
+ *
+ * Every key of the [locale] group gets an identifier, in the order of its first appearance,
+ * to be used with lh_get_string_id() after binding them with lh_set_string_ids(). */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "../src/ini.h"
+
+#define GEN_GROUP "locale"
+#define GEN_PREFIX "LH_STRING_"
+#define GEN_COUNT GEN_PREFIX "COUNT"
+#define GEN_KEYS GEN_PREFIX "KEYS"
+
+typedef struct {
+    GStringChunk* arena;
+    GPtrArray* keys;        /* keys in order of appearance */
+    GHashTable* seen;       /* keys already added */
+} genCatalog;
+
+static void gen_add_entry(const IniEntry* entry, void* userData) {
+    genCatalog* catalog = (genCatalog*)userData;
+    char* key = NULL;
+
+    if (!ini_string_equal(&entry->group, GEN_GROUP))
+        return;
+
+    key = ini_string_insert_const(catalog->arena, &entry->key);
+
+    if (g_hash_table_contains(catalog->seen, key))
+        return;
+
+    g_hash_table_add(catalog->seen, key);
+    g_ptr_array_add(catalog->keys, key);
+}
+
+/* The identifier of a key, ie. LH_STRING_SAVE_AS for "Save as" */
+static char* gen_get_name(const char* key) {
+    GString* name = NULL;
+    const char* c = NULL;
+
+    name = g_string_new(GEN_PREFIX);
+
+    for (c = key; *c; c++) {
+        g_string_append_c(name, g_ascii_isalnum(*c) ? g_ascii_toupper(*c) : '_');
+    }
+
+    return g_string_free(name, FALSE);
+}
+
+/* It escapes the key as a C string literal */
+static void gen_append_literal(GString* header, const char* key) {
+    const char* c = NULL;
+
+    g_string_append_c(header, '"');
+
+    for (c = key; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            g_string_append_c(header, '\\');
+
+        g_string_append_c(header, *c);
+    }
+
+    g_string_append_c(header, '"');
+}
+
+static GString* gen_header(const char* source, GPtrArray* keys) {
+    GHashTable* names = NULL;
+    GString* header = NULL;
+    char* basename = NULL;
+    char* name = NULL;
+    const char* key = NULL;
+    unsigned int i = 0;
+
+    header = g_string_new(NULL);
+    names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    basename = g_path_get_basename(source);
+
+    /* the names the header defines itself, they have no key */
+    g_hash_table_insert(names, g_strdup(GEN_COUNT), NULL);
+    g_hash_table_insert(names, g_strdup(GEN_KEYS), NULL);
+
+    g_string_append_printf(header,
+        "/*\n"
+        " * localization_ids.h\n"
+        " *\n"
+        " * Generated by lh_gen_ids from %s, do not edit.\n"
+        " */\n\n"
+        "#ifndef LOCALIZATION_IDS_H\n"
+        "#define LOCALIZATION_IDS_H\n\n"
+        "/* The identifiers of the localized strings, see lh_get_string_id() */\n"
+        "typedef enum {\n", basename);
+
+    for (i = 0; i < keys->len; i++) {
+        name = gen_get_name(g_ptr_array_index(keys, i));
+
+        /* ie. "Save as" and "Save.as", or "Count" and the sentinel */
+        if (g_hash_table_lookup_extended(names, name, NULL, (gpointer*)&key)) {
+            if (key != NULL)
+                fprintf(stderr, "lh_gen_ids: the keys '%s' and '%s' have the same identifier, %s\n",
+                    key, (char*)g_ptr_array_index(keys, i), name);
+            else
+                fprintf(stderr, "lh_gen_ids: the key '%s' has a reserved identifier, %s\n",
+                    (char*)g_ptr_array_index(keys, i), name);
+
+            g_free(name);
+            g_string_free(header, TRUE);
+            header = NULL;
+            goto cleanup;
+        }
+
+        g_string_append_printf(header, "    %s,\n", name);
+        g_hash_table_insert(names, name, g_ptr_array_index(keys, i));
+    }
+
+    g_string_append(header,
+        "    " GEN_COUNT "\n"
+        "} lhStringId;\n\n"
+        "/* The keys of the identifiers, in the same order, for lh_set_string_ids() */\n"
+        "#define " GEN_KEYS " {");
+
+    for (i = 0; i < keys->len; i++) {
+        g_string_append(header, i > 0 ? ", " : " ");
+        gen_append_literal(header, g_ptr_array_index(keys, i));
+    }
+
+    g_string_append(header, " }\n\n#endif\n");
+
+cleanup:
+    g_free(basename);
+    g_hash_table_destroy(names);
+
+    return header;
+}
+
+int main(int argc, char** argv) {
+    genCatalog catalog;
+    GString* header = NULL;
+    GError* error = NULL;
+    int status = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <catalog> <header>\n", argv[0]);
+        return 1;
+    }
+
+    catalog.arena = g_string_chunk_new(4096);
+    catalog.keys = g_ptr_array_new();
+    catalog.seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+    if (!ini_parse_file(argv[1], gen_add_entry, &catalog)) {
+        status = 1;
+    } else if ((header = gen_header(argv[1], catalog.keys)) == NULL) {
+        status = 1;
+    } else if (!g_file_set_contents(argv[2], header->str, header->len, &error)) {
+        fprintf(stderr, "lh_gen_ids: %s\n", error->message);
+        g_error_free(error);
+        status = 1;
+    }
+
+    if (header != NULL)
+        g_string_free(header, TRUE);
+
+    g_hash_table_destroy(catalog.seen);
+    g_ptr_array_free(catalog.keys, TRUE);
+    g_string_chunk_free(catalog.arena);
+
+    return status;
+}